@@ -0,0 +1,288 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "admission_control.h"
+#include "event_logger.h"
+
+#include <grpc_mock_server_logger.h>
+
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+namespace {
+
+// Multiplicative decrease factor applied on overload
+constexpr double LIMIT_BACKOFF_RATIO = 0.9;
+// A call is considered slow if its latency exceeds the long-term average that many times
+constexpr double LATENCY_TOLERANCE = 2.0;
+// Smoothing factor of the long-term latency average
+constexpr double LATENCY_AVERAGE_ALPHA = 0.05;
+// The latency signal is ignored until the average is meaningful
+constexpr uint64_t MIN_LATENCY_SAMPLES = 10;
+
+bool isOverloadStatus(const grpc::Status &status) {
+    return status.error_code() == grpc::StatusCode::RESOURCE_EXHAUSTED
+        || status.error_code() == grpc::StatusCode::UNAVAILABLE
+        || status.error_code() == grpc::StatusCode::DEADLINE_EXCEEDED;
+}
+
+} // anonymous namespace
+
+ConcurrencyLimiter::ConcurrencyLimiter(
+    int initial_limit,
+    int min_limit,
+    int max_limit,
+    bool adaptive,
+    size_t queue_size,
+    std::chrono::milliseconds queue_timeout
+)
+    : m_limit(initial_limit)
+    , m_min_limit(min_limit)
+    , m_max_limit(max_limit)
+    , m_adaptive(adaptive)
+    , m_queue_size(queue_size)
+    , m_queue_timeout(queue_timeout) {
+    assert(min_limit > 0 && min_limit <= initial_limit && initial_limit <= max_limit);
+}
+
+bool ConcurrencyLimiter::hasFreeSlot() const {
+    return static_cast<double>(m_in_flight) < std::floor(m_limit);
+}
+
+bool ConcurrencyLimiter::acquire(std::chrono::system_clock::time_point deadline) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!hasFreeSlot()) {
+        // Wait in the short bounded queue, the rest is rejected at once
+        if (m_queued >= m_queue_size || m_queue_timeout.count() == 0) {
+            m_rejected++;
+            return false;
+        }
+
+        m_queued++;
+        auto wait_deadline = std::min(deadline, std::chrono::system_clock::now() + m_queue_timeout);
+        bool acquired = m_released_cv.wait_until(lock, wait_deadline, [this]() { return hasFreeSlot(); });
+        m_queued--;
+        if (!acquired) {
+            m_rejected++;
+            return false;
+        }
+    }
+
+    m_in_flight++;
+    m_admitted++;
+    return true;
+}
+
+bool ConcurrencyLimiter::tryAcquire() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!hasFreeSlot()) return false;
+
+    m_in_flight++;
+    m_admitted++;
+    return true;
+}
+
+void ConcurrencyLimiter::release(std::chrono::microseconds latency, bool overloaded) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        assert(m_in_flight > 0);
+        m_in_flight--;
+
+        if (m_adaptive) {
+            auto latency_us = static_cast<double>(latency.count());
+            bool slow = m_latency_samples >= MIN_LATENCY_SAMPLES
+                && latency_us > m_latency_average_us * LATENCY_TOLERANCE;
+
+            m_latency_average_us = m_latency_samples == 0
+                ? latency_us
+                : m_latency_average_us + LATENCY_AVERAGE_ALPHA * (latency_us - m_latency_average_us);
+            m_latency_samples++;
+
+            auto now = std::chrono::steady_clock::now();
+            if (overloaded || slow) {
+                // Back off at most once per average call duration, otherwise a single congestion
+                // episode seen by all the running calls would collapse the limit
+                auto average = std::chrono::microseconds(static_cast<int64_t>(m_latency_average_us));
+                if (now - m_last_decrease_at >= average) {
+                    m_limit = std::max(m_min_limit, m_limit * LIMIT_BACKOFF_RATIO);
+                    m_last_decrease_at = now;
+                }
+            }
+            else if (static_cast<double>(m_in_flight + 1) * 2.0 >= m_limit) {
+                // Grow only if the limit is actually used, so that an idle period does not inflate it
+                m_limit = std::min(m_max_limit, m_limit + 1.0 / m_limit);
+            }
+        }
+    }
+    m_released_cv.notify_one();
+}
+
+void ConcurrencyLimiter::cancel() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        assert(m_in_flight > 0);
+        m_in_flight--;
+    }
+    m_released_cv.notify_one();
+}
+
+grpc_mock_server::AdmissionStatistics ConcurrencyLimiter::statistics() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    grpc_mock_server::AdmissionStatistics result;
+    result.limit = m_limit;
+    result.in_flight = m_in_flight;
+    result.queued = m_queued;
+    result.admitted = m_admitted;
+    result.rejected = m_rejected;
+    return result;
+}
+
+AdmissionController::Permit::~Permit() {
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - m_started_at
+    );
+    if (m_method_limiter) m_method_limiter->release(latency, m_overloaded);
+    if (m_global_limiter) m_global_limiter->release(latency, m_overloaded);
+}
+
+void AdmissionController::Permit::setStatus(const grpc::Status &status) {
+    m_overloaded = isOverloadStatus(status);
+}
+
+void AdmissionController::setLimits(
+    int global_limit,
+    int method_initial_limit,
+    int method_min_limit,
+    int method_max_limit,
+    int queue_size,
+    int queue_timeout_ms
+) {
+    assert(global_limit >= 0);
+    assert(method_min_limit > 0 && method_min_limit <= method_initial_limit && method_initial_limit <= method_max_limit);
+    assert(queue_size >= 0 && queue_timeout_ms >= 0);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_enabled = true;
+    m_method_initial_limit = method_initial_limit;
+    m_method_min_limit = method_min_limit;
+    m_method_max_limit = method_max_limit;
+    m_queue_size = static_cast<size_t>(queue_size);
+    m_queue_timeout = std::chrono::milliseconds(queue_timeout_ms);
+
+    // The global limit protects the server threads, so it is fixed rather than adaptive
+    m_global_limiter = global_limit > 0
+        ? std::make_shared<ConcurrencyLimiter>(global_limit, global_limit, global_limit, false, m_queue_size, m_queue_timeout)
+        : nullptr;
+    m_method_limiters.clear();
+
+    SystemLogger->info(
+        "Admission control: global limit {}, method limit {} ({}..{}), queue {} for {} ms",
+        global_limit,
+        method_initial_limit,
+        method_min_limit,
+        method_max_limit,
+        queue_size,
+        queue_timeout_ms
+    );
+}
+
+std::shared_ptr<ConcurrencyLimiter> AdmissionController::methodLimiter(const std::string &method) {
+    auto &limiter = m_method_limiters[method];
+    if (!limiter) {
+        limiter = std::make_shared<ConcurrencyLimiter>(
+            m_method_initial_limit,
+            m_method_min_limit,
+            m_method_max_limit,
+            true,
+            m_queue_size,
+            m_queue_timeout
+        );
+    }
+    return limiter;
+}
+
+grpc::Status AdmissionController::admit(grpc::ServerContextBase *server_context, const std::string &method, Permit &permit) {
+    std::shared_ptr<ConcurrencyLimiter> method_limiter;
+    std::shared_ptr<ConcurrencyLimiter> global_limiter;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_enabled) return grpc::Status::OK;
+
+        method_limiter = methodLimiter(method);
+        global_limiter = m_global_limiter;
+    }
+
+    auto deadline = server_context != nullptr
+        ? server_context->deadline()
+        : std::chrono::system_clock::time_point::max();
+
+    if (!method_limiter->acquire(deadline)) {
+        GMS_LOG_DEBUG_RATE_LIMITED(LogCategory::Upstream, 10, "Call of '{}' rejected: method concurrency limit reached", method);
+        return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Method concurrency limit reached");
+    }
+    if (global_limiter && !global_limiter->acquire(deadline)) {
+        method_limiter->cancel();
+        GMS_LOG_DEBUG_RATE_LIMITED(LogCategory::Upstream, 10, "Call of '{}' rejected: global concurrency limit reached", method);
+        return grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "Global concurrency limit reached");
+    }
+
+    permit.m_method_limiter = std::move(method_limiter);
+    permit.m_global_limiter = std::move(global_limiter);
+    permit.m_started_at = std::chrono::steady_clock::now();
+    return grpc::Status::OK;
+}
+
+bool AdmissionController::tryAdmit(const std::string &method, Permit &permit) {
+    std::shared_ptr<ConcurrencyLimiter> method_limiter;
+    std::shared_ptr<ConcurrencyLimiter> global_limiter;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_enabled) return true;
+
+        method_limiter = methodLimiter(method);
+        global_limiter = m_global_limiter;
+    }
+
+    if (!method_limiter->tryAcquire()) return false;
+    if (global_limiter && !global_limiter->tryAcquire()) {
+        method_limiter->cancel();
+        return false;
+    }
+
+    permit.m_method_limiter = std::move(method_limiter);
+    permit.m_global_limiter = std::move(global_limiter);
+    permit.m_started_at = std::chrono::steady_clock::now();
+    return true;
+}
+
+grpc_mock_server::AdmissionStatistics AdmissionController::statistics(const std::string &method) const {
+    std::shared_ptr<ConcurrencyLimiter> limiter;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (method.empty()) {
+            limiter = m_global_limiter;
+        }
+        else {
+            auto iter = m_method_limiters.find(method);
+            if (iter != m_method_limiters.end()) limiter = iter->second;
+        }
+    }
+    return limiter ? limiter->statistics() : grpc_mock_server::AdmissionStatistics();
+}
@@ -0,0 +1,140 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_ADMISSION_CONTROL_H
+#define GRPC_MOCK_SERVER_ADMISSION_CONTROL_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <unordered_map>
+
+#include <grpc++/grpc++.h>
+
+#include "grpc_mock_server_library.h"
+
+/// <summary>
+/// Concurrency limit adapted with AIMD: it grows additively while calls complete in time
+/// and shrinks multiplicatively when the latency jumps above its long-term average
+/// or the upstream reports an overload
+/// </summary>
+class ConcurrencyLimiter {
+    mutable std::mutex m_mutex;
+    std::condition_variable m_released_cv;
+
+    double m_limit;
+    double m_min_limit;
+    double m_max_limit;
+    bool m_adaptive;
+    size_t m_queue_size;
+    std::chrono::milliseconds m_queue_timeout;
+
+    uint64_t m_in_flight = 0;
+    uint64_t m_queued = 0;
+    uint64_t m_admitted = 0;
+    uint64_t m_rejected = 0;
+
+    double m_latency_average_us = 0.0;
+    uint64_t m_latency_samples = 0;
+    std::chrono::steady_clock::time_point m_last_decrease_at;
+
+    bool hasFreeSlot() const;
+
+public:
+    ConcurrencyLimiter(
+        int initial_limit,
+        int min_limit,
+        int max_limit,
+        bool adaptive,
+        size_t queue_size,
+        std::chrono::milliseconds queue_timeout
+    );
+
+    // Returns false if the call must be rejected
+    bool acquire(std::chrono::system_clock::time_point deadline);
+    // Takes a free slot only, neither waiting nor counting a rejection
+    bool tryAcquire();
+    void release(std::chrono::microseconds latency, bool overloaded);
+    // Gives the slot back without affecting the limit
+    void cancel();
+
+    grpc_mock_server::AdmissionStatistics statistics() const;
+};
+
+class AdmissionController {
+public:
+    // Admission of a single call, gives the slots back on destruction
+    class Permit {
+        std::shared_ptr<ConcurrencyLimiter> m_global_limiter;
+        std::shared_ptr<ConcurrencyLimiter> m_method_limiter;
+        std::chrono::steady_clock::time_point m_started_at;
+        bool m_overloaded = false;
+
+        friend class AdmissionController;
+
+    public:
+        Permit() = default;
+        Permit(const Permit&) = delete;
+        Permit &operator=(const Permit&) = delete;
+        ~Permit();
+
+        void setStatus(const grpc::Status &status);
+    };
+
+private:
+    mutable std::mutex m_mutex;
+    bool m_enabled = false;
+    int m_method_initial_limit = 0;
+    int m_method_min_limit = 0;
+    int m_method_max_limit = 0;
+    size_t m_queue_size = 0;
+    std::chrono::milliseconds m_queue_timeout { 0 };
+    // Limiters are shared with the permits, so that the limits may be changed while calls are running
+    std::shared_ptr<ConcurrencyLimiter> m_global_limiter;
+    std::unordered_map<std::string, std::shared_ptr<ConcurrencyLimiter>> m_method_limiters;
+
+    std::shared_ptr<ConcurrencyLimiter> methodLimiter(const std::string &method);
+
+public:
+    AdmissionController() = default;
+
+    AdmissionController(const AdmissionController&) = delete;
+    AdmissionController &operator=(const AdmissionController&) = delete;
+
+    // Zero global limit means no global limit
+    void setLimits(
+        int global_limit,
+        int method_initial_limit,
+        int method_min_limit,
+        int method_max_limit,
+        int queue_size,
+        int queue_timeout_ms
+    );
+
+    // Fails fast with RESOURCE_EXHAUSTED when both the limit and the wait queue are full
+    grpc::Status admit(grpc::ServerContextBase *server_context, const std::string &method, Permit &permit);
+    // Admits an optional extra upstream call, such as a hedged attempt, only if both limits have a free slot now
+    bool tryAdmit(const std::string &method, Permit &permit);
+
+    // Empty method name means the global limit
+    grpc_mock_server::AdmissionStatistics statistics(const std::string &method) const;
+};
+
+#endif // GRPC_MOCK_SERVER_ADMISSION_CONTROL_H
@@ -17,13 +17,31 @@
  */
 
 #include "business_logic.h"
+#include "tls_session.h"
+#include "upstream_proxy.h"
+#include "admission_control.h"
+#include "upstream_router.h"
+#include "pass_through_service.h"
+#include "tuning_profile.h"
+#include "traffic_capture.h"
+#include "rpc_tracing.h"
+#include "event_logger.h"
+#include "history_writer.h"
+#include "dataset_bundle.h"
+#include "synthetic_responses.h"
 
 #include <grpc_mock_server_logger.h>
+#include <grpcpp/security/tls_certificate_provider.h>
+#include <grpcpp/security/tls_credentials_options.h>
 
 // Generated headers
 #include <gmsServices.h>
 #include <common/common.stub.h>
 
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+
 #include <sqlite3.h>
 #include <SQLiteCpp/SQLiteCpp.h>
 #include <pugixml.hpp>
@@ -37,25 +55,114 @@
 
 namespace {
 
-std::shared_ptr<grpc::ServerCredentials> createLocalServerCredentials(
-    bool use_ssl,
+// Number of TLS sessions kept for resumption by the channels the library creates
+constexpr size_t TLS_SESSION_CACHE_CAPACITY = 1024;
+
+// Time the server thread has to close the database after the calls were drained
+constexpr auto SERVER_STOP_GRACE_PERIOD = std::chrono::seconds(10);
+
+// Loopback connection to the local server, so it only waits that long if the server is broken
+constexpr auto SERVER_HANDSHAKE_PROBE_TIMEOUT = std::chrono::seconds(1);
+
+// Time a history payload read waits for the history writer to commit
+constexpr int HISTORY_READ_BUSY_TIMEOUT_MS = 1000;
+
+const char *const SERVER_CERT_FILE_NAME = "server.crt";
+const char *const SERVER_KEY_FILE_NAME = "server.key";
+const char *const CA_CERT_FILE_NAME = "ca.crt";
+const char *const CURRENT_CERTIFICATES_DIR_NAME = "current";
+
+const char *const UNIX_ADDRESS_PREFIX = "unix:";
+const char *const UNIX_ABSTRACT_ADDRESS_PREFIX = "unix-abstract:";
+
+bool isUnixAddress(const std::string &address) {
+    return address.rfind(UNIX_ADDRESS_PREFIX, 0) == 0 || address.rfind(UNIX_ABSTRACT_ADDRESS_PREFIX, 0) == 0;
+}
+
+// The socket file left by a previous (crashed) run would make bind() fail
+void removeStaleUnixSocket(const std::string &address) {
+    if (address.rfind(UNIX_ADDRESS_PREFIX, 0) != 0) return;
+
+    auto socket_path = address.substr(strlen(UNIX_ADDRESS_PREFIX));
+    // Both "unix:path" and "unix:///absolute/path" forms are allowed
+    if (socket_path.rfind("//", 0) == 0) socket_path = socket_path.substr(2);
+
+    std::error_code error;
+    if (std::filesystem::is_socket(socket_path, error)) {
+        std::filesystem::remove(socket_path, error);
+    }
+}
+
+bool writeTextFile(const std::filesystem::path &file_path, const std::string &data) {
+    std::ofstream file(file_path, std::ios::binary | std::ios::trunc);
+    if (!file) return false;
+    file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    return static_cast<bool>(file);
+}
+
+// Writes the certificates into a new generation directory and then atomically re-points
+// the `current` symlink to it: the gRPC file watcher must never see a key from one pair
+// and a certificate from another
+bool writeCertificateGeneration(
+    const std::filesystem::path &directory,
     const std::string &server_cert_data,
     const std::string &server_key_data,
     const std::string &ca_cert_data
 ) {
-    if (use_ssl) {
-        assert(!server_cert_data.empty());
-        assert(!server_key_data.empty());
-        assert(!ca_cert_data.empty());
+    namespace fs = std::filesystem;
 
-        grpc::SslServerCredentialsOptions ssl_opts;
-        ssl_opts.pem_key_cert_pairs.push_back({ server_key_data, server_cert_data });
-        ssl_opts.pem_root_certs = ca_cert_data;
-        return grpc::SslServerCredentials(ssl_opts);
+    std::error_code error;
+    auto generation_name = fmt::format(
+        "generation-{}",
+        std::chrono::steady_clock::now().time_since_epoch().count()
+    );
+    auto generation_path = directory / generation_name;
+    fs::create_directories(generation_path, error);
+    if (error) {
+        SystemLogger->error("Unable to create directory '{}': {}", generation_path.generic_string(), error.message());
+        return false;
     }
-    else {
-        return grpc::InsecureServerCredentials();
+
+    if (!writeTextFile(generation_path / SERVER_CERT_FILE_NAME, server_cert_data)
+        || !writeTextFile(generation_path / SERVER_KEY_FILE_NAME, server_key_data)
+        || !writeTextFile(generation_path / CA_CERT_FILE_NAME, ca_cert_data)) {
+        SystemLogger->error("Unable to write certificates into '{}'", generation_path.generic_string());
+        return false;
+    }
+
+    auto current_path = directory / CURRENT_CERTIFICATES_DIR_NAME;
+    auto link_path = directory / "current.tmp";
+    fs::remove(link_path, error);
+    fs::create_directory_symlink(generation_name, link_path, error);
+    if (!error) {
+        fs::rename(link_path, current_path, error);
     }
+    if (error) {
+        // Symlinks may be unavailable (e.g. on Windows without developer mode), so fall back
+        // to the plain non-atomic copy
+        SystemLogger->warn("Unable to switch certificates symlink: {}", error.message());
+        fs::remove(link_path, error);
+        fs::create_directories(current_path, error);
+        fs::copy(
+            generation_path,
+            current_path,
+            fs::copy_options::overwrite_existing | fs::copy_options::recursive,
+            error
+        );
+        if (error) {
+            SystemLogger->error("Unable to copy certificates into '{}'", current_path.generic_string());
+            return false;
+        }
+    }
+
+    // Drop the previous generations
+    for (const auto &entry : fs::directory_iterator(directory, error)) {
+        auto name = entry.path().filename().string();
+        if (name.rfind("generation-", 0) == 0 && name != generation_name) {
+            fs::remove_all(entry.path(), error);
+        }
+    }
+    return true;
 }
 
 std::shared_ptr<grpc::ChannelCredentials> createLocalChannelCredentials(bool use_ssl, const std::string &cert_data) {
@@ -71,13 +178,6 @@ std::shared_ptr<grpc::ChannelCredentials> createLocalChannelCredentials(bool use
     }
 }
 
-gpr_timespec grpc_timeout_milliseconds_to_deadline(int64_t time_ms) {
-    return gpr_time_add(
-        gpr_now(GPR_CLOCK_MONOTONIC),
-        gpr_time_from_micros(static_cast<int64_t>(1e3) * time_ms, GPR_TIMESPAN)
-    );
-}
-
 bool parsePackagesXml(const std::string &data, std::vector<std::string> &output) {
     SystemLogger->info("Parsing 'packages.xml'...");
 
@@ -96,7 +196,7 @@ bool parsePackagesXml(const std::string &data, std::vector<std::string> &output)
             + "/" + node.attribute("name").as_string();
         output.push_back(full_method_name);
 
-        SystemLogger->info("Method '{}' found", full_method_name);
+        GMS_LOG_DEBUG(LogCategory::Config, "Method '{}' found", full_method_name);
     }
 
     SystemLogger->info("'packages.xml' was successfully parsed: {} methods found", output.size());
@@ -105,10 +205,25 @@ bool parsePackagesXml(const std::string &data, std::vector<std::string> &output)
 
 } // anonymous namespace
 
-BusinessLogic::BusinessLogic() {
+BusinessLogic::BusinessLogic()
+    : m_history_writer(std::make_unique<HistoryWriter>())
+    , m_tls_session_tracker(std::make_unique<TlsSessionTracker>(TLS_SESSION_CACHE_CAPACITY))
+    , m_admission_controller(std::make_unique<AdmissionController>())
+    , m_upstream_router(std::make_unique<UpstreamRouter>([this](const std::string &target) {
+        return createRemoteChannel(target);
+    }))
+    , m_upstream_proxy(std::make_unique<UpstreamProxy>(m_admission_controller.get(), m_upstream_router.get()))
+    , m_traffic_capture(std::make_unique<TrafficCapture>()) {
 }
 
 BusinessLogic::~BusinessLogic() {
+#ifndef ANDROID
+    // A joinable thread must not be destroyed
+    if (serverState() != grpc_mock_server::SERVER_STOPPED) {
+        stopServer(std::chrono::milliseconds(0));
+    }
+    waitForServerStopped(std::chrono::milliseconds::max());
+#endif
 }
 
 BusinessLogic &BusinessLogic::getInstance() {
@@ -118,9 +233,7 @@ BusinessLogic &BusinessLogic::getInstance() {
 
 bool BusinessLogic::isRemoteServerAvailable() const {
     auto channel = createRemoteChannel();
-    auto was_connected = channel->WaitForConnected(grpc_timeout_milliseconds_to_deadline(1000));
-    auto state = channel->GetState(true);
-    return state == GRPC_CHANNEL_READY;
+    return m_tls_session_tracker->waitForConnected(channel, std::chrono::milliseconds(1000));
 }
 
 void BusinessLogic::setDatabaseFilePath(const std::string &database_file_path) {
@@ -131,9 +244,11 @@ void BusinessLogic::setDatabaseFilePath(const std::string &database_file_path) {
 void BusinessLogic::setPackagesXmlData(const std::string &packages_xml_data) {
     assert(!packages_xml_data.empty());
     m_packages_xml_data = packages_xml_data;
+    m_method_names.clear();
 }
 
 bool BusinessLogic::openDatabase() {
+    std::lock_guard<std::mutex> lock(m_database_mutex);
     // Open the database file
     assert(!m_database_file_path.empty());
     m_database.reset(new SQLite::Database(m_database_file_path, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE));
@@ -144,14 +259,14 @@ bool BusinessLogic::openDatabase() {
     m_database->exec("DROP TABLE IF EXISTS methods");
     m_database->exec("CREATE TABLE methods (id INTEGER PRIMARY KEY, name TEXT)");
     // Add the methods from packages.xml
-    std::vector<std::string> method_names;
-    if (!parsePackagesXml(m_packages_xml_data, method_names)) {
+    if (m_method_names.empty() && !parsePackagesXml(m_packages_xml_data, m_method_names)) {
+        m_method_names.clear();
         SystemLogger->error("Unable to parse assets/packages.xml!");
         return false;
     }
     try {
         SQLite::Transaction transaction(*m_database);
-        for (const auto &method_name : method_names) {
+        for (const auto &method_name : m_method_names) {
             auto insert_query = fmt::format("INSERT INTO methods VALUES (NULL, \"{}\")", method_name);
             int nb = m_database->exec(insert_query);
             assert(nb == 1);
@@ -166,14 +281,60 @@ bool BusinessLogic::openDatabase() {
 
     // 2) Create a table for storing gRPC methods calls history
     m_database->exec("DROP TABLE IF EXISTS history");
-    m_database->exec("CREATE TABLE history (id INTEGER PRIMARY KEY, time INTEGER, method_id INTEGER, request_json TEXT, status INTEGER, response_json TEXT)");
+    // The request and response bodies are stored once per content in the 'payloads' table
+    PayloadStore::createTables(*m_database);
+    m_database->exec("CREATE TABLE history (id INTEGER PRIMARY KEY, time INTEGER, method_id INTEGER, request_payload_id INTEGER, status INTEGER, response_payload_id INTEGER)");
+
+    m_history_writer->start(m_database.get(), m_history_payload_settings);
     return true;
 }
 
 void BusinessLogic::closeDatabase() {
+    // Write the queued history first
+    m_history_writer->stop();
+    std::lock_guard<std::mutex> lock(m_database_mutex);
     m_database.reset(nullptr);
 }
 
+bool BusinessLogic::setHistoryCompression(bool enabled, int level, bool train_dictionary) {
+    PayloadStore::Settings settings;
+    settings.compression = enabled;
+    settings.compression_level = level;
+    settings.train_dictionary = train_dictionary;
+
+    std::string error;
+    if (!PayloadStore::validateSettings(settings, error)) {
+        SystemLogger->error("Invalid history compression settings: {}", error);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_database_mutex);
+    m_history_payload_settings = settings;
+    return true;
+}
+
+bool BusinessLogic::readHistoryPayload(int64_t payload_id, std::string &data) {
+    std::lock_guard<std::mutex> lock(m_database_mutex);
+    if (!m_database) {
+        SystemLogger->error("Unable to read history payload {}: database is not open", payload_id);
+        return false;
+    }
+
+    // The history writer thread may be in the middle of a transaction on the server connection,
+    // so the payload is read with a connection of its own
+    std::string error;
+    try {
+        SQLite::Database database(m_database_file_path, SQLite::OPEN_READONLY);
+        database.setBusyTimeout(HISTORY_READ_BUSY_TIMEOUT_MS);
+        if (PayloadStore::read(database, payload_id, data, error)) return true;
+    }
+    catch (const SQLite::Exception &exc) {
+        error = exc.getErrorStr();
+    }
+    SystemLogger->error("Unable to read history payload {}: {}", payload_id, error);
+    return false;
+}
+
 void BusinessLogic::insertHistoryRow(
     time_t time,
     const std::string &method,
@@ -181,28 +342,16 @@ void BusinessLogic::insertHistoryRow(
     int status,
     const std::string &response_json
 ) {
-    assert(m_database);
-
-    try {
-        auto insert_query = fmt::format(
-            "INSERT INTO history VALUES (NULL, {}, (SELECT id FROM methods WHERE name = '{}'), '{}', {}, '{}')",
-            time,
-            method,
-            request_json,
-            status,
-            response_json
-        );
-        int nb = m_database->exec(insert_query);
-        assert(nb == 1);
-    }
-    catch (const SQLite::Exception &exc) {
-        SystemLogger->error("Unable to add new history row to database: {}", exc.getErrorStr());
+    TraceSpan trace_span("history_write");
+    if (!m_history_writer->add(time, method, request_json, status, response_json)) {
+        GMS_LOG_DEBUG_RATE_LIMITED(LogCategory::Storage, 1, "History row of '{}' was dropped: database is not open", method);
     }
 }
 
 void BusinessLogic::setRemoteServerCertificateData(const std::string &data) {
     assert(!data.empty());
     m_remote_server_certificate_data = data;
+    resetRemoteChannel();
 }
 
 void BusinessLogic::setLocalServerCertificateData(
@@ -213,25 +362,278 @@ void BusinessLogic::setLocalServerCertificateData(
     assert(!server_cert_data.empty());
     assert(!server_key_data.empty());
     assert(!ca_cert_data.empty());
-    
+
+    // The server credentials are created from these under the same lock
+    std::lock_guard<std::mutex> lock(m_lifecycle_mutex);
     m_local_server_cert_data = server_cert_data;
     m_local_server_key_data = server_key_data;
     m_local_ca_cert_data = ca_cert_data;
+
+    // The running server watches the published certificates, so the new ones
+    // will be picked up without restart
+    if (m_server_state != grpc_mock_server::SERVER_STOPPED && m_certificate_directory_published) {
+        if (publishLocalServerCertificates()) {
+            m_tls_session_tracker->onCertificateUpdated();
+            SystemLogger->info("Local server certificate was updated");
+        }
+    }
+}
+
+void BusinessLogic::setLocalServerCertificateFiles(
+    const std::string &server_cert_path,
+    const std::string &server_key_path,
+    const std::string &ca_cert_path,
+    unsigned int refresh_interval_sec
+) {
+    assert(!server_cert_path.empty());
+    assert(!server_key_path.empty());
+    assert(!ca_cert_path.empty());
+    assert(refresh_interval_sec > 0);
+
+    m_local_server_cert_path = server_cert_path;
+    m_local_server_key_path = server_key_path;
+    m_local_ca_cert_path = ca_cert_path;
+    m_certificate_refresh_interval_sec = refresh_interval_sec;
+}
+
+void BusinessLogic::setCertificateDirectory(const std::string &certificate_directory) {
+    assert(!certificate_directory.empty());
+    m_certificate_directory = certificate_directory;
+}
+
+bool BusinessLogic::publishLocalServerCertificates() {
+    assert(!m_certificate_directory.empty());
+
+    return writeCertificateGeneration(
+        m_certificate_directory,
+        m_local_server_cert_data,
+        m_local_server_key_data,
+        m_local_ca_cert_data
+    );
+}
+
+grpc_mock_server::TlsStatistics BusinessLogic::tlsStatistics() const {
+    return m_tls_session_tracker->statistics();
+}
+
+UpstreamProxy &BusinessLogic::upstreamProxy() {
+    return *m_upstream_proxy;
+}
+
+AdmissionController &BusinessLogic::admissionController() {
+    return *m_admission_controller;
+}
+
+UpstreamRouter &BusinessLogic::upstreamRouter() {
+    return *m_upstream_router;
+}
+
+TrafficCapture &BusinessLogic::trafficCapture() {
+    return *m_traffic_capture;
+}
+
+bool BusinessLogic::loadDatasetBundle(const std::string &bundle_path) {
+    std::shared_ptr<DatasetBundle> bundle;
+    if (!bundle_path.empty()) {
+        bundle = std::make_shared<DatasetBundle>();
+        std::string error;
+        if (!bundle->open(bundle_path, error)) {
+            SystemLogger->error("Unable to load dataset bundle: {}", error);
+            return false;
+        }
+        SystemLogger->info("Dataset bundle '{}' loaded: {} fixtures", bundle->datasetName(), bundle->size());
+    }
+
+    std::lock_guard<std::mutex> lock(m_dataset_bundle_mutex);
+    m_dataset_bundle = std::move(bundle);
+    return true;
+}
+
+std::shared_ptr<const DatasetBundle> BusinessLogic::datasetBundle() const {
+    std::lock_guard<std::mutex> lock(m_dataset_bundle_mutex);
+    return m_dataset_bundle;
+}
+
+bool BusinessLogic::setSyntheticResponses(const grpc_mock_server::SyntheticResponseSettings &settings) {
+    if (settings.target_size_bytes < 0 || settings.repeated_field_count < 0 || settings.pool_size < 1) {
+        SystemLogger->error("Invalid synthetic response settings: sizes must not be negative and the pool must not be empty");
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_synthetic_responses_mutex);
+    m_synthetic_response_settings = settings;
+    return true;
+}
+
+std::shared_ptr<const SyntheticResponsePool> BusinessLogic::syntheticResponses() const {
+    std::lock_guard<std::mutex> lock(m_synthetic_responses_mutex);
+    return m_synthetic_responses;
+}
+
+void BusinessLogic::generateSyntheticResponses() {
+    grpc_mock_server::SyntheticResponseSettings settings;
+    {
+        std::lock_guard<std::mutex> lock(m_synthetic_responses_mutex);
+        settings = m_synthetic_response_settings;
+    }
+
+    std::shared_ptr<SyntheticResponsePool> pool;
+    if (settings.enabled) {
+        auto started_at = std::chrono::steady_clock::now();
+        pool = std::make_shared<SyntheticResponsePool>();
+        pool->build(m_method_names, settings);
+        SystemLogger->info(
+            "Synthetic responses generated for {} methods in {} ms",
+            pool->size(),
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started_at).count()
+        );
+    }
+
+    std::lock_guard<std::mutex> lock(m_synthetic_responses_mutex);
+    m_synthetic_responses = std::move(pool);
+}
+
+void BusinessLogic::setWarmUp(bool enabled, int timeout_ms) {
+    assert(timeout_ms >= 0);
+    std::lock_guard<std::mutex> lock(m_lifecycle_mutex);
+    m_warm_up_enabled = enabled;
+    m_warm_up_timeout = std::chrono::milliseconds(timeout_ms);
+}
+
+bool BusinessLogic::addWarmUpRequest(const std::string &method, const std::string &request_json) {
+    WarmUpRequest request;
+    std::string error;
+    if (!createWarmUpRequest(method, request_json, request, error)) {
+        SystemLogger->error("Unable to add warm-up request: {}", error);
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_lifecycle_mutex);
+    m_warm_up_requests.push_back(std::move(request));
+    return true;
+}
+
+void BusinessLogic::clearWarmUpRequests() {
+    std::lock_guard<std::mutex> lock(m_lifecycle_mutex);
+    m_warm_up_requests.clear();
+}
+
+void BusinessLogic::warmUp(
+    const std::shared_ptr<grpc::Channel> &remote_channel,
+    std::chrono::milliseconds timeout,
+    const std::vector<WarmUpRequest> &requests
+) {
+    auto started_at = std::chrono::steady_clock::now();
+
+    auto channels = m_upstream_router->channels();
+    channels.push_back(remote_channel);
+    auto connected = connectChannels(*m_tls_session_tracker, channels, timeout);
+    auto method_count = warmUpMessageTypes(m_method_names);
+
+    // Through the whole server handlers, tagged so that they are neither recorded nor forwarded upstream
+    size_t answered = 0;
+    if (!requests.empty()) {
+        answered = sendWarmUpRequests(createInProcessChannel(), requests, timeout);
+    }
+
+    SystemLogger->info(
+        "Warm-up finished in {} ms: {} of {} upstream channels connected, {} methods prepared, {} of {} requests answered",
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started_at).count(),
+        connected, channels.size(), method_count, answered, requests.size()
+    );
+}
+
+std::shared_ptr<grpc::ServerCredentials> BusinessLogic::createLocalServerCredentials() {
+    if (!m_use_ssl) {
+        return grpc::InsecureServerCredentials();
+    }
+
+    // Certificates are served through a provider, so that they can be rotated without
+    // rebuilding the server; the TLS contexts (and so the session tickets) stay alive between handshakes
+    std::shared_ptr<grpc::experimental::CertificateProviderInterface> provider;
+    if (!m_local_server_cert_path.empty()) {
+        SystemLogger->info("Watching local server certificate file '{}'", m_local_server_cert_path);
+        provider = std::make_shared<grpc::experimental::FileWatcherCertificateProvider>(
+            m_local_server_key_path,
+            m_local_server_cert_path,
+            m_local_ca_cert_path,
+            m_certificate_refresh_interval_sec
+        );
+    }
+    else {
+        assert(!m_local_server_cert_data.empty());
+        assert(!m_local_server_key_data.empty());
+        assert(!m_local_ca_cert_data.empty());
+
+        m_certificate_directory_published = !m_certificate_directory.empty() && publishLocalServerCertificates();
+        if (m_certificate_directory_published) {
+            auto current_path = std::filesystem::path(m_certificate_directory) / CURRENT_CERTIFICATES_DIR_NAME;
+            provider = std::make_shared<grpc::experimental::FileWatcherCertificateProvider>(
+                (current_path / SERVER_KEY_FILE_NAME).generic_string(),
+                (current_path / SERVER_CERT_FILE_NAME).generic_string(),
+                (current_path / CA_CERT_FILE_NAME).generic_string(),
+                m_certificate_refresh_interval_sec
+            );
+        }
+        else {
+            SystemLogger->warn("Certificate directory is not available, certificate rotation is disabled");
+            provider = std::make_shared<grpc::experimental::StaticDataCertificateProvider>(
+                m_local_ca_cert_data,
+                std::vector<grpc::experimental::IdentityKeyCertPair>{ { m_local_server_key_data, m_local_server_cert_data } }
+            );
+        }
+    }
+
+    grpc::experimental::TlsServerCredentialsOptions options(provider);
+    options.watch_root_certs();
+    options.watch_identity_key_cert_pairs();
+    options.set_cert_request_type(GRPC_SSL_DONT_REQUEST_CLIENT_CERTIFICATE);
+    return grpc::experimental::TlsServerCredentials(options);
 }
 
 void BusinessLogic::setSslUsage(bool use_ssl) {
     m_use_ssl = use_ssl;
 }
 
+bool BusinessLogic::setTuningProfile(const grpc_mock_server::TuningProfile &profile) {
+    std::string error;
+    if (!validateTuningProfile(profile, error)) {
+        SystemLogger->error("Invalid tuning profile: {}", error);
+        return false;
+    }
+
+    m_tuning_profile = profile;
+    resetRemoteChannel();
+    return true;
+}
+
+const grpc_mock_server::TuningProfile &BusinessLogic::tuningProfile() const {
+    return m_tuning_profile;
+}
+
 void BusinessLogic::setHostAndPort(const std::string &host_url, int port) {
     assert(!host_url.empty());
-    assert(port != -1);
+    // -1 disables TCP listening, see `addListeningAddress`
+    assert(port >= -1);
 
     m_host_url = host_url;
     m_port = port;
+    resetRemoteChannel();
+}
+
+void BusinessLogic::addListeningAddress(const std::string &address) {
+    assert(!address.empty());
+    m_listening_addresses.push_back(address);
+}
+
+void BusinessLogic::setPassThroughWorkers(size_t worker_count) {
+    std::lock_guard<std::mutex> lock(m_lifecycle_mutex);
+    m_pass_through_worker_count = worker_count;
 }
 
 std::shared_ptr<grpc::Channel> BusinessLogic::createRemoteChannel() const {
+    return createRemoteChannel(m_host_url);
+}
+
+std::shared_ptr<grpc::Channel> BusinessLogic::createRemoteChannel(const std::string &target) const {
     // NOTE: always use SSL for remote channel for more security, so ignore `m_use_ssl` here
     assert(!m_remote_server_certificate_data.empty());
 
@@ -239,7 +641,23 @@ std::shared_ptr<grpc::Channel> BusinessLogic::createRemoteChannel() const {
     ssl_options.pem_root_certs = m_remote_server_certificate_data;
 
     auto ssl_credentials = grpc::SslCredentials(ssl_options);
-    return grpc::CreateChannel(m_host_url, ssl_credentials);
+    grpc::ChannelArguments args;
+    applyTuningProfile(m_tuning_profile, args);
+    m_tls_session_tracker->applySessionCache(args);
+    auto channel = grpc::CreateCustomChannel(target, ssl_credentials, args);
+    m_tls_session_tracker->watchChannel(channel);
+    return channel;
+}
+
+std::shared_ptr<grpc::Channel> BusinessLogic::remoteChannel() {
+    std::lock_guard<std::mutex> lock(m_remote_channel_mutex);
+    if (!m_remote_channel) m_remote_channel = createRemoteChannel();
+    return m_remote_channel;
+}
+
+void BusinessLogic::resetRemoteChannel() {
+    std::lock_guard<std::mutex> lock(m_remote_channel_mutex);
+    m_remote_channel.reset();
 }
 
 std::shared_ptr<grpc::Channel> BusinessLogic::createLocalChannel() const {
@@ -247,12 +665,42 @@ std::shared_ptr<grpc::Channel> BusinessLogic::createLocalChannel() const {
     assert(!m_local_server_key_data.empty());
     assert(!m_local_ca_cert_data.empty());
 
-    return grpc::CreateChannel(
-        "localhost:50051",
-        createLocalChannelCredentials(m_use_ssl, m_local_server_cert_data)
+    grpc::ChannelArguments args;
+    applyTuningProfile(m_tuning_profile, args);
+
+    // Prefer the Unix domain socket, if any: it avoids both TCP and TLS overhead
+    for (const auto &address : m_listening_addresses) {
+        if (isUnixAddress(address)) {
+            return grpc::CreateCustomChannel(address, grpc::experimental::LocalCredentials(UDS), args);
+        }
+    }
+
+    m_tls_session_tracker->applySessionCache(args);
+    int port = m_selected_port > 0 ? m_selected_port : m_port;
+    return grpc::CreateCustomChannel(
+        fmt::format("localhost:{}", port),
+        createLocalChannelCredentials(m_use_ssl, m_local_server_cert_data),
+        args
     );
 }
 
+std::shared_ptr<grpc::Channel> BusinessLogic::createInProcessChannel() const {
+    std::shared_ptr<grpc::Server> server;
+    {
+        std::lock_guard<std::mutex> lock(m_lifecycle_mutex);
+        server = m_server;
+    }
+    if (!server) {
+        SystemLogger->error("Unable to create in-process channel: server is not running");
+        return nullptr;
+    }
+
+    // The calls go straight into the server, without any transport and security
+    grpc::ChannelArguments args;
+    applyTuningProfile(m_tuning_profile, args);
+    return server->InProcessChannel(args);
+}
+
 #ifdef ANDROID
 
 bool BusinessLogic::healthCheck(const std::shared_ptr<grpc::Channel> &channel) {
@@ -338,63 +786,214 @@ bool BusinessLogic::healthCheck(const std::shared_ptr<grpc::Channel> &channel) {
 
 void BusinessLogic::runServer(std::function<void()> on_started_callback) {
     assert(!m_host_url.empty());
-    assert(m_port != -1);
+    assert(m_port != -1 || !m_listening_addresses.empty());
 
-    auto server_thread = std::thread([=, this]() {
+    // The profile may have been edited field by field, so check it once more before use
+    std::string tuning_error;
+    if (!validateTuningProfile(m_tuning_profile, tuning_error)) {
+        SystemLogger->error("Unable to start server, invalid tuning profile: {}", tuning_error);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_lifecycle_mutex);
+    if (m_server_state != grpc_mock_server::SERVER_STOPPED) {
+        SystemLogger->error("Unable to start server: it is already running");
+        return;
+    }
+    // The thread of the previous run has already finished by now, see the end of its function
+    if (m_server_thread.joinable()) m_server_thread.join();
+    m_server_state = grpc_mock_server::SERVER_STARTING;
+
+    // The generated services forward the calls through the proxy, see `grpcMockServerForwardCall`.
+    // The channel is kept between the restarts, so they don't pay for the upstream connection setup
+    auto remote_channel = remoteChannel();
+    m_upstream_proxy->setChannel(remote_channel);
+
+    // Shared by all the TCP listeners: every call publishes a certificate generation and starts a provider
+    auto server_credentials = createLocalServerCredentials();
+    const bool use_ssl = m_use_ssl;
+    // The API calls may change these while the server thread runs
+    const bool warm_up_enabled = m_warm_up_enabled;
+    const auto warm_up_timeout = m_warm_up_timeout;
+    const auto warm_up_requests = m_warm_up_requests;
+    const auto pass_through_worker_count = m_pass_through_worker_count;
+
+    m_server_thread = std::thread([=, this]() {
         const int host_port_buf_size = 1024;
         char host_port[host_port_buf_size] = { 0 };
         snprintf(host_port, host_port_buf_size, "0.0.0.0:%d", m_port);
 
-        GrpcServices services(createRemoteChannel());
+        GrpcServices services(remote_channel);
         grpc::ServerBuilder builder;
 
-        // Set the default compression algorithm for the server.
-        builder.SetDefaultCompressionAlgorithm(GRPC_COMPRESS_GZIP);
-
-        // Listen on the given address without any authentication mechanism.
-        builder.AddListeningPort(
-            host_port,
-            createLocalServerCredentials(
-                m_use_ssl,
-                m_local_server_cert_data,
-                m_local_server_key_data,
-                m_local_ca_cert_data
-            )
-        );
+        // Thread pool, flow control, message limits, keepalive and compression
+        applyTuningProfile(m_tuning_profile, builder);
+
+        // Listen on TCP unless only the Unix domain sockets were requested; zero port means any free one
+        m_selected_port = -1;
+        if (m_port != -1) {
+            builder.AddListeningPort(host_port, server_credentials, &m_selected_port);
+        }
+
+        // Co-located clients do not need TLS, the socket file permissions protect it instead
+        for (const auto &address : m_listening_addresses) {
+            if (isUnixAddress(address)) {
+                removeStaleUnixSocket(address);
+                builder.AddListeningPort(address, grpc::experimental::LocalServerCredentials(UDS));
+            }
+            else {
+                builder.AddListeningPort(address, server_credentials);
+            }
+        }
+
+        std::vector<std::unique_ptr<grpc::experimental::ServerInterceptorFactoryInterface>> interceptor_factories;
+        if (use_ssl) {
+            interceptor_factories.push_back(m_tls_session_tracker->createInterceptorFactory());
+        }
+        interceptor_factories.push_back(RpcTracer::createInterceptorFactory());
+        builder.experimental().SetInterceptorCreators(std::move(interceptor_factories));
 
         // Register "service" as the instance through which we'll communicate with
         // clients. In this case it corresponds to an *synchronous* service.
         services.registerServices(builder);
 
+        // The calls of the methods no generated service knows are forwarded upstream as is
+        std::unique_ptr<PassThroughService> pass_through_service;
+        if (pass_through_worker_count > 0) {
+            pass_through_service = std::make_unique<PassThroughService>(m_upstream_proxy.get(), pass_through_worker_count);
+            builder.RegisterCallbackGenericService(pass_through_service.get());
+        }
+
         // Finally assemble the server
         if (!openDatabase()) {
             SystemLogger->error("Unable to open database!");
+            setServerState(grpc_mock_server::SERVER_STOPPED);
             return;
         }
+        // Before the first call, so that it doesn't pay for the generation
+        generateSyntheticResponses();
 
         SystemLogger->info("Server is starting...");
 
-        m_server = builder.BuildAndStart();
+        std::shared_ptr<grpc::Server> server = builder.BuildAndStart();
+        if (!server) {
+            SystemLogger->error("Unable to start server: the listening ports can't be bound");
+            closeDatabase();
+            setServerState(grpc_mock_server::SERVER_STOPPED);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_lifecycle_mutex);
+            m_server = server;
+        }
+        if (use_ssl && m_port != -1) {
+            m_tls_session_tracker->probeServerHandshake(
+                fmt::format("localhost:{}", m_selected_port),
+                SERVER_HANDSHAKE_PROBE_TIMEOUT
+            );
+        }
+        // The server is still reported as starting, so that the first calls of the users find everything ready
+        if (warm_up_enabled) {
+            warmUp(remote_channel, warm_up_timeout, warm_up_requests);
+        }
+        setServerState(grpc_mock_server::SERVER_RUNNING);
+
         SystemLogger->info("Server was started");
-        SystemLogger->info("Server is listening on port {}", host_port);
+        if (m_port != -1) {
+            SystemLogger->info("Server is listening on port {}", m_selected_port);
+        }
+        for (const auto &address : m_listening_addresses) {
+            SystemLogger->info("Server is listening on {}", address);
+        }
 
         on_started_callback();
 
         // Wait for the server to shutdown. Note that some other thread must be
         // responsible for shutting down the server for this call to ever return
-        m_server->Wait();
+        server->Wait();
 
-        m_server.reset(nullptr);
-        SystemLogger->info("Server was stopped");
+        // All the calls are finished by now, so their history is complete
         closeDatabase();
+        {
+            std::lock_guard<std::mutex> lock(m_lifecycle_mutex);
+            m_server.reset();
+        }
+        server.reset();
+        EventLogger::getInstance().flush();
+        SystemLogger->info("Server was stopped");
+        setServerState(grpc_mock_server::SERVER_STOPPED);
     });
+}
 
-    server_thread.detach();
+bool BusinessLogic::stopServer(std::chrono::milliseconds drain_timeout) {
+    std::unique_lock<std::mutex> lock(m_lifecycle_mutex);
+    // A starting server is stopped as soon as it is up
+    m_lifecycle_cv.wait(lock, [this]() { return m_server_state != grpc_mock_server::SERVER_STARTING; });
+    if (m_server_state != grpc_mock_server::SERVER_RUNNING) {
+        SystemLogger->warn("Unable to stop server: it is not running");
+        return false;
+    }
+    m_server_state = grpc_mock_server::SERVER_STOPPING;
+    // The server thread drops its pointer once `Wait` returns, which may happen before `Shutdown` does
+    auto server = m_server;
+    lock.unlock();
+    m_lifecycle_cv.notify_all();
+
+    if (drain_timeout == std::chrono::milliseconds::max()) {
+        SystemLogger->info("Server is stopping, waiting for the calls in progress to finish");
+        server->Shutdown();
+    }
+    else {
+        SystemLogger->info("Server is stopping, the calls in progress have {} ms to finish", drain_timeout.count());
+        server->Shutdown(std::chrono::system_clock::now() + drain_timeout);
+    }
+    return true;
 }
 
-void BusinessLogic::stopServer() {
-    if (!m_server) { assert(0); return; }
-    m_server->Shutdown();
+bool BusinessLogic::waitForServerStopped(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(m_lifecycle_mutex);
+    auto is_stopped = [this]() { return m_server_state == grpc_mock_server::SERVER_STOPPED; };
+    if (timeout == std::chrono::milliseconds::max()) {
+        m_lifecycle_cv.wait(lock, is_stopped);
+    }
+    else if (!m_lifecycle_cv.wait_for(lock, timeout, is_stopped)) {
+        return false;
+    }
+
+    // The thread only has to return after publishing the state
+    if (m_server_thread.joinable() && m_server_thread.get_id() != std::this_thread::get_id()) {
+        m_server_thread.join();
+    }
+    return true;
+}
+
+bool BusinessLogic::restartServer(std::function<void()> on_started_callback, std::chrono::milliseconds drain_timeout) {
+    if (serverState() != grpc_mock_server::SERVER_STOPPED) {
+        stopServer(drain_timeout);
+        auto stop_timeout = drain_timeout == std::chrono::milliseconds::max()
+            ? drain_timeout
+            : drain_timeout + SERVER_STOP_GRACE_PERIOD;
+        if (!waitForServerStopped(stop_timeout)) {
+            SystemLogger->error("Unable to restart server: it did not stop in time");
+            return false;
+        }
+    }
+
+    runServer(on_started_callback);
+    return true;
+}
+
+grpc_mock_server::ServerState BusinessLogic::serverState() const {
+    std::lock_guard<std::mutex> lock(m_lifecycle_mutex);
+    return m_server_state;
+}
+
+void BusinessLogic::setServerState(grpc_mock_server::ServerState state) {
+    {
+        std::lock_guard<std::mutex> lock(m_lifecycle_mutex);
+        m_server_state = state;
+    }
+    m_lifecycle_cv.notify_all();
 }
 
 #endif
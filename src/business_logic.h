@@ -22,26 +22,101 @@
 #include <string>
 #include <fstream>
 #include <atomic>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
 
 #include <grpc++/grpc++.h>
 
  // Generated headers
 #include <gmsServices.h>
 
+#include "grpc_mock_server_library.h"
+#include "payload_store.h"
+#include "warm_up.h"
+
 namespace SQLite { class Database; }
+class TlsSessionTracker;
+class UpstreamProxy;
+class UpstreamRouter;
+class AdmissionController;
+class TrafficCapture;
+class HistoryWriter;
+class DatasetBundle;
+class SyntheticResponsePool;
 
 class BusinessLogic {
     bool m_use_ssl = true;
     std::string m_host_url = "";
     int m_port = -1;
+    int m_selected_port = -1;
+    std::vector<std::string> m_listening_addresses;
+    // Zero answers the unknown methods with UNIMPLEMENTED; guarded by `m_lifecycle_mutex`
+    size_t m_pass_through_worker_count = 0;
     std::string m_database_file_path;
     std::string m_packages_xml_data;
+    // Guards the database being opened and closed, and the payload settings; the history writer
+    // thread uses the connection between the two
+    mutable std::mutex m_database_mutex;
     std::unique_ptr<SQLite::Database> m_database;
+    std::unique_ptr<HistoryWriter> m_history_writer;
+    PayloadStore::Settings m_history_payload_settings;
+    // Parsed 'packages.xml', kept for the restarts
+    std::vector<std::string> m_method_names;
     std::string m_remote_server_certificate_data;
     std::string m_local_server_cert_data;
     std::string m_local_server_key_data;
     std::string m_local_ca_cert_data;
-    std::unique_ptr<grpc::Server> m_server;
+    std::string m_local_server_cert_path;
+    std::string m_local_server_key_path;
+    std::string m_local_ca_cert_path;
+    std::string m_certificate_directory;
+    bool m_certificate_directory_published = false;
+    unsigned int m_certificate_refresh_interval_sec = 1;
+    grpc_mock_server::TuningProfile m_tuning_profile;
+    std::unique_ptr<TlsSessionTracker> m_tls_session_tracker;
+    std::unique_ptr<AdmissionController> m_admission_controller;
+    std::unique_ptr<UpstreamRouter> m_upstream_router;
+    std::unique_ptr<UpstreamProxy> m_upstream_proxy;
+    std::unique_ptr<TrafficCapture> m_traffic_capture;
+
+    // Reused by the restarts until the upstream settings change
+    std::mutex m_remote_channel_mutex;
+    std::shared_ptr<grpc::Channel> m_remote_channel;
+
+    mutable std::mutex m_lifecycle_mutex;
+    std::condition_variable m_lifecycle_cv;
+    grpc_mock_server::ServerState m_server_state = grpc_mock_server::SERVER_STOPPED;
+    std::thread m_server_thread;
+    // Guarded by `m_lifecycle_mutex`; shared, so that the stopping caller still has it until `Shutdown` returns
+    std::shared_ptr<grpc::Server> m_server;
+
+    mutable std::mutex m_dataset_bundle_mutex;
+    std::shared_ptr<const DatasetBundle> m_dataset_bundle;
+
+    // Guards both the settings and the pool
+    mutable std::mutex m_synthetic_responses_mutex;
+    grpc_mock_server::SyntheticResponseSettings m_synthetic_response_settings;
+    std::shared_ptr<const SyntheticResponsePool> m_synthetic_responses;
+
+    // Guarded by `m_lifecycle_mutex`, the server thread works on their copies
+    bool m_warm_up_enabled = false;
+    std::chrono::milliseconds m_warm_up_timeout { 2000 };
+    std::vector<WarmUpRequest> m_warm_up_requests;
+
+    std::shared_ptr<grpc::ServerCredentials> createLocalServerCredentials();
+    bool publishLocalServerCertificates();
+    std::shared_ptr<grpc::Channel> remoteChannel();
+    void resetRemoteChannel();
+    void setServerState(grpc_mock_server::ServerState state);
+    void generateSyntheticResponses();
+    void warmUp(
+        const std::shared_ptr<grpc::Channel> &remote_channel,
+        std::chrono::milliseconds timeout,
+        const std::vector<WarmUpRequest> &requests
+    );
 
     BusinessLogic();
     ~BusinessLogic();
@@ -60,6 +135,9 @@ public:
     void setPackagesXmlData(const std::string &packages_xml_data);
     bool openDatabase();
     void closeDatabase();
+    // Takes effect on the next database opening
+    bool setHistoryCompression(bool enabled, int level, bool train_dictionary);
+    bool readHistoryPayload(int64_t payload_id, std::string &data);
     void insertHistoryRow(
         time_t time,
         const std::string &method,
@@ -69,22 +147,56 @@ public:
     );
 
     void setHostAndPort(const std::string &host_url, int port);
+    void addListeningAddress(const std::string &address);
+    void setPassThroughWorkers(size_t worker_count);
     void setSslUsage(bool use_ssl);
+    bool setTuningProfile(const grpc_mock_server::TuningProfile &profile);
+    const grpc_mock_server::TuningProfile &tuningProfile() const;
     void setRemoteServerCertificateData(const std::string &data);
     void setLocalServerCertificateData(
         const std::string &server_cert_data,
         const std::string &server_key_data,
         const std::string &ca_cert_data
     );
+    void setLocalServerCertificateFiles(
+        const std::string &server_cert_path,
+        const std::string &server_key_path,
+        const std::string &ca_cert_path,
+        unsigned int refresh_interval_sec
+    );
+    void setCertificateDirectory(const std::string &certificate_directory);
+    grpc_mock_server::TlsStatistics tlsStatistics() const;
+    UpstreamProxy &upstreamProxy();
+    AdmissionController &admissionController();
+    UpstreamRouter &upstreamRouter();
+    TrafficCapture &trafficCapture();
+    // Empty path unloads the bundle; the calls in progress keep using the previous one
+    bool loadDatasetBundle(const std::string &bundle_path);
+    std::shared_ptr<const DatasetBundle> datasetBundle() const;
+    // Takes effect on the next server start
+    bool setSyntheticResponses(const grpc_mock_server::SyntheticResponseSettings &settings);
+    // nullptr if the synthetic responses are disabled
+    std::shared_ptr<const SyntheticResponsePool> syntheticResponses() const;
+    void setWarmUp(bool enabled, int timeout_ms);
+    bool addWarmUpRequest(const std::string &method, const std::string &request_json);
+    void clearWarmUpRequests();
     std::shared_ptr<grpc::Channel> createRemoteChannel() const;
+    std::shared_ptr<grpc::Channel> createRemoteChannel(const std::string &target) const;
     std::shared_ptr<grpc::Channel> createLocalChannel() const;
+    std::shared_ptr<grpc::Channel> createInProcessChannel() const;
 
 #ifdef ANDROID
     void runServer(JNIEnv* env, jobject obj, jmethodID is_cancelled_mid, int port);
     void stopServer();
 #else
     void runServer(std::function<void()> on_started_callback);
-    void stopServer();
+    // New calls are rejected at once, the calls still running after `drain_timeout` are cancelled;
+    // the maximum duration waits for all of them to finish
+    bool stopServer(std::chrono::milliseconds drain_timeout);
+    // Must not be called from the `on_started_callback`
+    bool waitForServerStopped(std::chrono::milliseconds timeout);
+    bool restartServer(std::function<void()> on_started_callback, std::chrono::milliseconds drain_timeout);
+    grpc_mock_server::ServerState serverState() const;
 #endif
 };
 
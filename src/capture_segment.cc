@@ -0,0 +1,244 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "capture_segment.h"
+
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+// Buffered writes, so that a record costs a memcpy rather than a system call
+constexpr size_t WRITE_BUFFER_SIZE = 1024 * 1024;
+
+template <typename T>
+void appendInteger(std::string &output, T value) {
+    char bytes[sizeof(T)];
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        bytes[i] = static_cast<char>((static_cast<uint64_t>(value) >> (8 * i)) & 0xFF);
+    }
+    output.append(bytes, sizeof(T));
+}
+
+template <typename T>
+bool readInteger(std::string_view &input, T &value) {
+    if (input.size() < sizeof(T)) return false;
+
+    uint64_t result = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        result |= static_cast<uint64_t>(static_cast<unsigned char>(input[i])) << (8 * i);
+    }
+    value = static_cast<T>(result);
+    input.remove_prefix(sizeof(T));
+    return true;
+}
+
+bool readBytes(std::string_view &input, size_t size, std::string_view &value) {
+    if (input.size() < size) return false;
+
+    value = input.substr(0, size);
+    input.remove_prefix(size);
+    return true;
+}
+
+} // anonymous namespace
+
+void encodeCaptureRecord(const CaptureRecord &record, std::string &output) {
+    auto size_offset = output.size();
+    appendInteger<uint32_t>(output, 0);
+
+    appendInteger<uint64_t>(output, record.arrival_time_ns);
+    appendInteger<uint16_t>(output, static_cast<uint16_t>(record.method.size()));
+    output.append(record.method);
+
+    appendInteger<uint16_t>(output, static_cast<uint16_t>(record.metadata.size()));
+    for (const auto &[key, value] : record.metadata) {
+        appendInteger<uint16_t>(output, static_cast<uint16_t>(key.size()));
+        output.append(key);
+        appendInteger<uint32_t>(output, static_cast<uint32_t>(value.size()));
+        output.append(value);
+    }
+
+    appendInteger<uint32_t>(output, static_cast<uint32_t>(record.payload.size()));
+    output.append(record.payload);
+
+    // Patch the record size now when it is known
+    std::string size_bytes;
+    appendInteger<uint32_t>(size_bytes, static_cast<uint32_t>(output.size() - size_offset - sizeof(uint32_t)));
+    output.replace(size_offset, sizeof(uint32_t), size_bytes);
+}
+
+std::vector<std::filesystem::path> listCaptureSegments(const std::filesystem::path &path) {
+    std::vector<std::filesystem::path> result;
+
+    std::error_code error;
+    if (!std::filesystem::is_directory(path, error)) {
+        result.push_back(path);
+        return result;
+    }
+
+    for (const auto &entry : std::filesystem::directory_iterator(path, error)) {
+        if (entry.is_regular_file() && entry.path().extension() == CAPTURE_SEGMENT_EXTENSION) {
+            result.push_back(entry.path());
+        }
+    }
+    // The names start with the zero-padded capture start time and sequence number
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+CaptureSegmentWriter::~CaptureSegmentWriter() {
+    close();
+}
+
+bool CaptureSegmentWriter::open(const std::filesystem::path &directory, uint64_t segment_size, std::string &error) {
+    close();
+
+    std::error_code fs_error;
+    std::filesystem::create_directories(directory, fs_error);
+    if (fs_error) {
+        error = fs_error.message();
+        return false;
+    }
+
+    m_directory = directory;
+    m_segment_size = segment_size;
+    m_sequence = 0;
+    m_session_id = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count());
+    return openNextSegment(error);
+}
+
+bool CaptureSegmentWriter::openNextSegment(std::string &error) {
+    if (m_file != nullptr) {
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+
+    char file_name[64] = { 0 };
+    snprintf(
+        file_name,
+        sizeof(file_name),
+        "capture-%013llu-%06u%s",
+        static_cast<unsigned long long>(m_session_id),
+        m_sequence++,
+        CAPTURE_SEGMENT_EXTENSION
+    );
+    auto file_path = m_directory / file_name;
+
+    m_file = std::fopen(file_path.string().c_str(), "wb");
+    if (m_file == nullptr) {
+        error = "unable to create segment file '" + file_path.string() + "': " + strerror(errno);
+        return false;
+    }
+    std::setvbuf(m_file, nullptr, _IOFBF, WRITE_BUFFER_SIZE);
+
+    std::fwrite(CAPTURE_SEGMENT_MAGIC, 1, sizeof(CAPTURE_SEGMENT_MAGIC), m_file);
+    m_current_size = sizeof(CAPTURE_SEGMENT_MAGIC);
+    return true;
+}
+
+bool CaptureSegmentWriter::append(std::string_view encoded_record, std::string &error) {
+    if (m_file == nullptr) {
+        error = "segment file is not open";
+        return false;
+    }
+
+    // A record larger than the segment gets a segment of its own
+    if (m_current_size > sizeof(CAPTURE_SEGMENT_MAGIC) && m_current_size + encoded_record.size() > m_segment_size) {
+        if (!openNextSegment(error)) return false;
+    }
+
+    if (std::fwrite(encoded_record.data(), 1, encoded_record.size(), m_file) != encoded_record.size()) {
+        error = std::string("unable to write segment file: ") + strerror(errno);
+        return false;
+    }
+    m_current_size += encoded_record.size();
+    return true;
+}
+
+void CaptureSegmentWriter::flush() {
+    if (m_file != nullptr) std::fflush(m_file);
+}
+
+void CaptureSegmentWriter::close() {
+    if (m_file != nullptr) {
+        std::fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+bool CaptureSegmentReader::open(const std::filesystem::path &file_path, std::string &error) {
+    m_offset = 0;
+    m_truncated = false;
+
+    if (!m_file.open(file_path.string(), true, error)) return false;
+
+    if (m_file.size() < sizeof(CAPTURE_SEGMENT_MAGIC)
+        || memcmp(m_file.data(), CAPTURE_SEGMENT_MAGIC, sizeof(CAPTURE_SEGMENT_MAGIC)) != 0) {
+        error = "'" + file_path.string() + "' is not a capture segment";
+        m_file.close();
+        return false;
+    }
+    m_offset = sizeof(CAPTURE_SEGMENT_MAGIC);
+    return true;
+}
+
+bool CaptureSegmentReader::next(CaptureRecord &record) {
+    if (!m_file.isOpen() || m_offset >= m_file.size()) return false;
+
+    std::string_view input = m_file.view().substr(m_offset);
+    uint32_t record_size = 0;
+    std::string_view body;
+    if (!readInteger(input, record_size) || !readBytes(input, record_size, body)) {
+        m_truncated = true;
+        m_offset = m_file.size();
+        return false;
+    }
+    m_offset += sizeof(uint32_t) + record_size;
+
+    uint16_t method_size = 0;
+    uint16_t metadata_count = 0;
+    uint32_t payload_size = 0;
+    record.metadata.clear();
+    bool ok = readInteger(body, record.arrival_time_ns)
+        && readInteger(body, method_size)
+        && readBytes(body, method_size, record.method)
+        && readInteger(body, metadata_count);
+    for (uint16_t i = 0; ok && i < metadata_count; ++i) {
+        uint16_t key_size = 0;
+        uint32_t value_size = 0;
+        std::string_view key;
+        std::string_view value;
+        ok = readInteger(body, key_size)
+            && readBytes(body, key_size, key)
+            && readInteger(body, value_size)
+            && readBytes(body, value_size, value);
+        if (ok) record.metadata.emplace_back(key, value);
+    }
+    ok = ok && readInteger(body, payload_size) && readBytes(body, payload_size, record.payload);
+
+    if (!ok) {
+        m_truncated = true;
+        m_offset = m_file.size();
+        return false;
+    }
+    return true;
+}
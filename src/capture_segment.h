@@ -0,0 +1,98 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_CAPTURE_SEGMENT_H
+#define GRPC_MOCK_SERVER_CAPTURE_SEGMENT_H
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <filesystem>
+
+#include "mapped_file.h"
+
+// Captured traffic is stored in the append-only segment files:
+//   segment := magic record*
+//   record  := u32 size (of the rest of the record)
+//              u64 arrival time (nanoseconds since the Unix epoch)
+//              u16 method size, method ("package.Service/Method")
+//              u16 metadata count, { u16 key size, key, u32 value size, value }*
+//              u32 payload size, payload (serialized request)
+// All the integers are little-endian
+constexpr char CAPTURE_SEGMENT_MAGIC[8] = { 'G', 'M', 'S', 'C', 'A', 'P', '0', '1' };
+constexpr const char *CAPTURE_SEGMENT_EXTENSION = ".seg";
+
+using CaptureMetadata = std::vector<std::pair<std::string_view, std::string_view>>;
+
+struct CaptureRecord {
+    uint64_t arrival_time_ns = 0;
+    std::string_view method;
+    CaptureMetadata metadata;
+    std::string_view payload;
+};
+
+// Appends the encoded record to the output
+void encodeCaptureRecord(const CaptureRecord &record, std::string &output);
+
+// Lists the segment files of a directory in the capture order, or returns the path itself if it is a file
+std::vector<std::filesystem::path> listCaptureSegments(const std::filesystem::path &path);
+
+class CaptureSegmentWriter {
+    std::filesystem::path m_directory;
+    uint64_t m_segment_size = 0;
+    std::FILE *m_file = nullptr;
+    uint64_t m_current_size = 0;
+    uint32_t m_sequence = 0;
+    uint64_t m_session_id = 0;
+
+    bool openNextSegment(std::string &error);
+
+public:
+    CaptureSegmentWriter() = default;
+    ~CaptureSegmentWriter();
+
+    CaptureSegmentWriter(const CaptureSegmentWriter&) = delete;
+    CaptureSegmentWriter &operator=(const CaptureSegmentWriter&) = delete;
+
+    // A new segment is started when the current one would exceed `segment_size` bytes
+    bool open(const std::filesystem::path &directory, uint64_t segment_size, std::string &error);
+    bool append(std::string_view encoded_record, std::string &error);
+    void flush();
+    void close();
+};
+
+class CaptureSegmentReader {
+    MappedFile m_file;
+    size_t m_offset = 0;
+    bool m_truncated = false;
+
+public:
+    bool open(const std::filesystem::path &file_path, std::string &error);
+
+    // The views point into the mapped segment and stay valid while the reader is alive.
+    // Returns false at the end of the segment
+    bool next(CaptureRecord &record);
+
+    // A writer killed in the middle of a record leaves a truncated tail, it is skipped
+    bool truncated() const { return m_truncated; }
+};
+
+#endif // GRPC_MOCK_SERVER_CAPTURE_SEGMENT_H
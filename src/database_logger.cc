@@ -3,6 +3,8 @@
 #include <grpc_mock_server_logger.h>
 
 #include "business_logic.h"
+#include "event_logger.h"
+#include "warm_up.h"
 
 // This function will be called by protobuf compiler generated code
 void grpcMockServerMethodCallback(
@@ -13,10 +15,11 @@ void grpcMockServerMethodCallback(
     const std::string &response_json
 ) {
     if (status == grpc::OK) {
-        SystemLogger->info("gRPC method '{}' succeeded", method);
+        GMS_LOG_INFO(LogCategory::Rpc, "gRPC method '{}' succeeded", method);
     }
     else {
-        SystemLogger->info("gRPC method '{}' failed with code {}", method, status);
+        GMS_LOG_INFO(LogCategory::Rpc, "gRPC method '{}' failed with code {}", method, status);
     }
+    if (isCurrentCallWarmUp()) return;
     BusinessLogic::getInstance().insertHistoryRow(time, method, request_json, status, response_json);
 }
\ No newline at end of file
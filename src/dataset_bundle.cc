@@ -0,0 +1,352 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "dataset_bundle.h"
+#include "business_logic.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <filesystem>
+
+#include <pugixml.hpp>
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/dynamic_message.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/util/json_util.h>
+#include <google/protobuf/io/coded_stream.h>
+
+#include <grpc_mock_server_logger.h>
+
+namespace {
+
+constexpr size_t HEADER_SIZE = 40;
+constexpr size_t INDEX_ENTRY_SIZE = 32;
+// The payloads are aligned, so that the index and the payloads don't share cache lines needlessly
+constexpr size_t PAYLOAD_ALIGNMENT = 8;
+
+template <typename T>
+void appendInteger(std::string &output, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        output.push_back(static_cast<char>((static_cast<uint64_t>(value) >> (8 * i)) & 0xFF));
+    }
+}
+
+template <typename T>
+T readInteger(const char *data) {
+    uint64_t result = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        result |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+    }
+    return static_cast<T>(result);
+}
+
+void alignTo(std::string &output, size_t alignment) {
+    output.resize((output.size() + alignment - 1) / alignment * alignment, '\0');
+}
+
+bool readFile(const std::filesystem::path &file_path, std::string &data) {
+    std::ifstream file(file_path, std::ios::binary);
+    if (!file) return false;
+
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    data = buffer.str();
+    return true;
+}
+
+bool compileFixture(
+    const std::string &method,
+    DatasetFixtureKind kind,
+    const std::filesystem::path &file_path,
+    DatasetFixture &fixture,
+    std::string &error
+) {
+    // Descriptors use dots only: "package.Service.Method"
+    std::string descriptor_name = method;
+    std::replace(descriptor_name.begin(), descriptor_name.end(), '/', '.');
+    auto method_descriptor = google::protobuf::DescriptorPool::generated_pool()->FindMethodByName(descriptor_name);
+    if (method_descriptor == nullptr) {
+        error = "unknown method '" + method + "'";
+        return false;
+    }
+
+    auto prototype = google::protobuf::MessageFactory::generated_factory()->GetPrototype(method_descriptor->output_type());
+    if (prototype == nullptr) {
+        error = "no generated message for '" + method_descriptor->output_type()->full_name() + "'";
+        return false;
+    }
+
+    std::string json;
+    if (!readFile(file_path, json)) {
+        error = "unable to read fixture file '" + file_path.string() + "'";
+        return false;
+    }
+
+    std::unique_ptr<google::protobuf::Message> response(prototype->New());
+    auto status = google::protobuf::util::JsonStringToMessage(json, response.get());
+    if (!status.ok()) {
+        error = "fixture file '" + file_path.string() + "' doesn't match '"
+            + method_descriptor->output_type()->full_name() + "': " + std::string(status.message());
+        return false;
+    }
+
+    fixture.method = method;
+    fixture.kind = kind;
+    if (!response->SerializeToString(&fixture.payload)) {
+        error = "unable to serialize fixture file '" + file_path.string() + "'";
+        return false;
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+bool buildDatasetBundle(
+    const std::string &config_xml_data,
+    const std::string &dataset_name,
+    const std::string &base_directory,
+    const std::string &output_path,
+    std::string &error
+) {
+    pugi::xml_document doc;
+    pugi::xml_parse_result parser_result = doc.load_buffer(config_xml_data.data(), config_xml_data.size());
+    if (!parser_result) {
+        error = parser_result.description();
+        return false;
+    }
+
+    auto dataset_node = doc.child("root").find_child_by_attribute("dataset", "name", dataset_name.c_str());
+    if (!dataset_node) {
+        error = "dataset '" + dataset_name + "' not found";
+        return false;
+    }
+
+    std::vector<DatasetFixture> fixtures;
+    for (auto package_node : dataset_node.children("package")) {
+        for (auto service_node : package_node.children("service")) {
+            for (auto method_node : service_node.children("method")) {
+                auto method = std::string(package_node.attribute("name").as_string())
+                    + "." + service_node.attribute("name").as_string()
+                    + "/" + method_node.attribute("name").as_string();
+
+                const std::pair<const char*, DatasetFixtureKind> fixture_nodes[] = {
+                    { "full", DATASET_FIXTURE_FULL },
+                    { "partial", DATASET_FIXTURE_PARTIAL }
+                };
+                for (const auto &[node_name, kind] : fixture_nodes) {
+                    auto fixture_node = method_node.child(node_name);
+                    if (!fixture_node) continue;
+
+                    std::filesystem::path file_path = fixture_node.attribute("path").as_string();
+                    if (file_path.is_relative()) file_path = std::filesystem::path(base_directory) / file_path;
+
+                    DatasetFixture fixture;
+                    if (!compileFixture(method, kind, file_path, fixture, error)) return false;
+                    fixtures.push_back(std::move(fixture));
+                }
+            }
+        }
+    }
+
+    if (!writeDatasetBundle(dataset_name, std::move(fixtures), output_path, error)) return false;
+
+    SystemLogger->info("Dataset '{}' was compiled into bundle '{}'", dataset_name, output_path);
+    return true;
+}
+
+bool writeDatasetBundle(
+    const std::string &dataset_name,
+    std::vector<DatasetFixture> fixtures,
+    const std::string &output_path,
+    std::string &error
+) {
+    std::sort(fixtures.begin(), fixtures.end(), [](const DatasetFixture &lhs, const DatasetFixture &rhs) {
+        return std::tie(lhs.method, lhs.kind) < std::tie(rhs.method, rhs.kind);
+    });
+    auto duplicate = std::adjacent_find(fixtures.begin(), fixtures.end(), [](const DatasetFixture &lhs, const DatasetFixture &rhs) {
+        return lhs.method == rhs.method && lhs.kind == rhs.kind;
+    });
+    if (duplicate != fixtures.end()) {
+        error = "duplicate fixture of method '" + duplicate->method + "'";
+        return false;
+    }
+
+    // The header is patched at the end, when the offsets are known
+    std::string output(HEADER_SIZE, '\0');
+    auto name_offset = output.size();
+    output.append(dataset_name);
+
+    std::string index;
+    for (const auto &fixture : fixtures) {
+        auto method_offset = output.size();
+        output.append(fixture.method);
+        alignTo(output, PAYLOAD_ALIGNMENT);
+        auto payload_offset = output.size();
+        output.append(fixture.payload);
+
+        appendInteger<uint64_t>(index, method_offset);
+        appendInteger<uint32_t>(index, static_cast<uint32_t>(fixture.method.size()));
+        appendInteger<uint32_t>(index, fixture.kind);
+        appendInteger<uint64_t>(index, payload_offset);
+        appendInteger<uint64_t>(index, fixture.payload.size());
+    }
+    alignTo(output, PAYLOAD_ALIGNMENT);
+    auto index_offset = output.size();
+    output.append(index);
+
+    std::string header(DATASET_BUNDLE_MAGIC, sizeof(DATASET_BUNDLE_MAGIC));
+    appendInteger<uint32_t>(header, static_cast<uint32_t>(fixtures.size()));
+    appendInteger<uint32_t>(header, 0);
+    appendInteger<uint64_t>(header, index_offset);
+    appendInteger<uint64_t>(header, name_offset);
+    appendInteger<uint32_t>(header, static_cast<uint32_t>(dataset_name.size()));
+    appendInteger<uint32_t>(header, 0);
+    output.replace(0, HEADER_SIZE, header);
+
+    // A running server may have the previous bundle mapped, so replace the file instead of rewriting it
+    auto temporary_path = output_path + ".tmp";
+    {
+        std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+        file.write(output.data(), static_cast<std::streamsize>(output.size()));
+        if (!file) {
+            error = "unable to write bundle file '" + temporary_path + "'";
+            return false;
+        }
+    }
+    std::error_code fs_error;
+    std::filesystem::rename(temporary_path, output_path, fs_error);
+    if (fs_error) {
+        error = "unable to replace bundle file '" + output_path + "': " + fs_error.message();
+        return false;
+    }
+    return true;
+}
+
+bool DatasetBundle::open(const std::string &file_path, std::string &error) {
+    // The lookups are random, so there is no use in the read-ahead
+    if (!m_file.open(file_path, false, error)) return false;
+
+    auto file = m_file.view();
+    if (file.size() < HEADER_SIZE || memcmp(file.data(), DATASET_BUNDLE_MAGIC, sizeof(DATASET_BUNDLE_MAGIC)) != 0) {
+        error = "'" + file_path + "' is not a dataset bundle";
+        m_file.close();
+        return false;
+    }
+
+    auto entry_count = readInteger<uint32_t>(file.data() + 8);
+    auto index_offset = readInteger<uint64_t>(file.data() + 16);
+    auto name_offset = readInteger<uint64_t>(file.data() + 24);
+    auto name_size = readInteger<uint32_t>(file.data() + 32);
+    if (index_offset > file.size()
+        || (file.size() - index_offset) / INDEX_ENTRY_SIZE < entry_count
+        || name_offset > file.size()
+        || file.size() - name_offset < name_size) {
+        error = "dataset bundle '" + file_path + "' is truncated";
+        m_file.close();
+        return false;
+    }
+
+    m_index = file.data() + index_offset;
+    m_entry_count = entry_count;
+    m_dataset_name = file.substr(name_offset, name_size);
+    return true;
+}
+
+DatasetBundle::IndexEntry DatasetBundle::entry(uint32_t index) const {
+    const char *data = m_index + static_cast<size_t>(index) * INDEX_ENTRY_SIZE;
+    return {
+        readInteger<uint64_t>(data),
+        readInteger<uint32_t>(data + 8),
+        readInteger<uint32_t>(data + 12),
+        readInteger<uint64_t>(data + 16),
+        readInteger<uint64_t>(data + 24)
+    };
+}
+
+std::vector<std::string> DatasetBundle::methodNames() const {
+    auto file = m_file.view();
+    std::vector<std::string> result;
+    for (uint32_t i = 0; i < m_entry_count; ++i) {
+        auto index_entry = entry(i);
+        if (index_entry.method_offset > file.size()) continue;
+
+        auto method = file.substr(index_entry.method_offset, index_entry.method_size);
+        // The index is sorted, so the fixtures of the same method are adjacent
+        if (result.empty() || result.back() != method) result.emplace_back(method);
+    }
+    return result;
+}
+
+bool DatasetBundle::find(std::string_view method, DatasetFixtureKind kind, std::string_view &payload) const {
+    auto file = m_file.view();
+    auto method_of = [&file](const IndexEntry &index_entry) {
+        if (index_entry.method_offset > file.size()) return std::string_view();
+        return file.substr(index_entry.method_offset, index_entry.method_size);
+    };
+
+    // Binary search over (method, kind), only the visited index entries are touched
+    uint32_t low = 0;
+    uint32_t high = m_entry_count;
+    while (low < high) {
+        auto middle = low + (high - low) / 2;
+        auto middle_entry = entry(middle);
+        auto compare = method_of(middle_entry).compare(method);
+        if (compare < 0 || (compare == 0 && middle_entry.kind < kind)) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    if (low == m_entry_count) return false;
+
+    auto found_entry = entry(low);
+    if (method_of(found_entry) != method || found_entry.kind != kind) return false;
+    if (found_entry.payload_offset > file.size() || file.size() - found_entry.payload_offset < found_entry.payload_size) {
+        return false;
+    }
+
+    payload = file.substr(found_entry.payload_offset, found_entry.payload_size);
+    return true;
+}
+
+bool grpcMockServerLoadBundledResponse(const std::string &method, google::protobuf::Message *response) {
+    auto bundle = BusinessLogic::getInstance().datasetBundle();
+    if (!bundle) return false;
+
+    std::string_view payload;
+    if (!bundle->find(method, DATASET_FIXTURE_FULL, payload)) return false;
+    return response->ParseFromArray(payload.data(), static_cast<int>(payload.size()));
+}
+
+bool grpcMockServerApplyBundledOverride(const std::string &method, google::protobuf::Message *response) {
+    auto bundle = BusinessLogic::getInstance().datasetBundle();
+    if (!bundle) return false;
+
+    std::string_view payload;
+    if (!bundle->find(method, DATASET_FIXTURE_PARTIAL, payload)) return false;
+    google::protobuf::io::CodedInputStream input(
+        reinterpret_cast<const uint8_t*>(payload.data()),
+        static_cast<int>(payload.size())
+    );
+    return response->MergeFromCodedStream(&input);
+}
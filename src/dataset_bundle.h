@@ -0,0 +1,108 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_DATASET_BUNDLE_H
+#define GRPC_MOCK_SERVER_DATASET_BUNDLE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+#include "mapped_file.h"
+
+namespace google::protobuf { class Message; }
+
+// Dataset fixtures compiled into a single file, so that the server maps it instead of
+// opening and parsing every fixture file:
+//   header := magic, u32 entry count, u32 reserved, u64 index offset, u64 dataset name offset, u32 name size, u32 reserved
+//   data   := the dataset name, method names and payloads
+//   index  := { u64 method offset, u32 method size, u32 kind, u64 payload offset, u64 payload size }*,
+//             sorted by method name and kind
+// All the integers are little-endian. The payloads are messages in the protobuf wire format
+constexpr char DATASET_BUNDLE_MAGIC[8] = { 'G', 'M', 'S', 'B', 'N', 'D', '0', '1' };
+
+enum DatasetFixtureKind : uint32_t {
+    // Whole response, replaces the upstream call
+    DATASET_FIXTURE_FULL = 0,
+    // Fields merged into the upstream response (protobuf merge: repeated fields are appended)
+    DATASET_FIXTURE_PARTIAL = 1
+};
+
+struct DatasetFixture {
+    // Full method name like "package.Service/Method"
+    std::string method;
+    DatasetFixtureKind kind = DATASET_FIXTURE_FULL;
+    std::string payload;
+};
+
+// Reads the dataset `dataset_name` from the configuration XML, converts its JSON fixtures to the wire format
+// validating them against the generated message descriptors, and writes the bundle.
+// Relative fixture paths are resolved against `base_directory`
+bool buildDatasetBundle(
+    const std::string &config_xml_data,
+    const std::string &dataset_name,
+    const std::string &base_directory,
+    const std::string &output_path,
+    std::string &error
+);
+
+bool writeDatasetBundle(
+    const std::string &dataset_name,
+    std::vector<DatasetFixture> fixtures,
+    const std::string &output_path,
+    std::string &error
+);
+
+/// <summary>
+/// Memory-mapped bundle: only the index pages and the payloads actually looked up are loaded
+/// </summary>
+class DatasetBundle {
+    struct IndexEntry {
+        uint64_t method_offset;
+        uint32_t method_size;
+        uint32_t kind;
+        uint64_t payload_offset;
+        uint64_t payload_size;
+    };
+
+    MappedFile m_file;
+    const char *m_index = nullptr;
+    uint32_t m_entry_count = 0;
+    std::string_view m_dataset_name;
+
+    IndexEntry entry(uint32_t index) const;
+
+public:
+    bool open(const std::string &file_path, std::string &error);
+
+    std::string_view datasetName() const { return m_dataset_name; }
+    size_t size() const { return m_entry_count; }
+    // Full method names like "package.Service/Method", sorted and unique
+    std::vector<std::string> methodNames() const;
+
+    // The view points into the mapped file; returns false if there is no such fixture
+    bool find(std::string_view method, DatasetFixtureKind kind, std::string_view &payload) const;
+};
+
+// These functions will be called by protobuf compiler generated code before reading the fixture files
+// of the method. The response is parsed from the full fixture, or the partial one is merged into it
+bool grpcMockServerLoadBundledResponse(const std::string &method, google::protobuf::Message *response);
+bool grpcMockServerApplyBundledOverride(const std::string &method, google::protobuf::Message *response);
+
+#endif // GRPC_MOCK_SERVER_DATASET_BUNDLE_H
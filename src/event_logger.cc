@@ -0,0 +1,120 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "event_logger.h"
+
+#include <spdlog/async.h>
+#include <spdlog/async_logger.h>
+
+#include <algorithm>
+
+#include <grpc_mock_server_logger.h>
+
+namespace {
+
+// Preallocated message slots; every slot holds a formatted message
+constexpr size_t LOG_QUEUE_SIZE = 16384;
+constexpr size_t LOG_THREAD_COUNT = 1;
+
+constexpr std::array<const char*, static_cast<size_t>(LogCategory::Count)> CATEGORY_NAMES = {
+    "rpc",
+    "config",
+    "upstream",
+    "tls",
+    "storage"
+};
+
+} // anonymous namespace
+
+EventLogger::EventLogger()
+    : m_thread_pool(std::make_shared<spdlog::details::thread_pool>(LOG_QUEUE_SIZE, LOG_THREAD_COUNT)) {
+    const auto &sinks = SystemLogger->sinks();
+    for (size_t i = 0; i < m_loggers.size(); ++i) {
+        auto logger = std::make_shared<spdlog::async_logger>(
+            CATEGORY_NAMES[i],
+            sinks.begin(),
+            sinks.end(),
+            m_thread_pool,
+            spdlog::async_overflow_policy::overrun_oldest
+        );
+        logger->set_level(SystemLogger->level());
+        logger->flush_on(spdlog::level::err);
+        m_loggers[i] = std::move(logger);
+    }
+}
+
+EventLogger &EventLogger::getInstance() {
+    // Created on the first use, when the SystemLogger sinks are already set up
+    static EventLogger instance;
+    return instance;
+}
+
+bool EventLogger::setLevel(const std::string &category, const std::string &level) {
+    auto parsed_level = spdlog::level::from_str(level);
+    // Unknown names are parsed as "off"
+    if (parsed_level == spdlog::level::off && level != "off") {
+        SystemLogger->error("Unknown log level '{}'", level);
+        return false;
+    }
+
+    bool found = false;
+    for (size_t i = 0; i < m_loggers.size(); ++i) {
+        if (category.empty() || category == CATEGORY_NAMES[i]) {
+            m_loggers[i]->set_level(parsed_level);
+            found = true;
+        }
+    }
+    if (!found) {
+        SystemLogger->error("Unknown log category '{}'", category);
+        return false;
+    }
+    return true;
+}
+
+void EventLogger::flush() {
+    for (const auto &logger : m_loggers) {
+        logger->flush();
+    }
+}
+
+size_t EventLogger::droppedMessages() const {
+    return m_thread_pool->overrun_counter();
+}
+
+bool LogRateLimiter::tryAcquire(uint64_t &suppressed) {
+    auto interval_ns = static_cast<int64_t>(1e9 / m_messages_per_second);
+    auto burst_ns = static_cast<int64_t>(1e9);
+    auto now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+    ).count();
+
+    auto next_allowed_ns = m_next_allowed_ns.load(std::memory_order_relaxed);
+    do {
+        if (next_allowed_ns > now_ns + burst_ns) {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+    } while (!m_next_allowed_ns.compare_exchange_weak(
+        next_allowed_ns,
+        std::max(next_allowed_ns, now_ns) + interval_ns,
+        std::memory_order_relaxed
+    ));
+
+    suppressed = m_suppressed.exchange(0, std::memory_order_relaxed);
+    return true;
+}
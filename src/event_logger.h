@@ -0,0 +1,133 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_EVENT_LOGGER_H
+#define GRPC_MOCK_SERVER_EVENT_LOGGER_H
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <array>
+
+#include <spdlog/spdlog.h>
+
+// The log sites below this level are removed at compile time
+#ifndef GMS_LOG_ACTIVE_LEVEL
+#ifdef NDEBUG
+#define GMS_LOG_ACTIVE_LEVEL SPDLOG_LEVEL_INFO
+#else
+#define GMS_LOG_ACTIVE_LEVEL SPDLOG_LEVEL_TRACE
+#endif
+#endif
+
+enum class LogCategory {
+    Rpc,
+    Config,
+    Upstream,
+    Tls,
+    Storage,
+    Count
+};
+
+/// <summary>
+/// Logging for the per-call events. Every category has its own logger with a runtime level;
+/// all of them share the SystemLogger sinks and write through a background thread with
+/// a preallocated queue, so the calling thread only formats the message.
+/// When the queue is full the oldest messages are dropped rather than blocking the call
+/// </summary>
+class EventLogger {
+    std::shared_ptr<spdlog::details::thread_pool> m_thread_pool;
+    std::array<std::shared_ptr<spdlog::logger>, static_cast<size_t>(LogCategory::Count)> m_loggers;
+
+    EventLogger();
+
+public:
+    static EventLogger &getInstance();
+
+    static spdlog::logger &logger(LogCategory category) {
+        return *getInstance().m_loggers[static_cast<size_t>(category)];
+    }
+
+    // Empty category name means all the categories
+    bool setLevel(const std::string &category, const std::string &level);
+    void flush();
+    size_t droppedMessages() const;
+};
+
+/// <summary>
+/// Token bucket allowing `messages_per_second` messages with bursts of the same size
+/// </summary>
+class LogRateLimiter {
+    const double m_messages_per_second;
+    std::atomic<int64_t> m_next_allowed_ns { 0 };
+    std::atomic<uint64_t> m_suppressed { 0 };
+
+public:
+    explicit LogRateLimiter(double messages_per_second) : m_messages_per_second(messages_per_second) {
+    }
+
+    // Returns false if the message must be suppressed; `suppressed` is set to the number of the messages
+    // suppressed since the last allowed one
+    bool tryAcquire(uint64_t &suppressed);
+};
+
+#define GMS_LOG(category, level, ...) \
+    do { \
+        auto &gms_logger = EventLogger::logger(category); \
+        if (gms_logger.should_log(level)) gms_logger.log(level, __VA_ARGS__); \
+    } while (0)
+
+// Logs at most `messages_per_second` messages from this call site
+#define GMS_LOG_RATE_LIMITED(category, level, messages_per_second, ...) \
+    do { \
+        auto &gms_logger = EventLogger::logger(category); \
+        if (gms_logger.should_log(level)) { \
+            static LogRateLimiter gms_rate_limiter(messages_per_second); \
+            uint64_t gms_suppressed = 0; \
+            if (gms_rate_limiter.tryAcquire(gms_suppressed)) { \
+                if (gms_suppressed > 0) gms_logger.log(level, "{} similar messages were suppressed", gms_suppressed); \
+                gms_logger.log(level, __VA_ARGS__); \
+            } \
+        } \
+    } while (0)
+
+#if GMS_LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_TRACE
+#define GMS_LOG_TRACE(category, ...) GMS_LOG(category, spdlog::level::trace, __VA_ARGS__)
+#else
+#define GMS_LOG_TRACE(category, ...) (void)0
+#endif
+
+#if GMS_LOG_ACTIVE_LEVEL <= SPDLOG_LEVEL_DEBUG
+#define GMS_LOG_DEBUG(category, ...) GMS_LOG(category, spdlog::level::debug, __VA_ARGS__)
+#define GMS_LOG_DEBUG_RATE_LIMITED(category, messages_per_second, ...) \
+    GMS_LOG_RATE_LIMITED(category, spdlog::level::debug, messages_per_second, __VA_ARGS__)
+#else
+#define GMS_LOG_DEBUG(category, ...) (void)0
+#define GMS_LOG_DEBUG_RATE_LIMITED(category, messages_per_second, ...) (void)0
+#endif
+
+#define GMS_LOG_INFO(category, ...) GMS_LOG(category, spdlog::level::info, __VA_ARGS__)
+#define GMS_LOG_WARN(category, ...) GMS_LOG(category, spdlog::level::warn, __VA_ARGS__)
+#define GMS_LOG_ERROR(category, ...) GMS_LOG(category, spdlog::level::err, __VA_ARGS__)
+#define GMS_LOG_INFO_RATE_LIMITED(category, messages_per_second, ...) \
+    GMS_LOG_RATE_LIMITED(category, spdlog::level::info, messages_per_second, __VA_ARGS__)
+#define GMS_LOG_ERROR_RATE_LIMITED(category, messages_per_second, ...) \
+    GMS_LOG_RATE_LIMITED(category, spdlog::level::err, messages_per_second, __VA_ARGS__)
+
+#endif // GRPC_MOCK_SERVER_EVENT_LOGGER_H
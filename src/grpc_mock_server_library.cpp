@@ -18,10 +18,22 @@
 
 #include "grpc_mock_server_library.h"
 #include "business_logic.h"
+#include "upstream_proxy.h"
+#include "admission_control.h"
+#include "upstream_router.h"
+#include "tuning_profile.h"
+#include "traffic_capture.h"
+#include "rpc_tracing.h"
+#include "event_logger.h"
+#include "dataset_bundle.h"
+
+#include <grpc_mock_server_logger.h>
 
 #include <fstream>
 #include <sstream>
 #include <filesystem>
+#include <chrono>
+#include <algorithm>
 
 #ifdef ANDROID
 
@@ -160,6 +172,10 @@ void setSslUsage(bool use_ssl) {
     BusinessLogic::getInstance().setSslUsage(use_ssl);
 }
 
+void addListeningAddress(const std::string &address) {
+    BusinessLogic::getInstance().addListeningAddress(address);
+}
+
 void setRemoteServerCertificate(const std::string &crt_data) {
     BusinessLogic::getInstance().setRemoteServerCertificateData(crt_data);
 }
@@ -172,6 +188,20 @@ void setLocalServerCertificate(
     BusinessLogic::getInstance().setLocalServerCertificateData(server_cert_data, server_key_data, ca_cert_data);
 }
 
+void setLocalServerCertificateFiles(
+    const std::string &server_cert_path,
+    const std::string &server_key_path,
+    const std::string &ca_cert_path,
+    unsigned int refresh_interval_sec
+) {
+    BusinessLogic::getInstance().setLocalServerCertificateFiles(
+        server_cert_path,
+        server_key_path,
+        ca_cert_path,
+        refresh_interval_sec
+    );
+}
+
 void setAppDirectory(const std::string &app_directory) {
 #ifdef ANDROID
     std::__fs::filesystem::path app_directory_path(app_directory);
@@ -179,6 +209,9 @@ void setAppDirectory(const std::string &app_directory) {
     std::filesystem::path app_directory_path(app_directory);
 #endif
 
+    std::filesystem::path certificate_directory_path = app_directory_path / "certificates";
+    BusinessLogic::getInstance().setCertificateDirectory(certificate_directory_path.generic_string());
+
     std::filesystem::path database_path = app_directory_path /= "database.db3";
     BusinessLogic::getInstance().setDatabaseFilePath(database_path.generic_string());
 }
@@ -187,6 +220,80 @@ void setPackagesXmlData(const std::string &packages_xml_data) {
     BusinessLogic::getInstance().setPackagesXmlData(packages_xml_data);
 }
 
+bool setTuningProfile(const TuningProfile &profile) {
+    return BusinessLogic::getInstance().setTuningProfile(profile);
+}
+
+bool setNamedTuningProfile(const std::string &profile_name) {
+    TuningProfile profile;
+    if (!findTuningProfile(profile_name, profile)) {
+        SystemLogger->error("Unknown tuning profile '{}'", profile_name);
+        return false;
+    }
+    return BusinessLogic::getInstance().setTuningProfile(profile);
+}
+
+bool setTuningProfileXmlData(const std::string &tuning_xml_data) {
+    TuningProfile profile;
+    std::string error;
+    if (!parseTuningProfileXml(tuning_xml_data, profile, error)) {
+        SystemLogger->error("Unable to parse tuning profile: {}", error);
+        return false;
+    }
+    return BusinessLogic::getInstance().setTuningProfile(profile);
+}
+
+TuningProfile getTuningProfile() {
+    return BusinessLogic::getInstance().tuningProfile();
+}
+
+void setHedgingPolicy(const std::string &method, int delay_ms, double delay_percentile) {
+    BusinessLogic::getInstance().upstreamProxy().setHedgingPolicy(method, delay_ms, delay_percentile);
+}
+
+void setCoalescingEnabled(const std::string &method, bool enabled) {
+    BusinessLogic::getInstance().upstreamProxy().setCoalescingEnabled(method, enabled);
+}
+
+void setConcurrencyLimits(
+    int global_limit,
+    int method_initial_limit,
+    int method_min_limit,
+    int method_max_limit,
+    int queue_size,
+    int queue_timeout_ms
+) {
+    BusinessLogic::getInstance().admissionController().setLimits(
+        global_limit,
+        method_initial_limit,
+        method_min_limit,
+        method_max_limit,
+        queue_size,
+        queue_timeout_ms
+    );
+}
+
+bool addUpstreamGroup(const std::string &name, const std::vector<std::string> &targets) {
+    return BusinessLogic::getInstance().upstreamRouter().addGroup(name, targets);
+}
+
+bool addUpstreamRoute(const std::string &prefix, const std::string &group_name) {
+    return BusinessLogic::getInstance().upstreamRouter().addRoute(prefix, group_name);
+}
+
+void setUpstreamEjectionPolicy(int consecutive_failures, int ejection_time_ms) {
+    BusinessLogic::getInstance().upstreamRouter().setEjectionPolicy(consecutive_failures, ejection_time_ms);
+}
+
+bool setUpstreamRoutingXmlData(const std::string &routing_xml_data) {
+    std::string error;
+    if (!BusinessLogic::getInstance().upstreamRouter().parseXml(routing_xml_data, error)) {
+        SystemLogger->error("Unable to parse upstream routing: {}", error);
+        return false;
+    }
+    return true;
+}
+
 bool isRemoteServerAvailable() {
     return BusinessLogic::getInstance().isRemoteServerAvailable();
 }
@@ -204,7 +311,123 @@ void startServer(std::function<void()> on_started_callback) {
 }
 
 void stopServer() {
-    BusinessLogic::getInstance().stopServer();
+    // Returns once the calls in progress have finished, use `stopServerAndWait` to bound the wait
+    BusinessLogic::getInstance().stopServer(std::chrono::milliseconds::max());
+}
+
+bool stopServerAndWait(int drain_timeout_ms) {
+    auto drain_timeout = std::chrono::milliseconds(std::max(0, drain_timeout_ms));
+    if (!BusinessLogic::getInstance().stopServer(drain_timeout)) return false;
+    return BusinessLogic::getInstance().waitForServerStopped(std::chrono::milliseconds::max());
+}
+
+bool waitForServerStopped(int timeout_ms) {
+    return BusinessLogic::getInstance().waitForServerStopped(std::chrono::milliseconds(std::max(0, timeout_ms)));
+}
+
+bool restartServer(std::function<void()> on_started_callback, int drain_timeout_ms) {
+    return BusinessLogic::getInstance().restartServer(
+        on_started_callback,
+        std::chrono::milliseconds(std::max(0, drain_timeout_ms))
+    );
+}
+
+ServerState getServerState() {
+    return BusinessLogic::getInstance().serverState();
+}
+
+std::shared_ptr<grpc::Channel> createInProcessChannel() {
+    return BusinessLogic::getInstance().createInProcessChannel();
+}
+
+bool startTrafficCapture(const std::string &directory, unsigned long long segment_size_bytes) {
+    if (directory.empty() || segment_size_bytes == 0) {
+        SystemLogger->error("Invalid traffic capture directory or segment size");
+        return false;
+    }
+    return BusinessLogic::getInstance().trafficCapture().start(directory, segment_size_bytes);
+}
+
+void stopTrafficCapture() {
+    BusinessLogic::getInstance().trafficCapture().stop();
+}
+
+void setRpcTracing(bool enabled, double sample_rate) {
+    RpcTracer::setEnabled(enabled, sample_rate);
+}
+
+bool writeRpcTrace(const std::string &file_path) {
+    return RpcTracer::writeTraceFile(file_path);
+}
+
+bool setLogLevel(const std::string &category, const std::string &level) {
+    return EventLogger::getInstance().setLevel(category, level);
+}
+
+bool compileDatasetBundle(
+    const std::string &config_xml_data,
+    const std::string &dataset_name,
+    const std::string &base_directory,
+    const std::string &bundle_path
+) {
+    std::string error;
+    if (!buildDatasetBundle(config_xml_data, dataset_name, base_directory, bundle_path, error)) {
+        SystemLogger->error("Unable to compile dataset '{}': {}", dataset_name, error);
+        return false;
+    }
+    return true;
+}
+
+bool loadDatasetBundle(const std::string &bundle_path) {
+    return BusinessLogic::getInstance().loadDatasetBundle(bundle_path);
+}
+
+void setPassThroughWorkers(int worker_count) {
+    if (worker_count < 0) {
+        SystemLogger->error("Invalid pass-through worker count {}", worker_count);
+        return;
+    }
+    BusinessLogic::getInstance().setPassThroughWorkers(static_cast<size_t>(worker_count));
+}
+
+bool setSyntheticResponses(const SyntheticResponseSettings &settings) {
+    return BusinessLogic::getInstance().setSyntheticResponses(settings);
+}
+
+void setWarmUp(bool enabled, int timeout_ms) {
+    BusinessLogic::getInstance().setWarmUp(enabled, timeout_ms);
+}
+
+bool addWarmUpRequest(const std::string &method, const std::string &request_json) {
+    return BusinessLogic::getInstance().addWarmUpRequest(method, request_json);
+}
+
+void clearWarmUpRequests() {
+    BusinessLogic::getInstance().clearWarmUpRequests();
+}
+
+bool setHistoryCompression(bool enabled, int level, bool train_dictionary) {
+    return BusinessLogic::getInstance().setHistoryCompression(enabled, level, train_dictionary);
+}
+
+bool readHistoryPayload(long long payload_id, std::string &data) {
+    return BusinessLogic::getInstance().readHistoryPayload(payload_id, data);
+}
+
+TlsStatistics getTlsStatistics() {
+    return BusinessLogic::getInstance().tlsStatistics();
+}
+
+UpstreamStatistics getUpstreamStatistics(const std::string &method) {
+    return BusinessLogic::getInstance().upstreamProxy().statistics(method);
+}
+
+AdmissionStatistics getAdmissionStatistics(const std::string &method) {
+    return BusinessLogic::getInstance().admissionController().statistics(method);
+}
+
+UpstreamEndpointStatistics getUpstreamEndpointStatistics(const std::string &target) {
+    return BusinessLogic::getInstance().upstreamRouter().statistics(target);
 }
 
 } // namespace grpc_mock_server
@@ -24,6 +24,119 @@
 #include <iostream>
 #include <functional>
 #include <filesystem>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace grpc { class Channel; }
+
+namespace grpc_mock_server {
+
+struct TlsStatistics {
+    // Handshakes of the connections accepted by the local server
+    uint64_t server_full_handshakes = 0;
+    uint64_t server_resumed_handshakes = 0;
+    // Full handshake time of the local server, measured over loopback when it starts,
+    // since gRPC doesn't expose the timing of the handshakes it accepts
+    uint64_t server_handshake_probe_time_us = 0;
+    // Connection setups (TCP + TLS) of the channels created by the library
+    uint64_t client_handshakes = 0;
+    uint64_t client_handshake_time_us_total = 0;
+    uint64_t client_handshake_time_us_max = 0;
+    // Local server certificate rotations made without restart
+    uint64_t certificate_updates = 0;
+};
+
+struct UpstreamStatistics {
+    // Calls forwarded to the upstream server
+    uint64_t calls = 0;
+    uint64_t failed_calls = 0;
+    // Calls which needed the second (hedged) attempt, and how many times it replied first
+    uint64_t hedged_calls = 0;
+    uint64_t hedge_wins = 0;
+    // Calls which were not forwarded but got the reply of an identical concurrent call
+    uint64_t coalesced_calls = 0;
+};
+
+struct AdmissionStatistics {
+    // Current (possibly adapted) concurrency limit
+    double limit = 0.0;
+    uint64_t in_flight = 0;
+    uint64_t queued = 0;
+    uint64_t admitted = 0;
+    // Calls failed fast with RESOURCE_EXHAUSTED
+    uint64_t rejected = 0;
+};
+
+struct UpstreamEndpointStatistics {
+    uint64_t calls = 0;
+    uint64_t failed_calls = 0;
+    uint64_t in_flight = 0;
+    // Exponentially weighted moving average of the latency, reacting to the peaks at once
+    double latency_ewma_us = 0.0;
+    // Times the endpoint was taken out of rotation after consecutive failures
+    uint64_t ejections = 0;
+    bool ejected = false;
+};
+
+// Settings of the local server and the channels created by the library.
+// Zero values (and -1 for `max_pings_without_data`) leave the gRPC defaults
+struct TuningProfile {
+    // Synchronous server polling
+    int num_cqs = 0;
+    int min_pollers = 0;
+    int max_pollers = 0;
+    int cq_timeout_ms = 0;
+    // Resource quota
+    int max_threads = 0;
+    int64_t memory_quota_bytes = 0;
+    // Message size limits, -1 means unlimited
+    int max_receive_message_size = 0;
+    int max_send_message_size = 0;
+    // HTTP/2 flow control
+    bool bdp_probe = true;
+    int stream_lookahead_bytes = 0;
+    int max_frame_size = 0;
+    // Keepalive
+    int keepalive_time_ms = 0;
+    int keepalive_timeout_ms = 0;
+    bool keepalive_permit_without_calls = false;
+    int max_pings_without_data = -1;
+    int min_ping_interval_without_data_ms = 0;
+    // Keepalive of the channels created by the library, off unless set: the server keepalive
+    // above is much too frequent for most upstream servers, which reply with a "too_many_pings" GOAWAY
+    int channel_keepalive_time_ms = 0;
+    int channel_keepalive_timeout_ms = 0;
+    bool channel_keepalive_permit_without_calls = false;
+    // Default gzip compression of the server responses
+    bool compression = true;
+};
+
+// Responses generated from the output message descriptors, returned for the methods with no fixture
+// while the upstream server is unavailable or too slow
+struct SyntheticResponseSettings {
+    bool enabled = false;
+    // The methods with no fixture get a synthetic response without trying the upstream server at all
+    bool synthetic_only = false;
+    // Approximate serialized size of every response
+    int target_size_bytes = 256;
+    // Number of elements of every repeated (and map) field
+    int repeated_field_count = 2;
+    // The same seed generates the same responses
+    uint64_t seed = 0;
+    // Different responses generated per method and returned in turn
+    int pool_size = 16;
+};
+
+enum ServerState {
+    SERVER_STOPPED = 0,
+    SERVER_STARTING,
+    SERVER_RUNNING,
+    SERVER_STOPPING
+};
+
+} // namespace grpc_mock_server
 
 #ifdef ANDROID
 
@@ -80,20 +193,131 @@ namespace grpc_mock_server {
 // Setters
 extern "C" GRPC_MOCK_SERVER_LIBRARY_API void setHostAndPort(const std::string &host_url, int port);
 extern "C" GRPC_MOCK_SERVER_LIBRARY_API void setSslUsage(bool use_ssl);
+// Additional listening address, e.g. "unix:/tmp/mock.sock" or "127.0.0.1:50052". Unix domain sockets
+// are served without TLS. Set the port to -1 in `setHostAndPort` to listen on these addresses only,
+// or to 0 to listen on any free TCP port
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API void addListeningAddress(const std::string &address);
 extern "C" GRPC_MOCK_SERVER_LIBRARY_API void setRemoteServerCertificate(const std::string &crt_data);
 extern "C" GRPC_MOCK_SERVER_LIBRARY_API void setLocalServerCertificate(
     const std::string &server_cert_data,
     const std::string &server_key_data,
     const std::string &ca_cert_data
 );
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API void setLocalServerCertificateFiles(
+    const std::string &server_cert_path,
+    const std::string &server_key_path,
+    const std::string &ca_cert_path,
+    unsigned int refresh_interval_sec
+);
 extern "C" GRPC_MOCK_SERVER_LIBRARY_API void setAppDirectory(const std::string &app_directory);
 extern "C" GRPC_MOCK_SERVER_LIBRARY_API void setPackagesXmlData(const std::string &packages_xml_data);
+// Tuning profile, validated before use: returns false and keeps the current profile if it is invalid.
+// Named profiles are "default", "low-latency" and "bulk-payload"
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool setTuningProfile(const TuningProfile &profile);
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool setNamedTuningProfile(const std::string &profile_name);
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool setTuningProfileXmlData(const std::string &tuning_xml_data);
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API TuningProfile getTuningProfile();
+// Sends a second upstream attempt if the first one did not reply in `delay_ms`, or in the `delay_percentile`
+// of the observed method latencies if it is non-zero; the first reply wins. Use for idempotent methods only.
+// Until enough latencies are observed for the percentile, `delay_ms` is used, and zero means no hedging yet.
+// The second attempt is only sent if the admission limits have a free slot for it.
+// `method` is a full method name like "package.Service/Method"; zero delays disable hedging
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API void setHedgingPolicy(
+    const std::string &method,
+    int delay_ms,
+    double delay_percentile
+);
+// Coalesces the identical (same method and serialized request) concurrent calls into a single upstream call
+// and fans its reply out to all of them. Use for read-only methods only
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API void setCoalescingEnabled(const std::string &method, bool enabled);
+// Limits the number of concurrent upstream calls. Every method gets its own limit adapted (AIMD) between
+// `method_min_limit` and `method_max_limit` by the observed latency; `global_limit` caps all the methods together
+// (zero means no cap). Calls over the limit wait up to `queue_timeout_ms` in a queue of `queue_size` calls,
+// the rest are rejected with RESOURCE_EXHAUSTED
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API void setConcurrencyLimits(
+    int global_limit,
+    int method_initial_limit,
+    int method_min_limit,
+    int method_max_limit,
+    int queue_size,
+    int queue_timeout_ms
+);
+// Named group of upstream endpoints ("host:port"); every call goes to the endpoint with the lowest
+// latency EWMA times outstanding calls
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool addUpstreamGroup(const std::string &name, const std::vector<std::string> &targets);
+// Routes the calls of a package ("package"), a service ("package.Service") or a method ("package.Service/Method")
+// to the group; the longest matching prefix wins, the calls without a route go to the default upstream
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool addUpstreamRoute(const std::string &prefix, const std::string &group_name);
+// An endpoint failing `consecutive_failures` times in a row is left out for `ejection_time_ms`,
+// the repeated ejections last longer
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API void setUpstreamEjectionPolicy(int consecutive_failures, int ejection_time_ms);
+// Replaces the groups and routes with the ones from the <upstreams> element
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool setUpstreamRoutingXmlData(const std::string &routing_xml_data);
 
 // Actions
 extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool isRemoteServerAvailable();
 extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool healthCheck();
 extern "C" GRPC_MOCK_SERVER_LIBRARY_API void startServer(std::function<void()> on_started_callback);
+// Rejects the new calls at once and returns when the calls in progress have finished,
+// without waiting for the server thread
 extern "C" GRPC_MOCK_SERVER_LIBRARY_API void stopServer();
+// Rejects the new calls at once and gives the calls in progress up to `drain_timeout_ms` to finish,
+// then waits until the calls history is written and the server thread is finished
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool stopServerAndWait(int drain_timeout_ms);
+// Must not be called from the `on_started_callback`
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool waitForServerStopped(int timeout_ms);
+// Stops the server, if running, and starts it again reusing the upstream channel and the parsed configuration
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool restartServer(std::function<void()> on_started_callback, int drain_timeout_ms);
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API ServerState getServerState();
+// Channel calling the running server directly, bypassing the transport; nullptr if the server is not running
+GRPC_MOCK_SERVER_LIBRARY_API std::shared_ptr<grpc::Channel> createInProcessChannel();
+// Appends every incoming call to the segment files in `directory` (see the replay tool),
+// a new file is started when the current one reaches `segment_size_bytes`
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool startTrafficCapture(const std::string &directory, unsigned long long segment_size_bytes);
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API void stopTrafficCapture();
+// Records the phases (receive, override lookup, upstream call, JSON conversion, history write, send)
+// of every call, or of a `sample_rate` fraction of them; the spans are kept in memory until written out
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API void setRpcTracing(bool enabled, double sample_rate);
+// Writes the recorded spans to a Chrome trace JSON file (chrome://tracing, ui.perfetto.dev)
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool writeRpcTrace(const std::string &file_path);
+// Sets the level ("trace", "debug", "info", "warning", "error", "critical", "off") of the per-call event logging
+// category: "rpc", "config", "upstream", "tls" or "storage"; empty category means all of them
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool setLogLevel(const std::string &category, const std::string &level);
+// Packs the fixtures of the dataset `dataset_name` from the configuration XML into a single indexed file,
+// converted to the protobuf wire format and validated; relative fixture paths are resolved against `base_directory`
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool compileDatasetBundle(
+    const std::string &config_xml_data,
+    const std::string &dataset_name,
+    const std::string &base_directory,
+    const std::string &bundle_path
+);
+// Memory-maps the compiled bundle, the fixtures are loaded on their first use; empty path unloads it
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool loadDatasetBundle(const std::string &bundle_path);
+// Forwards the unary calls of the methods no generated service knows upstream as is, on `worker_count` threads;
+// zero (the default) answers them with UNIMPLEMENTED. Takes effect on the next server start
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API void setPassThroughWorkers(int worker_count);
+// Responses are generated when the server starts, see `SyntheticResponseSettings`
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool setSyntheticResponses(const SyntheticResponseSettings &settings);
+// Before reporting being started, the server connects the upstream channels, prepares the message types
+// of all the methods and sends the warm-up requests to itself, waiting up to `timeout_ms` for each of these steps.
+// Disabled by default: it delays every start and restart
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API void setWarmUp(bool enabled, int timeout_ms);
+// The request is given in JSON; the warm-up calls go through the server handlers, but they are answered
+// without the upstream server and left out of the history and the traffic capture
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool addWarmUpRequest(const std::string &method, const std::string &request_json);
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API void clearWarmUpRequests();
+// zstd compression of the stored history payloads (the same bodies are always stored once), optionally with
+// a dictionary trained on the first of them. `level` is a zstd compression level. Takes effect on the next server start
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool setHistoryCompression(bool enabled, int level, bool train_dictionary);
+// Reads the body referenced by the 'request_payload_id' or 'response_payload_id' column of the history table
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API bool readHistoryPayload(long long payload_id, std::string &data);
+
+// Statistics
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API TlsStatistics getTlsStatistics();
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API UpstreamStatistics getUpstreamStatistics(const std::string &method);
+// Empty method name returns the global limit statistics
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API AdmissionStatistics getAdmissionStatistics(const std::string &method);
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API UpstreamEndpointStatistics getUpstreamEndpointStatistics(const std::string &target);
 
 } // namespace grpc_mock_server
 
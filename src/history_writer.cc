@@ -0,0 +1,140 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "history_writer.h"
+#include "event_logger.h"
+
+#include <chrono>
+#include <cassert>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+#include <grpc_mock_server_logger.h>
+
+namespace {
+
+constexpr auto FLUSH_INTERVAL = std::chrono::milliseconds(50);
+constexpr size_t FLUSH_THRESHOLD = 512;
+
+// Rows are dropped rather than growing the queue without a limit if the disk can't keep up
+constexpr size_t MAX_PENDING_ROWS = 100000;
+
+} // anonymous namespace
+
+HistoryWriter::~HistoryWriter() {
+    stop();
+}
+
+void HistoryWriter::start(SQLite::Database *database, const PayloadStore::Settings &payload_settings) {
+    assert(database != nullptr);
+    stop();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_database = database;
+    m_payloads.open(database, payload_settings);
+    m_pending.clear();
+    m_stop_requested = false;
+    m_dropped_rows = 0;
+    m_running = true;
+    m_thread = std::thread(&HistoryWriter::writerLoop, this);
+}
+
+void HistoryWriter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running) return;
+        m_stop_requested = true;
+    }
+    m_cv.notify_one();
+    m_thread.join();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_running = false;
+    m_payloads.close();
+    m_database = nullptr;
+    if (m_dropped_rows > 0) {
+        SystemLogger->warn("{} history rows were dropped because of a full queue", m_dropped_rows);
+    }
+}
+
+bool HistoryWriter::add(
+    time_t time,
+    const std::string &method,
+    const std::string &request_json,
+    int status,
+    const std::string &response_json
+) {
+    bool notify = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_running || m_stop_requested) return false;
+        if (m_pending.size() >= MAX_PENDING_ROWS) {
+            ++m_dropped_rows;
+            return false;
+        }
+        m_pending.push_back({ time, method, request_json, status, response_json });
+        notify = m_pending.size() == FLUSH_THRESHOLD;
+    }
+    if (notify) m_cv.notify_one();
+    return true;
+}
+
+void HistoryWriter::writerLoop() {
+    std::vector<Row> rows;
+    bool stop_requested = false;
+    while (!stop_requested) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait_for(lock, FLUSH_INTERVAL, [this]() {
+                return m_stop_requested || m_pending.size() >= FLUSH_THRESHOLD;
+            });
+            stop_requested = m_stop_requested;
+            rows.swap(m_pending);
+        }
+        if (rows.empty()) continue;
+
+        writeBatch(rows);
+        rows.clear();
+    }
+}
+
+void HistoryWriter::writeBatch(const std::vector<Row> &rows) {
+    try {
+        SQLite::Transaction transaction(*m_database);
+        SQLite::Statement insert_query(
+            *m_database,
+            "INSERT INTO history VALUES (NULL, ?, (SELECT id FROM methods WHERE name = ?), ?, ?, ?)"
+        );
+        for (const auto &row : rows) {
+            insert_query.bind(1, static_cast<int64_t>(row.time));
+            insert_query.bind(2, row.method);
+            insert_query.bind(3, m_payloads.add(row.request_json));
+            insert_query.bind(4, row.status);
+            insert_query.bind(5, m_payloads.add(row.response_json));
+            insert_query.exec();
+            insert_query.reset();
+        }
+        m_payloads.commitReferences();
+        transaction.commit();
+        m_payloads.commit();
+    }
+    catch (const SQLite::Exception &exc) {
+        m_payloads.rollback();
+        GMS_LOG_ERROR_RATE_LIMITED(LogCategory::Storage, 1, "Unable to add {} history rows to database: {}", rows.size(), exc.getErrorStr());
+    }
+}
@@ -0,0 +1,82 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_HISTORY_WRITER_H
+#define GRPC_MOCK_SERVER_HISTORY_WRITER_H
+
+#include <ctime>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "payload_store.h"
+
+namespace SQLite { class Database; }
+
+/// <summary>
+/// Writes the calls history rows from a background thread in batches, one transaction per batch.
+/// The RPC threads only queue the rows, so they neither wait for the disk nor race each other
+/// or the database closing on the shared connection. The request and response bodies are kept
+/// in the payload store, the rows reference them by id
+/// </summary>
+class HistoryWriter {
+    struct Row {
+        time_t time;
+        std::string method;
+        std::string request_json;
+        int status;
+        std::string response_json;
+    };
+
+    SQLite::Database *m_database = nullptr;
+    PayloadStore m_payloads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::vector<Row> m_pending;
+    bool m_running = false;
+    bool m_stop_requested = false;
+    uint64_t m_dropped_rows = 0;
+    std::thread m_thread;
+
+    void writerLoop();
+    void writeBatch(const std::vector<Row> &rows);
+
+public:
+    HistoryWriter() = default;
+    ~HistoryWriter();
+
+    HistoryWriter(const HistoryWriter&) = delete;
+    HistoryWriter &operator=(const HistoryWriter&) = delete;
+
+    void start(SQLite::Database *database, const PayloadStore::Settings &payload_settings);
+    // Writes all the queued rows before returning
+    void stop();
+
+    bool add(
+        time_t time,
+        const std::string &method,
+        const std::string &request_json,
+        int status,
+        const std::string &response_json
+    );
+};
+
+#endif // GRPC_MOCK_SERVER_HISTORY_WRITER_H
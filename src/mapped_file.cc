@@ -0,0 +1,165 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "mapped_file.h"
+
+#include <utility>
+
+#ifdef WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+MappedFile::MappedFile(MappedFile &&other) noexcept {
+    *this = std::move(other);
+}
+
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept {
+    if (this != &other) {
+        close();
+        std::swap(m_data, other.m_data);
+        std::swap(m_size, other.m_size);
+        std::swap(m_open, other.m_open);
+#ifdef WIN32
+        std::swap(m_file_handle, other.m_file_handle);
+        std::swap(m_mapping_handle, other.m_mapping_handle);
+#else
+        std::swap(m_fd, other.m_fd);
+#endif
+    }
+    return *this;
+}
+
+#ifdef WIN32
+
+bool MappedFile::open(const std::string &file_path, bool sequential_access, std::string &error) {
+    close();
+
+    HANDLE file_handle = CreateFileA(
+        file_path.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL | (sequential_access ? FILE_FLAG_SEQUENTIAL_SCAN : FILE_FLAG_RANDOM_ACCESS),
+        nullptr
+    );
+    if (file_handle == INVALID_HANDLE_VALUE) {
+        error = "CreateFile() failed with code " + std::to_string(GetLastError());
+        return false;
+    }
+    m_file_handle = file_handle;
+
+    LARGE_INTEGER file_size{};
+    if (!GetFileSizeEx(file_handle, &file_size)) {
+        error = "GetFileSizeEx() failed with code " + std::to_string(GetLastError());
+        close();
+        return false;
+    }
+    m_size = static_cast<size_t>(file_size.QuadPart);
+    m_open = true;
+
+    // Empty files can not be mapped, but are valid
+    if (m_size == 0) return true;
+
+    HANDLE mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping_handle == nullptr) {
+        error = "CreateFileMapping() failed with code " + std::to_string(GetLastError());
+        close();
+        return false;
+    }
+    m_mapping_handle = mapping_handle;
+
+    m_data = static_cast<const char*>(MapViewOfFile(mapping_handle, FILE_MAP_READ, 0, 0, 0));
+    if (m_data == nullptr) {
+        error = "MapViewOfFile() failed with code " + std::to_string(GetLastError());
+        close();
+        return false;
+    }
+    return true;
+}
+
+void MappedFile::close() {
+    if (m_data != nullptr) UnmapViewOfFile(m_data);
+    if (m_mapping_handle != nullptr) CloseHandle(m_mapping_handle);
+    if (m_file_handle != nullptr) CloseHandle(m_file_handle);
+
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+    m_mapping_handle = nullptr;
+    m_file_handle = nullptr;
+}
+
+#else
+
+bool MappedFile::open(const std::string &file_path, bool sequential_access, std::string &error) {
+    close();
+
+    m_fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd == -1) {
+        error = std::string("open() failed: ") + strerror(errno);
+        return false;
+    }
+
+    struct stat file_stat {};
+    if (fstat(m_fd, &file_stat) != 0) {
+        error = std::string("fstat() failed: ") + strerror(errno);
+        close();
+        return false;
+    }
+    m_size = static_cast<size_t>(file_stat.st_size);
+    m_open = true;
+
+    // Empty files can not be mapped, but are valid
+    if (m_size == 0) return true;
+
+    void *data = mmap(nullptr, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if (data == MAP_FAILED) {
+        error = std::string("mmap() failed: ") + strerror(errno);
+        close();
+        return false;
+    }
+    m_data = static_cast<const char*>(data);
+
+    madvise(data, m_size, sequential_access ? MADV_SEQUENTIAL : MADV_RANDOM);
+    return true;
+}
+
+void MappedFile::close() {
+    if (m_data != nullptr) munmap(const_cast<char*>(m_data), m_size);
+    if (m_fd != -1) ::close(m_fd);
+
+    m_data = nullptr;
+    m_size = 0;
+    m_open = false;
+    m_fd = -1;
+}
+
+#endif
@@ -0,0 +1,60 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_MAPPED_FILE_H
+#define GRPC_MOCK_SERVER_MAPPED_FILE_H
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+/// <summary>
+/// Read-only memory mapping of a whole file: the pages are loaded lazily by the OS
+/// when touched and may be dropped under memory pressure
+/// </summary>
+class MappedFile {
+    const char *m_data = nullptr;
+    size_t m_size = 0;
+    bool m_open = false;
+#ifdef WIN32
+    void *m_file_handle = nullptr;
+    void *m_mapping_handle = nullptr;
+#else
+    int m_fd = -1;
+#endif
+
+public:
+    MappedFile() = default;
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile &operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    // Sequential access enables the read-ahead, random one disables it
+    bool open(const std::string &file_path, bool sequential_access, std::string &error);
+    void close();
+
+    bool isOpen() const { return m_open; }
+    const char *data() const { return m_data; }
+    size_t size() const { return m_size; }
+    std::string_view view() const { return std::string_view(m_data, m_size); }
+};
+
+#endif // GRPC_MOCK_SERVER_MAPPED_FILE_H
@@ -0,0 +1,115 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "pass_through_service.h"
+#include "upstream_proxy.h"
+#include "rpc_tracing.h"
+
+#include <cassert>
+
+namespace {
+
+class PassThroughReactor : public grpc::ServerGenericBidiReactor {
+    PassThroughService *m_service;
+    grpc::GenericCallbackServerContext *m_context;
+    grpc::ByteBuffer m_request;
+    grpc::ByteBuffer m_response;
+
+public:
+    PassThroughReactor(PassThroughService *service, grpc::GenericCallbackServerContext *context)
+        : m_service(service), m_context(context) {
+        StartRead(&m_request);
+    }
+
+    void OnReadDone(bool ok) override {
+        if (!ok) {
+            Finish(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Request message expected"));
+            return;
+        }
+
+        // The trace context is bound to the thread, so it goes along with the task to the worker thread
+        // and is unbound from this one, which runs the callbacks of other calls next
+        auto rpc_id = RpcTracer::currentRpc();
+        RpcTracer::endRpc();
+        m_service->post([this, rpc_id]() {
+            RpcTracer::bindRpc(rpc_id);
+            // "/package.Service/Method" -> "package.Service/Method"
+            auto method = m_context->method().substr(1);
+            auto status = m_service->upstreamProxy().forward(m_context, method, m_request, &m_response);
+            RpcTracer::endRpc();
+            if (!status.ok()) {
+                Finish(status);
+                return;
+            }
+            StartWriteAndFinish(&m_response, grpc::WriteOptions(), status);
+        });
+    }
+
+    void OnDone() override {
+        delete this;
+    }
+};
+
+} // anonymous namespace
+
+PassThroughService::PassThroughService(UpstreamProxy *upstream_proxy, size_t worker_count)
+    : m_upstream_proxy(upstream_proxy) {
+    assert(upstream_proxy != nullptr);
+    assert(worker_count > 0);
+
+    for (size_t i = 0; i < worker_count; ++i) {
+        m_workers.emplace_back(&PassThroughService::workerLoop, this);
+    }
+}
+
+PassThroughService::~PassThroughService() {
+    {
+        std::lock_guard<std::mutex> lock(m_tasks_mutex);
+        m_stop_requested = true;
+    }
+    m_tasks_cv.notify_all();
+    for (auto &worker : m_workers) worker.join();
+}
+
+void PassThroughService::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(m_tasks_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_tasks_cv.notify_one();
+}
+
+void PassThroughService::workerLoop() {
+    while (true) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(m_tasks_mutex);
+            m_tasks_cv.wait(lock, [this]() { return m_stop_requested || !m_tasks.empty(); });
+            // The server is shut down before the service is destroyed, so no task is left behind
+            if (m_tasks.empty()) return;
+
+            task = std::move(m_tasks.front());
+            m_tasks.pop_front();
+        }
+        task();
+    }
+}
+
+grpc::ServerGenericBidiReactor *PassThroughService::CreateReactor(grpc::GenericCallbackServerContext *context) {
+    return new PassThroughReactor(this, context);
+}
@@ -0,0 +1,63 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_PASS_THROUGH_SERVICE_H
+#define GRPC_MOCK_SERVER_PASS_THROUGH_SERVICE_H
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+#include <grpc++/grpc++.h>
+#include <grpcpp/generic/async_generic_service.h>
+
+class UpstreamProxy;
+
+/// <summary>
+/// Handles the unary calls of the methods no registered service knows: the request is forwarded
+/// upstream as raw bytes, without parsing it. The upstream call blocks, so it is made on a worker thread
+/// rather than on the callback thread
+/// </summary>
+class PassThroughService : public grpc::CallbackGenericService {
+    UpstreamProxy *m_upstream_proxy;
+
+    std::mutex m_tasks_mutex;
+    std::condition_variable m_tasks_cv;
+    std::deque<std::function<void()>> m_tasks;
+    bool m_stop_requested = false;
+    std::vector<std::thread> m_workers;
+
+    void workerLoop();
+
+public:
+    PassThroughService(UpstreamProxy *upstream_proxy, size_t worker_count);
+    ~PassThroughService() override;
+
+    PassThroughService(const PassThroughService&) = delete;
+    PassThroughService &operator=(const PassThroughService&) = delete;
+
+    void post(std::function<void()> task);
+    UpstreamProxy &upstreamProxy() { return *m_upstream_proxy; }
+
+    grpc::ServerGenericBidiReactor *CreateReactor(grpc::GenericCallbackServerContext *context) override;
+};
+
+#endif // GRPC_MOCK_SERVER_PASS_THROUGH_SERVICE_H
@@ -0,0 +1,293 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "payload_store.h"
+#include "event_logger.h"
+
+#include <cassert>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+#include <xxhash.h>
+#include <zstd.h>
+#include <zdict.h>
+
+#include <grpc_mock_server_logger.h>
+
+namespace {
+
+// The dictionary is trained once this many payloads are seen, or once they reach the size limit
+constexpr size_t DICTIONARY_SAMPLE_COUNT = 2000;
+constexpr size_t DICTIONARY_SAMPLES_SIZE = 4 * 1024 * 1024;
+constexpr size_t DICTIONARY_MAX_SAMPLE_SIZE = 64 * 1024;
+constexpr size_t DICTIONARY_CAPACITY = 64 * 1024;
+
+// Not worth the zstd frame header
+constexpr size_t MIN_COMPRESSED_PAYLOAD_SIZE = 32;
+
+constexpr size_t MAX_CACHED_IDS = 100000;
+
+} // anonymous namespace
+
+PayloadStore::~PayloadStore() {
+    close();
+}
+
+void PayloadStore::createTables(SQLite::Database &database) {
+    database.exec("DROP TABLE IF EXISTS payloads");
+    database.exec("DROP TABLE IF EXISTS payload_dictionaries");
+    database.exec("CREATE TABLE payload_dictionaries (id INTEGER PRIMARY KEY, data BLOB)");
+    database.exec(
+        "CREATE TABLE payloads (id INTEGER PRIMARY KEY, hash BLOB UNIQUE, refcount INTEGER, "
+        "compression INTEGER, dictionary_id INTEGER, size INTEGER, data BLOB)"
+    );
+}
+
+bool PayloadStore::validateSettings(const Settings &settings, std::string &error) {
+    if (settings.compression
+        && (settings.compression_level < ZSTD_minCLevel() || settings.compression_level > ZSTD_maxCLevel())) {
+        error = "compression level must be between " + std::to_string(ZSTD_minCLevel())
+            + " and " + std::to_string(ZSTD_maxCLevel());
+        return false;
+    }
+    return true;
+}
+
+void PayloadStore::open(SQLite::Database *database, const Settings &settings) {
+    assert(database != nullptr);
+    close();
+
+    m_database = database;
+    m_settings = settings;
+    m_find_query = std::make_unique<SQLite::Statement>(*m_database, "SELECT id FROM payloads WHERE hash = ?");
+    m_insert_query = std::make_unique<SQLite::Statement>(*m_database, "INSERT INTO payloads VALUES (NULL, ?, 0, ?, ?, ?, ?)");
+    m_add_references_query = std::make_unique<SQLite::Statement>(*m_database, "UPDATE payloads SET refcount = refcount + ? WHERE id = ?");
+
+    if (m_settings.compression) {
+        m_compress_context = ZSTD_createCCtx();
+        m_training_done = !m_settings.train_dictionary;
+    }
+}
+
+void PayloadStore::close() {
+    m_find_query.reset();
+    m_insert_query.reset();
+    m_add_references_query.reset();
+    m_database = nullptr;
+    m_ids.clear();
+    m_pending_references.clear();
+    freeCompression();
+}
+
+void PayloadStore::freeCompression() {
+    if (m_compress_dictionary != nullptr) {
+        ZSTD_freeCDict(m_compress_dictionary);
+        m_compress_dictionary = nullptr;
+    }
+    if (m_compress_context != nullptr) {
+        ZSTD_freeCCtx(m_compress_context);
+        m_compress_context = nullptr;
+    }
+    m_dictionary_id = 0;
+    m_samples.clear();
+    m_samples.shrink_to_fit();
+    m_sample_sizes.clear();
+    m_training_done = false;
+    m_dictionary_pending = false;
+}
+
+int64_t PayloadStore::add(std::string_view data) {
+    assert(m_database != nullptr);
+
+    const auto xxh = XXH3_128bits(data.data(), data.size());
+    const Hash hash{ xxh.low64, xxh.high64 };
+
+    int64_t id = 0;
+    auto it = m_ids.find(hash);
+    if (it != m_ids.end()) {
+        id = it->second;
+    }
+    else {
+        m_find_query->bind(1, &hash, static_cast<int>(sizeof(hash)));
+        if (m_find_query->executeStep()) {
+            id = m_find_query->getColumn(0).getInt64();
+        }
+        m_find_query->reset();
+
+        if (id == 0) id = insert(hash, data);
+        if (m_ids.size() >= MAX_CACHED_IDS) m_ids.clear();
+        m_ids.emplace(hash, id);
+    }
+
+    ++m_pending_references[id];
+    return id;
+}
+
+int64_t PayloadStore::insert(const Hash &hash, std::string_view data) {
+    int compression = COMPRESSION_NONE;
+    int64_t dictionary_id = 0;
+    std::string_view stored = data;
+
+    if (m_compress_context != nullptr && data.size() >= MIN_COMPRESSED_PAYLOAD_SIZE) {
+        if (!m_training_done) collectSample(data);
+
+        m_compressed.resize(ZSTD_compressBound(data.size()));
+        size_t result = m_compress_dictionary != nullptr
+            ? ZSTD_compress_usingCDict(m_compress_context, m_compressed.data(), m_compressed.size(), data.data(), data.size(), m_compress_dictionary)
+            : ZSTD_compressCCtx(m_compress_context, m_compressed.data(), m_compressed.size(), data.data(), data.size(), m_settings.compression_level);
+        if (ZSTD_isError(result)) {
+            GMS_LOG_WARN(LogCategory::Storage, "Unable to compress {} bytes history payload: {}", data.size(), ZSTD_getErrorName(result));
+        }
+        else if (result < data.size()) {
+            compression = COMPRESSION_ZSTD;
+            dictionary_id = m_compress_dictionary != nullptr ? m_dictionary_id : 0;
+            stored = std::string_view(m_compressed.data(), result);
+        }
+    }
+
+    m_insert_query->bind(1, &hash, static_cast<int>(sizeof(hash)));
+    m_insert_query->bind(2, compression);
+    m_insert_query->bind(3, dictionary_id);
+    m_insert_query->bind(4, static_cast<int64_t>(data.size()));
+    m_insert_query->bind(5, stored.data(), static_cast<int>(stored.size()));
+    m_insert_query->exec();
+    m_insert_query->reset();
+    return m_database->getLastInsertRowid();
+}
+
+void PayloadStore::collectSample(std::string_view data) {
+    if (data.size() <= DICTIONARY_MAX_SAMPLE_SIZE) {
+        m_samples.append(data);
+        m_sample_sizes.push_back(data.size());
+    }
+    if (m_sample_sizes.size() >= DICTIONARY_SAMPLE_COUNT || m_samples.size() >= DICTIONARY_SAMPLES_SIZE) {
+        trainDictionary();
+    }
+}
+
+void PayloadStore::trainDictionary() {
+    m_training_done = true;
+
+    std::string dictionary(DICTIONARY_CAPACITY, '\0');
+    size_t size = ZDICT_trainFromBuffer(
+        dictionary.data(), dictionary.size(),
+        m_samples.data(), m_sample_sizes.data(), static_cast<unsigned>(m_sample_sizes.size())
+    );
+    const size_t sample_count = m_sample_sizes.size();
+    m_samples.clear();
+    m_samples.shrink_to_fit();
+    m_sample_sizes.clear();
+    m_sample_sizes.shrink_to_fit();
+    if (ZDICT_isError(size)) {
+        GMS_LOG_WARN(LogCategory::Storage, "Unable to train the history payloads dictionary on {} samples: {}", sample_count, ZDICT_getErrorName(size));
+        return;
+    }
+    dictionary.resize(size);
+
+    // Written in the current transaction, so the payloads using it can't outlive it
+    SQLite::Statement insert_query(*m_database, "INSERT INTO payload_dictionaries VALUES (NULL, ?)");
+    insert_query.bind(1, dictionary.data(), static_cast<int>(dictionary.size()));
+    insert_query.exec();
+    m_dictionary_id = m_database->getLastInsertRowid();
+    m_compress_dictionary = ZSTD_createCDict(dictionary.data(), dictionary.size(), m_settings.compression_level);
+    m_dictionary_pending = true;
+    GMS_LOG_INFO(LogCategory::Storage, "History payloads dictionary of {} bytes was trained on {} samples", dictionary.size(), sample_count);
+}
+
+void PayloadStore::commitReferences() {
+    for (const auto &[id, count] : m_pending_references) {
+        m_add_references_query->bind(1, count);
+        m_add_references_query->bind(2, id);
+        m_add_references_query->exec();
+        m_add_references_query->reset();
+    }
+    m_pending_references.clear();
+}
+
+void PayloadStore::commit() {
+    m_dictionary_pending = false;
+}
+
+void PayloadStore::rollback() {
+    m_ids.clear();
+    m_pending_references.clear();
+    m_find_query->reset();
+    m_insert_query->reset();
+    m_add_references_query->reset();
+
+    // The dictionary row is gone too if it was written in this transaction; a committed one stays in use
+    if (m_dictionary_pending) {
+        ZSTD_freeCDict(m_compress_dictionary);
+        m_compress_dictionary = nullptr;
+        m_dictionary_id = 0;
+        m_dictionary_pending = false;
+    }
+}
+
+bool PayloadStore::read(SQLite::Database &database, int64_t id, std::string &data, std::string &error) {
+    try {
+        SQLite::Statement select_query(database, "SELECT compression, dictionary_id, size, data FROM payloads WHERE id = ?");
+        select_query.bind(1, id);
+        if (!select_query.executeStep()) {
+            error = "no such payload";
+            return false;
+        }
+        const int compression = select_query.getColumn(0).getInt();
+        const int64_t dictionary_id = select_query.getColumn(1).getInt64();
+        const auto size = static_cast<size_t>(select_query.getColumn(2).getInt64());
+        const auto blob = select_query.getColumn(3);
+        const auto *stored = static_cast<const char*>(blob.getBlob());
+        const auto stored_size = static_cast<size_t>(blob.getBytes());
+
+        if (compression == COMPRESSION_NONE) {
+            data.assign(stored, stored_size);
+            return true;
+        }
+        if (compression != COMPRESSION_ZSTD) {
+            error = "unknown compression " + std::to_string(compression);
+            return false;
+        }
+
+        std::string dictionary;
+        if (dictionary_id != 0) {
+            SQLite::Statement dictionary_query(database, "SELECT data FROM payload_dictionaries WHERE id = ?");
+            dictionary_query.bind(1, dictionary_id);
+            if (!dictionary_query.executeStep()) {
+                error = "no dictionary " + std::to_string(dictionary_id);
+                return false;
+            }
+            const auto dictionary_blob = dictionary_query.getColumn(0);
+            dictionary.assign(static_cast<const char*>(dictionary_blob.getBlob()), static_cast<size_t>(dictionary_blob.getBytes()));
+        }
+
+        data.resize(size);
+        std::unique_ptr<ZSTD_DCtx, decltype(&ZSTD_freeDCtx)> context(ZSTD_createDCtx(), &ZSTD_freeDCtx);
+        size_t result = ZSTD_decompress_usingDict(
+            context.get(), data.data(), data.size(), stored, stored_size, dictionary.data(), dictionary.size()
+        );
+        if (ZSTD_isError(result) || result != size) {
+            error = ZSTD_isError(result) ? ZSTD_getErrorName(result) : "size mismatch";
+            data.clear();
+            return false;
+        }
+        return true;
+    }
+    catch (const SQLite::Exception &exc) {
+        error = exc.getErrorStr();
+        return false;
+    }
+}
@@ -0,0 +1,117 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_PAYLOAD_STORE_H
+#define GRPC_MOCK_SERVER_PAYLOAD_STORE_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+
+namespace SQLite { class Database; class Statement; }
+
+struct ZSTD_CCtx_s;
+struct ZSTD_CDict_s;
+
+/// <summary>
+/// Stores the history payloads once per content: the rows reference them by id, each payload is found
+/// by its XXH3-128 hash and counts its references. The payloads can be zstd-compressed, with a dictionary
+/// trained on the first ones (the calls of one method differ in a few fields, so it helps the small ones most).
+/// Not thread-safe: used by the history writer thread only
+/// </summary>
+class PayloadStore {
+public:
+    struct Settings {
+        bool compression = false;
+        int compression_level = 3;
+        bool train_dictionary = true;
+    };
+
+    // Values of the 'compression' column
+    enum Compression {
+        COMPRESSION_NONE = 0,
+        COMPRESSION_ZSTD = 1
+    };
+
+private:
+    struct Hash {
+        uint64_t low = 0;
+        uint64_t high = 0;
+        bool operator==(const Hash &other) const { return low == other.low && high == other.high; }
+    };
+    struct HashHasher {
+        size_t operator()(const Hash &hash) const { return static_cast<size_t>(hash.low); }
+    };
+
+    SQLite::Database *m_database = nullptr;
+    Settings m_settings;
+    std::unique_ptr<SQLite::Statement> m_find_query;
+    std::unique_ptr<SQLite::Statement> m_insert_query;
+    std::unique_ptr<SQLite::Statement> m_add_references_query;
+
+    // Payloads stored in the current transaction are cached too, so it must be dropped on rollback
+    std::unordered_map<Hash, int64_t, HashHasher> m_ids;
+    std::unordered_map<int64_t, int64_t> m_pending_references;
+
+    ZSTD_CCtx_s *m_compress_context = nullptr;
+    ZSTD_CDict_s *m_compress_dictionary = nullptr;
+    int64_t m_dictionary_id = 0;
+    std::string m_samples;
+    std::vector<size_t> m_sample_sizes;
+    bool m_training_done = false;
+    // The dictionary was trained in the current transaction, so its row is gone if it's rolled back
+    bool m_dictionary_pending = false;
+    std::string m_compressed;
+
+    int64_t insert(const Hash &hash, std::string_view data);
+    void collectSample(std::string_view data);
+    void trainDictionary();
+    void freeCompression();
+
+public:
+    PayloadStore() = default;
+    ~PayloadStore();
+
+    PayloadStore(const PayloadStore&) = delete;
+    PayloadStore &operator=(const PayloadStore&) = delete;
+
+    // Recreates the payload tables along with the history one
+    static void createTables(SQLite::Database &database);
+    static bool validateSettings(const Settings &settings, std::string &error);
+
+    // The statements are bound to `database` until close()
+    void open(SQLite::Database *database, const Settings &settings);
+    void close();
+
+    // Returns the id of the payload with the same content, storing it first if there is none.
+    // Must be called inside a transaction, followed by commitReferences() before it commits
+    int64_t add(std::string_view data);
+    void commitReferences();
+    // To be called once the transaction is committed
+    void commit();
+    // Forgets the payloads of a rolled back transaction
+    void rollback();
+
+    // Reads and decompresses the payload `id`; can be used on any connection to the same database
+    static bool read(SQLite::Database &database, int64_t id, std::string &data, std::string &error);
+};
+
+#endif // GRPC_MOCK_SERVER_PAYLOAD_STORE_H
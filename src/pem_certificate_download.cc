@@ -9,6 +9,9 @@
 #include <ws2tcpip.h>
 #else
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <netdb.h>
@@ -18,15 +21,44 @@
 
 #include <openssl/ssl.h>
 #include <openssl/err.h>
+#include <openssl/pem.h>
+
+#include <ctime>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+#include <filesystem>
 
 #ifdef WIN32
 #define SocketType SOCKET
+#define INVALID_SOCKET_VALUE INVALID_SOCKET
 #else
 #define SocketType int
+#define INVALID_SOCKET_VALUE (-1)
 #endif
 
 namespace {
 
+using Clock = std::chrono::steady_clock;
+
+// Cached certificates expiring sooner than this are downloaded again
+constexpr std::chrono::seconds CACHE_EXPIRY_MARGIN = std::chrono::hours(1);
+
+// Name lookups blocked in the system resolver don't hold up more than this many new ones
+constexpr size_t MAX_RESOLVER_THREADS = 8;
+
+// Downloads of a batch running at once; the rest wait for a free worker
+constexpr size_t MAX_DOWNLOAD_THREADS = 8;
+
 struct SocketWrapper {
     SocketType data;
 
@@ -35,57 +67,146 @@ struct SocketWrapper {
 void socketClose(SocketType socket_fd);
 
 using BioHandle = std::unique_ptr < BIO, decltype([](BIO* p) {
-    // 1
-    SystemLogger->info("BIO_free");
+    SystemLogger->trace("BIO_free");
     BIO_free(p);
 }) > ;
 using X509Handle = std::unique_ptr < X509, decltype([](X509* p) {
-    // 2
-    SystemLogger->info("X509_free");
+    SystemLogger->trace("X509_free");
     X509_free(p);
 }) > ;
 using SslHandle = std::unique_ptr < SSL, decltype([](SSL* p) {
-    // 3
-    SystemLogger->info("SSL_free");
+    SystemLogger->trace("SSL_free");
     SSL_free(p);
 }) > ;
 using SslCtxHandle = std::unique_ptr < SSL_CTX, decltype([](SSL_CTX* p) { 
-    // 4
-    SystemLogger->info("SSL_CTX_free");
+    SystemLogger->trace("SSL_CTX_free");
     SSL_CTX_free(p);
 }) >;
 using SocketHandle = std::unique_ptr < SocketWrapper, decltype([](SocketWrapper* p) {
-    // 5
-    SystemLogger->info("socketClose");
+    SystemLogger->trace("socketClose");
     socketClose(p->data);
+    delete p;
+}) >;
+using AddrInfoHandle = std::unique_ptr < addrinfo, decltype([](addrinfo* p) {
+    freeaddrinfo(p);
 }) >;
 
-// TODO: class WinsockWrapper
-int winsockInit() {
-#ifdef WIN32
-    WORD version = MAKEWORD(2, 0);
-    WSADATA wsaData{};
-    int error = WSAStartup(version, &wsaData);
-    if (error != 0) {
-        SystemLogger->error("WSAStartup() failed with code {}", error);
-        return -1;
+enum class IoResult { Ready, TimedOut, Failed };
+
+/// <summary>
+/// Runs the blocking getaddrinfo() on its own threads, so that the callers wait for it no longer than their deadline.
+/// An abandoned lookup finishes in the background; the threads are joined when the library is unloaded
+/// </summary>
+class HostResolver {
+    struct Request {
+        std::string host;
+        std::string port;
+        bool done = false;
+        int status = 0;
+        AddrInfoHandle addresses;
+    };
+
+    std::mutex m_mutex;
+    std::condition_variable m_queue_cv;
+    std::condition_variable m_done_cv;
+    std::deque<std::shared_ptr<Request>> m_queue;
+    std::vector<std::thread> m_threads;
+    size_t m_idle_threads = 0;
+    bool m_stopping = false;
+
+    void workerLoop() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        for (;;) {
+            m_idle_threads++;
+            m_queue_cv.wait(lock, [this]() { return m_stopping || !m_queue.empty(); });
+            m_idle_threads--;
+            if (m_stopping) return;
+
+            auto request = m_queue.front();
+            m_queue.pop_front();
+            lock.unlock();
+
+            addrinfo hints;
+            memset(&hints, 0, sizeof hints);
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            hints.ai_protocol = IPPROTO_TCP;
+            addrinfo* res = nullptr;
+            int status = getaddrinfo(request->host.c_str(), request->port.c_str(), &hints, &res);
+
+            lock.lock();
+            request->status = status;
+            if (status == 0) request->addresses.reset(res);
+            request->done = true;
+            m_done_cv.notify_all();
+        }
     }
 
-    // Check for correct version
-    if (LOBYTE(wsaData.wVersion) != 2 || HIBYTE(wsaData.wVersion) != 0) {
-        SystemLogger->error("Invalid Winsock version {}", wsaData.wVersion);
-        WSACleanup();
-        return -1;
+public:
+    static HostResolver &getInstance() {
+        static HostResolver instance;
+        return instance;
     }
-#endif // WIN32
 
-    return 0;
-}
+    ~HostResolver() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_queue_cv.notify_all();
+        for (auto &thread : m_threads) thread.join();
+    }
+
+    // Returns nullptr on failure; `timed_out` tells the deadline from the lookup errors
+    AddrInfoHandle resolve(const char* host, const char* port, Clock::time_point deadline, bool &timed_out) {
+        auto request = std::make_shared<Request>();
+        request->host = host;
+        request->port = port;
 
-void winsockFree() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_queue.push_back(request);
+        if (m_idle_threads < m_queue.size() && m_threads.size() < MAX_RESOLVER_THREADS) {
+            m_threads.emplace_back(&HostResolver::workerLoop, this);
+        }
+        m_queue_cv.notify_one();
+
+        timed_out = !m_done_cv.wait_until(lock, deadline, [&request]() { return request->done; });
+        if (timed_out) {
+            // Dropped if it hasn't started yet
+            auto iter = std::find(m_queue.begin(), m_queue.end(), request);
+            if (iter != m_queue.end()) m_queue.erase(iter);
+            return nullptr;
+        }
+        if (request->status != 0) {
+            SystemLogger->error("getaddrinfo() error: {}", gai_strerror(request->status));
+            return nullptr;
+        }
+        return std::move(request->addresses);
+    }
+};
+
+// Winsock and OpenSSL are initialized once per process: the downloads may run concurrently,
+// so the per-call cleanup would pull the rug out from under the other threads
+void librariesInit() {
+    static std::once_flag once;
+    std::call_once(once, []() {
 #ifdef WIN32
-    WSACleanup();
+        WORD version = MAKEWORD(2, 0);
+        WSADATA wsaData{};
+        int error = WSAStartup(version, &wsaData);
+        if (error != 0) {
+            SystemLogger->error("WSAStartup() failed with code {}", error);
+        }
+        // Check for correct version
+        else if (LOBYTE(wsaData.wVersion) != 2 || HIBYTE(wsaData.wVersion) != 0) {
+            SystemLogger->error("Invalid Winsock version {}", wsaData.wVersion);
+        }
 #endif // WIN32
+
+        OpenSSL_add_ssl_algorithms();
+        ERR_load_crypto_strings();
+        SSL_load_error_strings();
+    });
 }
 
 void socketClose(SocketType socket_fd) {
@@ -96,110 +217,416 @@ void socketClose(SocketType socket_fd) {
 #endif
 }
 
-} // namespace anonymous
+int socketLastError() {
+#ifdef WIN32
+    return WSAGetLastError();
+#else
+    return errno;
+#endif
+}
 
-static SocketType tcpConnect(const char* host, const char* port) {
-    int status = -1;
-
-    addrinfo hints;
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    hints.ai_protocol = IPPROTO_TCP;
-    
-    addrinfo* res = nullptr;
-    if ((status = getaddrinfo(host, port, &hints, &res)) < 0) {
-        SystemLogger->error("getaddrinfo() error: {}", gai_strerror(status));
-        return -1;
+bool socketSetNonBlocking(SocketType socket_fd) {
+#ifdef WIN32
+    u_long mode = 1;
+    return ioctlsocket(socket_fd, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(socket_fd, F_GETFL, 0);
+    return flags != -1 && fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+IoResult socketWait(SocketType socket_fd, bool for_write, Clock::time_point deadline) {
+    for (;;) {
+        auto remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        if (remaining_ms <= 0) return IoResult::TimedOut;
+
+#ifdef WIN32
+        WSAPOLLFD poll_fd{};
+        poll_fd.fd = socket_fd;
+        poll_fd.events = for_write ? POLLWRNORM : POLLRDNORM;
+        int status = WSAPoll(&poll_fd, 1, static_cast<INT>(remaining_ms));
+#else
+        pollfd poll_fd{};
+        poll_fd.fd = socket_fd;
+        poll_fd.events = for_write ? POLLOUT : POLLIN;
+        int status = poll(&poll_fd, 1, static_cast<int>(remaining_ms));
+        if (status < 0 && errno == EINTR) continue;
+#endif
+        if (status < 0) return IoResult::Failed;
+        if (status == 0) return IoResult::TimedOut;
+        return IoResult::Ready;
     }
+}
 
-    SocketType socket_fd = socket(res->ai_family, res->ai_socktype, (int)res->ai_protocol);
-    if (socket_fd == -1) {
-        SystemLogger->error("socket() error: {}", gai_strerror((int)socket_fd));
-        return -1;
+std::string sanitizeFileNamePart(const std::string &value) {
+    std::string result = value;
+    for (auto &c : result) {
+        bool allowed = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '.' || c == '-';
+        if (!allowed) c = '_';
     }
+    return result;
+}
 
-#ifdef __linux__
-    // Set the socket connect timeout to 2 seconds
-    uint32_t user_timeout = 2000;
-    socklen_t user_timeout_len = sizeof(user_timeout);
-    setsockopt(socket_fd, IPPROTO_TCP, TCP_USER_TIMEOUT, &user_timeout, user_timeout_len);
-#endif
+// Cache file names look like `<host>_<port>.<expiry unix time>.pem`
+std::string cacheKey(const char* remote_host, const char* remote_port) {
+    return sanitizeFileNamePart(remote_host) + "_" + sanitizeFileNamePart(remote_port) + ".";
+}
 
-    status = connect(socket_fd, res->ai_addr, static_cast<int>(res->ai_addrlen));
-    if (status != 0) {
-        SystemLogger->error("connect() error: {}", gai_strerror(status));
-        return -1;
+// Only `<key><expiry digits>.pem` matches the key
+bool parseCacheFileName(const std::filesystem::path &file_path, const std::string &key, time_t &expiry) {
+    if (file_path.extension() != ".pem") return false;
+
+    auto stem = file_path.stem().string();
+    if (stem.size() <= key.size() || stem.compare(0, key.size(), key) != 0) return false;
+
+    auto expiry_str = stem.substr(key.size());
+    if (!std::all_of(expiry_str.begin(), expiry_str.end(), [](char c) { return c >= '0' && c <= '9'; })) return false;
+    expiry = static_cast<time_t>(std::strtoll(expiry_str.c_str(), nullptr, 10));
+    return true;
+}
+
+bool findCachedCertificate(
+    const std::filesystem::path &cache_directory,
+    const std::string &key,
+    std::filesystem::path &cached_file_path
+) {
+    namespace fs = std::filesystem;
+
+    auto valid_until = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now() + CACHE_EXPIRY_MARGIN);
+    time_t best_expiry = 0;
+
+    std::error_code error;
+    for (const auto &entry : fs::directory_iterator(cache_directory, error)) {
+        time_t expiry = 0;
+        if (!parseCacheFileName(entry.path(), key, expiry)) continue;
+        if (expiry > valid_until && expiry > best_expiry) {
+            best_expiry = expiry;
+            cached_file_path = entry.path();
+        }
     }
+    return best_expiry != 0;
+}
 
-    freeaddrinfo(res);
+time_t certificateExpiry(X509* certificate) {
+    struct tm expiry_tm {};
+    if (ASN1_TIME_to_tm(X509_get0_notAfter(certificate), &expiry_tm) != 1) return 0;
+#ifdef WIN32
+    return _mkgmtime(&expiry_tm);
+#else
+    return timegm(&expiry_tm);
+#endif
+}
 
-    return socket_fd;
+void logSslErrors(const char* function_name) {
+    char message[1024];
+    unsigned long error_code = 0;
+    while ((error_code = ERR_get_error()) != 0) {
+        ERR_error_string_n(error_code, message, sizeof(message));
+        SystemLogger->error("{}() error: {}", function_name, message);
+    }
 }
 
-namespace grpc_mock_server {
+SocketType tcpConnect(const char* host, const char* port, Clock::time_point deadline, bool &timed_out) {
+    timed_out = false;
 
-int downloadPemCertificate(const char* remote_host, const char* remote_port, const char* local_file_path) {
-    winsockInit();
+    AddrInfoHandle addresses = HostResolver::getInstance().resolve(host, port, deadline, timed_out);
+    if (!addresses) return INVALID_SOCKET_VALUE;
+    int status = 0;
 
-    SocketHandle socket;
-    SslCtxHandle ctx;
-    SslHandle ssl;
-    X509Handle peer;
+    for (addrinfo* address = addresses.get(); address != nullptr; address = address->ai_next) {
+        if (Clock::now() >= deadline) {
+            timed_out = true;
+            return INVALID_SOCKET_VALUE;
+        }
 
-    OpenSSL_add_ssl_algorithms();
-    ERR_load_crypto_strings();
-    SSL_load_error_strings();
+        SocketType socket_fd = socket(address->ai_family, address->ai_socktype, (int)address->ai_protocol);
+        if (socket_fd == INVALID_SOCKET_VALUE) {
+            SystemLogger->error("socket() error: {}", socketLastError());
+            continue;
+        }
+        SocketHandle socket_handle(new SocketWrapper(socket_fd));
+
+        if (!socketSetNonBlocking(socket_fd)) {
+            SystemLogger->error("Unable to make socket non-blocking: {}", socketLastError());
+            continue;
+        }
 
-    const SSL_METHOD* method = SSLv23_client_method();
-    ctx.reset(SSL_CTX_new(method));
+        status = connect(socket_fd, address->ai_addr, static_cast<int>(address->ai_addrlen));
+        if (status != 0) {
+            int error = socketLastError();
+#ifdef WIN32
+            bool in_progress = error == WSAEWOULDBLOCK;
+#else
+            bool in_progress = error == EINPROGRESS;
+#endif
+            if (!in_progress) {
+                SystemLogger->error("connect() error: {}", error);
+                continue;
+            }
+
+            auto wait_result = socketWait(socket_fd, true, deadline);
+            if (wait_result == IoResult::TimedOut) {
+                timed_out = true;
+                return INVALID_SOCKET_VALUE;
+            }
+
+            int socket_error = 0;
+            socklen_t socket_error_len = sizeof(socket_error);
+            getsockopt(socket_fd, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&socket_error), &socket_error_len);
+            if (wait_result == IoResult::Failed || socket_error != 0) {
+                SystemLogger->error("connect() error: {}", socket_error);
+                continue;
+            }
+        }
 
+        // The caller takes the socket ownership
+        delete socket_handle.release();
+        return socket_fd;
+    }
+
+    return INVALID_SOCKET_VALUE;
+}
+
+/// Connects to the host and writes its certificate (chain) into the cache directory
+int fetchCertificate(
+    SSL_CTX* ctx,
+    const std::string &remote_host,
+    const std::string &remote_port,
+    const std::filesystem::path &cache_directory,
+    std::chrono::milliseconds connect_timeout,
+    std::chrono::milliseconds handshake_timeout,
+    bool full_chain,
+    std::filesystem::path &local_file_path
+) {
     // Connect the TCP socket
-    auto socket_fd = tcpConnect(remote_host, remote_port);
-    if (socket_fd < 0) {
+    bool timed_out = false;
+    auto socket_fd = tcpConnect(remote_host.c_str(), remote_port.c_str(), Clock::now() + connect_timeout, timed_out);
+    if (socket_fd == INVALID_SOCKET_VALUE) {
         SystemLogger->error("Unable to connect to host:port '{}:{}'", remote_host, remote_port);
-        return -1;
+        return timed_out ? grpc_mock_server::PEM_CERTIFICATE_TIMED_OUT : grpc_mock_server::PEM_CERTIFICATE_FAILED;
     }
-    socket.reset(new SocketWrapper(socket_fd));
+    SocketHandle socket(new SocketWrapper(socket_fd));
 
     // Connect the SSL socket
-    ssl.reset(SSL_new(ctx.get()));
+    SslHandle ssl(SSL_new(ctx));
+    if (!ssl) {
+        logSslErrors("SSL_new");
+        return grpc_mock_server::PEM_CERTIFICATE_FAILED;
+    }
+    SSL_set_tlsext_host_name(ssl.get(), remote_host.c_str());
 
     // SSL_free also frees the assigned BIO, so not need in RAII here
     BIO* sbio = BIO_new_socket((int)socket->data, BIO_NOCLOSE);
     SSL_set_bio(ssl.get(), sbio, sbio);
 
-    int status = SSL_connect(ssl.get());
-    if (status <= 0) {
+    auto handshake_deadline = Clock::now() + handshake_timeout;
+    for (;;) {
+        int status = SSL_connect(ssl.get());
+        if (status == 1) break;
+
         int err = SSL_get_error(ssl.get(), status);
-        if (err == SSL_ERROR_SSL) {
-            char message[1024];
-            ERR_error_string_n(ERR_get_error(), message, sizeof(message));
-            SystemLogger->error(
-                "SSL_connect() errors: | {} | {} | {}",
-                message,
-                ERR_lib_error_string(0),
-                ERR_reason_error_string(0)
-            );
+        if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE) {
+            logSslErrors("SSL_connect");
+            return grpc_mock_server::PEM_CERTIFICATE_FAILED;
+        }
+
+        auto wait_result = socketWait(socket->data, err == SSL_ERROR_WANT_WRITE, handshake_deadline);
+        if (wait_result == IoResult::TimedOut) {
+            SystemLogger->error("TLS handshake with '{}:{}' timed out", remote_host, remote_port);
+            return grpc_mock_server::PEM_CERTIFICATE_TIMED_OUT;
+        }
+        if (wait_result == IoResult::Failed) {
+            SystemLogger->error("TLS handshake with '{}:{}' failed: {}", remote_host, remote_port, socketLastError());
+            return grpc_mock_server::PEM_CERTIFICATE_FAILED;
         }
-        return -1;
     }
 
-    peer.reset(SSL_get_peer_certificate(ssl.get()));
+    X509Handle peer(SSL_get_peer_certificate(ssl.get()));
+    if (!peer) {
+        SystemLogger->error("Host '{}:{}' sent no certificate", remote_host, remote_port);
+        return grpc_mock_server::PEM_CERTIFICATE_FAILED;
+    }
 
+    // Write into a temporary file first, so that a concurrent reader never sees a partial certificate
+    auto key = cacheKey(remote_host.c_str(), remote_port.c_str());
+    local_file_path = cache_directory / (key + std::to_string(certificateExpiry(peer.get())) + ".pem");
+    // Unique, so that the concurrent downloads of the same host don't write into one file
+    static std::atomic<uint64_t> temporary_file_counter { 0 };
+    auto temporary_file_path = local_file_path;
+    temporary_file_path += "." + std::to_string(temporary_file_counter.fetch_add(1)) + ".tmp";
     {
-        BioHandle local_file(BIO_new_file(local_file_path, "w"));
+        BioHandle local_file(BIO_new_file(temporary_file_path.string().c_str(), "w"));
         if (!local_file) {
-            SystemLogger->error("BIO_new_file() error: {}", status);
-            return -1;
+            logSslErrors("BIO_new_file");
+            return grpc_mock_server::PEM_CERTIFICATE_FAILED;
+        }
+
+        STACK_OF(X509)* chain = full_chain ? SSL_get_peer_cert_chain(ssl.get()) : nullptr;
+        if (chain != nullptr && sk_X509_num(chain) > 0) {
+            for (int i = 0; i < sk_X509_num(chain); ++i) {
+                PEM_write_bio_X509(local_file.get(), sk_X509_value(chain, i));
+            }
+        }
+        else {
+            PEM_write_bio_X509(local_file.get(), peer.get());
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary_file_path, local_file_path, error);
+    if (error) {
+        SystemLogger->error("Unable to save certificate '{}': {}", local_file_path.string(), error.message());
+        std::filesystem::remove(temporary_file_path, error);
+        return grpc_mock_server::PEM_CERTIFICATE_FAILED;
+    }
+
+    // Drop the outdated certificates of this host; the temporary files of the other downloads are left alone
+    for (const auto &entry : std::filesystem::directory_iterator(cache_directory, error)) {
+        time_t expiry = 0;
+        if (parseCacheFileName(entry.path(), key, expiry) && entry.path() != local_file_path) {
+            std::filesystem::remove(entry.path(), error);
+        }
+    }
+
+    return grpc_mock_server::PEM_CERTIFICATE_DOWNLOADED;
+}
+
+} // namespace anonymous
+
+namespace grpc_mock_server {
+
+int downloadPemCertificate(const char* remote_host, const char* remote_port, const char* local_file_path) {
+    librariesInit();
+
+    SslCtxHandle ctx(SSL_CTX_new(SSLv23_client_method()));
+    if (!ctx) {
+        logSslErrors("SSL_CTX_new");
+        return -1;
+    }
+
+    std::error_code error;
+    auto temporary_directory = std::filesystem::temp_directory_path(error) / "grpc_mock_server_certificates";
+    std::filesystem::create_directories(temporary_directory, error);
+
+    std::filesystem::path downloaded_file_path;
+    int status = fetchCertificate(
+        ctx.get(),
+        remote_host,
+        remote_port,
+        temporary_directory,
+        std::chrono::milliseconds(PEM_CERTIFICATE_DEFAULT_CONNECT_TIMEOUT_MS),
+        std::chrono::milliseconds(PEM_CERTIFICATE_DEFAULT_HANDSHAKE_TIMEOUT_MS),
+        false,
+        downloaded_file_path
+    );
+    if (status != PEM_CERTIFICATE_DOWNLOADED) return -1;
+
+    std::filesystem::copy_file(
+        downloaded_file_path,
+        local_file_path,
+        std::filesystem::copy_options::overwrite_existing,
+        error
+    );
+    if (error) {
+        SystemLogger->error("Unable to copy certificate to '{}': {}", local_file_path, error.message());
+        return -1;
+    }
+
+    return 0;
+}
+
+int downloadPemCertificates(
+    const char* const* remote_hosts,
+    const char* const* remote_ports,
+    size_t count,
+    const char* cache_directory,
+    int connect_timeout_ms,
+    int handshake_timeout_ms,
+    bool full_chain,
+    int* statuses
+) {
+    assert(remote_hosts != nullptr && remote_ports != nullptr && statuses != nullptr);
+    assert(cache_directory != nullptr);
+    assert(connect_timeout_ms > 0 && handshake_timeout_ms > 0);
+
+    librariesInit();
+
+    std::filesystem::path cache_directory_path(cache_directory);
+    std::error_code error;
+    std::filesystem::create_directories(cache_directory_path, error);
+    if (error) {
+        SystemLogger->error("Unable to create certificate cache directory '{}': {}", cache_directory, error.message());
+        for (size_t i = 0; i < count; ++i) statuses[i] = PEM_CERTIFICATE_FAILED;
+        return 0;
+    }
+
+    // SSL_CTX is reference counted and thread-safe, so a single one is shared by all the downloads
+    SslCtxHandle ctx(SSL_CTX_new(SSLv23_client_method()));
+    if (!ctx) {
+        logSslErrors("SSL_CTX_new");
+        for (size_t i = 0; i < count; ++i) statuses[i] = PEM_CERTIFICATE_FAILED;
+        return 0;
+    }
+
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < count; ++i) {
+        std::filesystem::path cached_file_path;
+        if (findCachedCertificate(cache_directory_path, cacheKey(remote_hosts[i], remote_ports[i]), cached_file_path)) {
+            SystemLogger->debug("Using cached certificate '{}'", cached_file_path.string());
+            statuses[i] = PEM_CERTIFICATE_CACHED;
+            continue;
         }
-        PEM_write_bio_X509(local_file.get(), peer.get());
+        pending.push_back(i);
     }
 
-    winsockFree();
+    // Every step of a download has its deadline, the name lookup included, so joining the workers takes
+    // no longer than connect_timeout_ms + handshake_timeout_ms per MAX_DOWNLOAD_THREADS uncached hosts
+    std::atomic<size_t> next_pending = 0;
+    auto worker_loop = [&]() {
+        for (size_t n = next_pending++; n < pending.size(); n = next_pending++) {
+            const size_t i = pending[n];
+            std::filesystem::path local_file_path;
+            statuses[i] = fetchCertificate(
+                ctx.get(),
+                remote_hosts[i],
+                remote_ports[i],
+                cache_directory_path,
+                std::chrono::milliseconds(connect_timeout_ms),
+                std::chrono::milliseconds(handshake_timeout_ms),
+                full_chain,
+                local_file_path
+            );
+        }
+    };
 
-    ERR_free_strings();
+    std::vector<std::thread> workers;
+    const size_t worker_count = std::min(pending.size(), MAX_DOWNLOAD_THREADS);
+    for (size_t i = 0; i < worker_count; ++i) {
+        workers.emplace_back(worker_loop);
+    }
+    for (auto &worker : workers) worker.join();
+
+    int available = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (statuses[i] == PEM_CERTIFICATE_DOWNLOADED || statuses[i] == PEM_CERTIFICATE_CACHED) available++;
+    }
+    SystemLogger->info("{} of {} certificates are available in '{}'", available, count, cache_directory);
+    return available;
+}
 
+int findCachedPemCertificate(
+    const char* remote_host,
+    const char* remote_port,
+    const char* cache_directory,
+    char* local_file_path,
+    size_t local_file_path_size
+) {
+    std::filesystem::path cached_file_path;
+    if (!findCachedCertificate(cache_directory, cacheKey(remote_host, remote_port), cached_file_path)) return -1;
+
+    auto path = cached_file_path.string();
+    if (path.size() + 1 > local_file_path_size) return -1;
+    memcpy(local_file_path, path.c_str(), path.size() + 1);
     return 0;
 }
 
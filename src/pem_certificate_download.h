@@ -21,8 +21,20 @@
 
 #include <grpc_mock_server_export.h>
 
+#include <cstddef>
+
 namespace grpc_mock_server {
 
+// Per-host results of `downloadPemCertificates`
+constexpr int PEM_CERTIFICATE_DOWNLOADED = 0;
+constexpr int PEM_CERTIFICATE_CACHED = 1;
+constexpr int PEM_CERTIFICATE_FAILED = -1;
+constexpr int PEM_CERTIFICATE_TIMED_OUT = -2;
+
+// Timeouts of `downloadPemCertificate`, also reasonable for `downloadPemCertificates`
+constexpr int PEM_CERTIFICATE_DEFAULT_CONNECT_TIMEOUT_MS = 2000;
+constexpr int PEM_CERTIFICATE_DEFAULT_HANDSHAKE_TIMEOUT_MS = 2000;
+
 /// <summary>
 /// Downloads a PEM-format certificate from a specified remote host to a specified local file
 /// </summary>
@@ -31,6 +43,49 @@ namespace grpc_mock_server {
 /// <returns>Zero if success or non-zero if failure</returns>
 extern "C" GRPC_MOCK_SERVER_LIBRARY_API int downloadPemCertificate(const char* remote_host, const char* remote_port, const char* local_file_path);
 
+/// <summary>
+/// Concurrently downloads PEM-format certificates from the specified remote hosts into the on-disk cache.
+/// Hosts having a non-expired certificate in the cache are not contacted at all.
+/// Never blocks longer than connect_timeout_ms + handshake_timeout_ms, name resolution included:
+/// the hosts which did not answer in time are reported as timed out
+/// </summary>
+/// <param name="remote_hosts">Remote host addresses, e.g. "google.ru" or "1.2.3.4"</param>
+/// <param name="remote_ports">Remote ports, one per host, e.g. "443"</param>
+/// <param name="count">Number of hosts</param>
+/// <param name="cache_directory">Local certificate cache directory, e.g. "/home/user/test/certificates"</param>
+/// <param name="connect_timeout_ms">Hard deadline for name resolution and TCP connection</param>
+/// <param name="handshake_timeout_ms">Hard deadline for TLS handshake</param>
+/// <param name="full_chain">Save the whole certificate chain sent by the host instead of the leaf certificate only</param>
+/// <param name="statuses">Output array of `count` per-host results, see PEM_CERTIFICATE_* constants</param>
+/// <returns>Number of hosts whose certificate is available in the cache</returns>
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API int downloadPemCertificates(
+    const char* const* remote_hosts,
+    const char* const* remote_ports,
+    size_t count,
+    const char* cache_directory,
+    int connect_timeout_ms,
+    int handshake_timeout_ms,
+    bool full_chain,
+    int* statuses
+);
+
+/// <summary>
+/// Looks up the non-expired cached certificate of a specified remote host
+/// </summary>
+/// <param name="remote_host">Remote host address, e.g. "google.ru" or "1.2.3.4"</param>
+/// <param name="remote_port">Remote port, e.g. "443"</param>
+/// <param name="cache_directory">Local certificate cache directory, e.g. "/home/user/test/certificates"</param>
+/// <param name="local_file_path">Output buffer for the cached certificate file path</param>
+/// <param name="local_file_path_size">Output buffer size</param>
+/// <returns>Zero if found or non-zero if not</returns>
+extern "C" GRPC_MOCK_SERVER_LIBRARY_API int findCachedPemCertificate(
+    const char* remote_host,
+    const char* remote_port,
+    const char* cache_directory,
+    char* local_file_path,
+    size_t local_file_path_size
+);
+
 } // namespace grpc_mock_server
 
 #endif // GRPC_MOCK_SERVER_PEM_CERTIFICATE_DOWNLOAD_H
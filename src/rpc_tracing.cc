@@ -0,0 +1,290 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "rpc_tracing.h"
+
+#include <mutex>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+
+#include <grpc_mock_server_logger.h>
+
+namespace {
+
+// A thread stops recording when its buffer is full until the spans are written out
+constexpr size_t MAX_SPANS_PER_THREAD = 65536;
+
+struct SpanRecord {
+    const char *name = nullptr;
+    std::string method;
+    uint64_t rpc_id = 0;
+    RpcTracer::Clock::time_point start;
+    RpcTracer::Clock::time_point end;
+};
+
+struct ThreadBuffer {
+    // Only contended when the trace file is being written
+    std::mutex mutex;
+    std::vector<SpanRecord> spans;
+    uint64_t dropped_spans = 0;
+    uint32_t thread_id = 0;
+};
+
+struct RpcContext {
+    uint64_t rpc_id = 0;
+};
+
+std::mutex g_buffers_mutex;
+std::vector<std::shared_ptr<ThreadBuffer>> g_buffers;
+uint32_t g_next_thread_id = 1;
+
+std::atomic<uint64_t> g_next_rpc_id = 1;
+std::atomic<uint64_t> g_sample_interval = 1;
+const RpcTracer::Clock::time_point g_trace_epoch = RpcTracer::Clock::now();
+
+thread_local RpcContext t_rpc_context;
+
+ThreadBuffer &threadBuffer() {
+    thread_local std::shared_ptr<ThreadBuffer> buffer;
+    if (!buffer) {
+        buffer = std::make_shared<ThreadBuffer>();
+
+        std::lock_guard<std::mutex> lock(g_buffers_mutex);
+        buffer->thread_id = g_next_thread_id++;
+        g_buffers.push_back(buffer);
+    }
+    return *buffer;
+}
+
+void appendSpan(SpanRecord &&span) {
+    auto &buffer = threadBuffer();
+
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    if (buffer.spans.size() >= MAX_SPANS_PER_THREAD) {
+        ++buffer.dropped_spans;
+        return;
+    }
+    if (buffer.spans.capacity() == 0) buffer.spans.reserve(1024);
+    buffer.spans.push_back(std::move(span));
+}
+
+std::string escapeJson(const std::string &value) {
+    std::string result;
+    result.reserve(value.size());
+    for (char c : value) {
+        if (c == '"' || c == '\\') result.push_back('\\');
+        if (static_cast<unsigned char>(c) < 0x20) continue;
+        result.push_back(c);
+    }
+    return result;
+}
+
+int64_t microsecondsSinceEpoch(RpcTracer::Clock::time_point time_point) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(time_point - g_trace_epoch).count();
+}
+
+class TracingInterceptor : public grpc::experimental::Interceptor {
+    grpc::experimental::ServerRpcInfo *m_info;
+    uint64_t m_rpc_id = 0;
+    RpcTracer::Clock::time_point m_rpc_start;
+    RpcTracer::Clock::time_point m_send_start;
+    bool m_sending_message = false;
+
+    void finishRpc(RpcTracer::Clock::time_point end) {
+        RpcTracer::recordRpc(m_rpc_id, m_info->method(), m_rpc_start, end);
+        RpcTracer::endRpc();
+        m_rpc_id = 0;
+    }
+
+public:
+    explicit TracingInterceptor(grpc::experimental::ServerRpcInfo *info) : m_info(info) {
+    }
+
+    void Intercept(grpc::experimental::InterceptorBatchMethods *methods) override {
+        using grpc::experimental::InterceptionHookPoints;
+
+        if (methods->QueryInterceptionHookPoint(InterceptionHookPoints::POST_RECV_INITIAL_METADATA)) {
+            if (RpcTracer::isEnabled()) {
+                m_rpc_id = RpcTracer::beginRpc();
+                m_rpc_start = RpcTracer::Clock::now();
+            }
+        }
+        if (methods->QueryInterceptionHookPoint(InterceptionHookPoints::POST_RECV_MESSAGE)) {
+            // The handler runs on the thread receiving the message, which is not always the one that got the metadata;
+            // an unsampled call binds zero, so that it doesn't inherit the RPC another call left on the thread
+            RpcTracer::bindRpc(m_rpc_id);
+        }
+        if (m_rpc_id == 0) {
+            methods->Proceed();
+            return;
+        }
+
+        auto now = RpcTracer::Clock::now();
+        if (methods->QueryInterceptionHookPoint(InterceptionHookPoints::POST_RECV_MESSAGE)) {
+            // The request is deserialized by now
+            RpcTracer::recordSpan(m_rpc_id, "receive", m_rpc_start, now);
+        }
+        if (methods->QueryInterceptionHookPoint(InterceptionHookPoints::PRE_SEND_MESSAGE)) {
+            m_send_start = now;
+            m_sending_message = true;
+        }
+        if (methods->QueryInterceptionHookPoint(InterceptionHookPoints::POST_SEND_MESSAGE)) {
+            RpcTracer::recordSpan(m_rpc_id, "send", m_send_start, now);
+            finishRpc(now);
+        }
+        else if (methods->QueryInterceptionHookPoint(InterceptionHookPoints::PRE_SEND_STATUS) && !m_sending_message) {
+            // Failed calls send the status only
+            finishRpc(now);
+        }
+        methods->Proceed();
+    }
+};
+
+class TracingInterceptorFactory : public grpc::experimental::ServerInterceptorFactoryInterface {
+public:
+    grpc::experimental::Interceptor *CreateServerInterceptor(grpc::experimental::ServerRpcInfo *info) override {
+        // No interceptor means no per-call allocation and no hooks while tracing is off
+        if (!RpcTracer::isEnabled()) return nullptr;
+        return new TracingInterceptor(info);
+    }
+};
+
+} // anonymous namespace
+
+std::atomic<bool> RpcTracer::s_enabled = false;
+
+void RpcTracer::setEnabled(bool enabled, double sample_rate) {
+    uint64_t sample_interval = 1;
+    if (sample_rate > 0.0 && sample_rate < 1.0) {
+        sample_interval = static_cast<uint64_t>(std::llround(1.0 / sample_rate));
+    }
+    g_sample_interval = sample_interval;
+    s_enabled = enabled;
+
+    if (enabled) {
+        SystemLogger->info("RPC tracing enabled, every {} call is traced", sample_interval);
+    }
+    else {
+        SystemLogger->info("RPC tracing disabled");
+    }
+}
+
+uint64_t RpcTracer::beginRpc() {
+    auto rpc_id = g_next_rpc_id.fetch_add(1, std::memory_order_relaxed);
+    t_rpc_context.rpc_id = (rpc_id % g_sample_interval.load(std::memory_order_relaxed) == 0) ? rpc_id : 0;
+    return t_rpc_context.rpc_id;
+}
+
+void RpcTracer::endRpc() {
+    t_rpc_context.rpc_id = 0;
+}
+
+bool RpcTracer::isCurrentRpcSampled() {
+    return t_rpc_context.rpc_id != 0;
+}
+
+uint64_t RpcTracer::currentRpc() {
+    return t_rpc_context.rpc_id;
+}
+
+void RpcTracer::bindRpc(uint64_t rpc_id) {
+    t_rpc_context.rpc_id = rpc_id;
+}
+
+void RpcTracer::recordRpc(uint64_t rpc_id, const char *method, Clock::time_point start, Clock::time_point end) {
+    appendSpan({ "rpc", method != nullptr ? method : "", rpc_id, start, end });
+}
+
+void RpcTracer::recordSpan(uint64_t rpc_id, const char *name, Clock::time_point start, Clock::time_point end) {
+    appendSpan({ name, std::string(), rpc_id, start, end });
+}
+
+void RpcTracer::recordSpan(const char *name, Clock::time_point start, Clock::time_point end) {
+    if (t_rpc_context.rpc_id == 0) return;
+    recordSpan(t_rpc_context.rpc_id, name, start, end);
+}
+
+bool RpcTracer::writeTraceFile(const std::string &file_path) {
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(g_buffers_mutex);
+        buffers = g_buffers;
+
+        // Buffers of the finished threads are only referenced by the list, drop them once written out
+        std::erase_if(g_buffers, [](const std::shared_ptr<ThreadBuffer> &buffer) { return buffer.use_count() == 2; });
+    }
+
+    std::FILE *file = std::fopen(file_path.c_str(), "w");
+    if (file == nullptr) {
+        SystemLogger->error("Unable to create trace file '{}'", file_path);
+        return false;
+    }
+
+    std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+    bool first_event = true;
+    size_t span_count = 0;
+    uint64_t dropped_spans = 0;
+    std::vector<SpanRecord> spans;
+    for (const auto &buffer : buffers) {
+        {
+            std::lock_guard<std::mutex> lock(buffer->mutex);
+            spans.swap(buffer->spans);
+            dropped_spans += buffer->dropped_spans;
+            buffer->dropped_spans = 0;
+        }
+
+        for (const auto &span : spans) {
+            auto start_us = microsecondsSinceEpoch(span.start);
+            auto duration_us = microsecondsSinceEpoch(span.end) - start_us;
+            std::string name = span.method.empty() ? span.name : escapeJson(span.method);
+            std::fprintf(
+                file,
+                "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%lld,\"args\":{\"rpc\":%llu}}",
+                first_event ? "" : ",\n",
+                name.c_str(),
+                span.method.empty() ? "phase" : "rpc",
+                buffer->thread_id,
+                static_cast<long long>(start_us),
+                static_cast<long long>(duration_us),
+                static_cast<unsigned long long>(span.rpc_id)
+            );
+            first_event = false;
+        }
+        span_count += spans.size();
+        spans.clear();
+    }
+    std::fputs("\n]}\n", file);
+
+    bool ok = std::ferror(file) == 0;
+    ok = (std::fclose(file) == 0) && ok;
+    if (!ok) {
+        SystemLogger->error("Unable to write trace file '{}'", file_path);
+        return false;
+    }
+
+    if (dropped_spans > 0) {
+        SystemLogger->warn("{} spans were dropped because of full trace buffers", dropped_spans);
+    }
+    SystemLogger->info("{} spans were written to trace file '{}'", span_count, file_path);
+    return true;
+}
+
+std::unique_ptr<grpc::experimental::ServerInterceptorFactoryInterface> RpcTracer::createInterceptorFactory() {
+    return std::make_unique<TracingInterceptorFactory>();
+}
@@ -0,0 +1,98 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_RPC_TRACING_H
+#define GRPC_MOCK_SERVER_RPC_TRACING_H
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <chrono>
+
+#include <grpc++/grpc++.h>
+#include <grpcpp/support/server_interceptor.h>
+
+/// <summary>
+/// Records the time spent in every phase of the sampled RPCs into per-thread buffers
+/// and writes them as a Chrome trace JSON file (chrome://tracing, ui.perfetto.dev).
+/// The receive/deserialize and send phases are recorded by the server interceptor,
+/// the rest by the TraceSpan objects on the thread handling the call.
+/// When tracing is disabled a span costs a single relaxed atomic load
+/// </summary>
+class RpcTracer {
+    static std::atomic<bool> s_enabled;
+
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static bool isEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+    // Every N-th RPC is traced, where N is the closest integer to 1 / `sample_rate`
+    static void setEnabled(bool enabled, double sample_rate);
+
+    // Binds the RPC to the calling thread; returns its id, or zero if it is not sampled
+    static uint64_t beginRpc();
+    static void endRpc();
+    static bool isCurrentRpcSampled();
+    // The sampled RPC bound to the calling thread, or zero; to be passed along with a task run
+    // on another thread, which binds it with `bindRpc` and unbinds it with `endRpc`
+    static uint64_t currentRpc();
+    static void bindRpc(uint64_t rpc_id);
+
+    static void recordRpc(uint64_t rpc_id, const char *method, Clock::time_point start, Clock::time_point end);
+    static void recordSpan(uint64_t rpc_id, const char *name, Clock::time_point start, Clock::time_point end);
+    // Records the span for the RPC bound to the calling thread
+    static void recordSpan(const char *name, Clock::time_point start, Clock::time_point end);
+
+    // Moves the recorded spans out of the buffers into the trace file
+    static bool writeTraceFile(const std::string &file_path);
+
+    static std::unique_ptr<grpc::experimental::ServerInterceptorFactoryInterface> createInterceptorFactory();
+};
+
+/// <summary>
+/// Records a span from construction to destruction if the current RPC is sampled.
+/// `name` must be a string literal
+/// </summary>
+class TraceSpan {
+    const char *m_name;
+    bool m_active;
+    RpcTracer::Clock::time_point m_start;
+
+public:
+    explicit TraceSpan(const char *name)
+        : m_name(name), m_active(RpcTracer::isEnabled() && RpcTracer::isCurrentRpcSampled()) {
+        if (m_active) m_start = RpcTracer::Clock::now();
+    }
+
+    ~TraceSpan() {
+        if (m_active) RpcTracer::recordSpan(m_name, m_start, RpcTracer::Clock::now());
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan &operator=(const TraceSpan&) = delete;
+};
+
+#define GMS_TRACE_CONCAT_IMPL(a, b) a##b
+#define GMS_TRACE_CONCAT(a, b) GMS_TRACE_CONCAT_IMPL(a, b)
+
+// To be used by protobuf compiler generated code for the "override_lookup", "override_apply"
+// and "json_conversion" phases, e.g. `GMS_TRACE_SPAN("json_conversion");`
+#define GMS_TRACE_SPAN(name) TraceSpan GMS_TRACE_CONCAT(gms_trace_span_, __LINE__)(name)
+
+#endif // GRPC_MOCK_SERVER_RPC_TRACING_H
@@ -0,0 +1,279 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "synthetic_responses.h"
+#include "business_logic.h"
+#include "event_logger.h"
+
+#include <random>
+#include <algorithm>
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+
+#include <grpc_mock_server_logger.h>
+
+namespace {
+
+using google::protobuf::Descriptor;
+using google::protobuf::FieldDescriptor;
+using google::protobuf::Message;
+using google::protobuf::Reflection;
+
+// Recursive message types would never end otherwise
+constexpr int MAX_MESSAGE_DEPTH = 4;
+// Size of the strings in the first pass, which measures how much the rest of the message takes
+constexpr size_t PROBE_STRING_SIZE = 8;
+
+constexpr char STRING_ALPHABET[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+
+// FNV-1a: unlike std::hash, gives the same seeds on every platform
+uint64_t hashMethodName(const std::string &method) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c : method) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Map entries are written in key order, so that the same seed gives the same bytes
+bool serializeDeterministic(const Message &message, std::string &data) {
+    data.clear();
+    google::protobuf::io::StringOutputStream stream(&data);
+    google::protobuf::io::CodedOutputStream output(&stream);
+    output.SetSerializationDeterministic(true);
+    return message.SerializeToCodedStream(&output);
+}
+
+class MessageGenerator {
+    const grpc_mock_server::SyntheticResponseSettings &m_settings;
+    std::mt19937_64 m_random;
+    // Separate, so that the string sizes don't change the rest of the message
+    std::mt19937_64 m_string_random;
+    size_t m_string_size;
+    size_t m_string_count = 0;
+
+    std::string randomString(bool bytes) {
+        std::string result(m_string_size, '\0');
+        for (auto &c : result) {
+            c = bytes
+                ? static_cast<char>(m_string_random() & 0xFF)
+                : STRING_ALPHABET[m_string_random() % (sizeof(STRING_ALPHABET) - 1)];
+        }
+        ++m_string_count;
+        return result;
+    }
+
+    void addValue(Message *message, const FieldDescriptor *field, int depth) {
+        const Reflection *reflection = message->GetReflection();
+        const bool repeated = field->is_repeated();
+
+        switch (field->cpp_type()) {
+        case FieldDescriptor::CPPTYPE_INT32: {
+            auto value = static_cast<int32_t>(m_random() % 1000);
+            repeated ? reflection->AddInt32(message, field, value) : reflection->SetInt32(message, field, value);
+            break;
+        }
+        case FieldDescriptor::CPPTYPE_INT64: {
+            auto value = static_cast<int64_t>(m_random() % 1000000);
+            repeated ? reflection->AddInt64(message, field, value) : reflection->SetInt64(message, field, value);
+            break;
+        }
+        case FieldDescriptor::CPPTYPE_UINT32: {
+            auto value = static_cast<uint32_t>(m_random() % 1000);
+            repeated ? reflection->AddUInt32(message, field, value) : reflection->SetUInt32(message, field, value);
+            break;
+        }
+        case FieldDescriptor::CPPTYPE_UINT64: {
+            auto value = static_cast<uint64_t>(m_random() % 1000000);
+            repeated ? reflection->AddUInt64(message, field, value) : reflection->SetUInt64(message, field, value);
+            break;
+        }
+        case FieldDescriptor::CPPTYPE_DOUBLE: {
+            auto value = static_cast<double>(m_random() % 100000) / 100.0;
+            repeated ? reflection->AddDouble(message, field, value) : reflection->SetDouble(message, field, value);
+            break;
+        }
+        case FieldDescriptor::CPPTYPE_FLOAT: {
+            auto value = static_cast<float>(m_random() % 100000) / 100.0f;
+            repeated ? reflection->AddFloat(message, field, value) : reflection->SetFloat(message, field, value);
+            break;
+        }
+        case FieldDescriptor::CPPTYPE_BOOL: {
+            bool value = (m_random() & 1) != 0;
+            repeated ? reflection->AddBool(message, field, value) : reflection->SetBool(message, field, value);
+            break;
+        }
+        case FieldDescriptor::CPPTYPE_ENUM: {
+            const auto *enum_type = field->enum_type();
+            const auto *value = enum_type->value(static_cast<int>(m_random() % enum_type->value_count()));
+            repeated ? reflection->AddEnum(message, field, value) : reflection->SetEnum(message, field, value);
+            break;
+        }
+        case FieldDescriptor::CPPTYPE_STRING: {
+            auto value = randomString(field->type() == FieldDescriptor::TYPE_BYTES);
+            repeated ? reflection->AddString(message, field, std::move(value)) : reflection->SetString(message, field, std::move(value));
+            break;
+        }
+        case FieldDescriptor::CPPTYPE_MESSAGE: {
+            auto *child = repeated ? reflection->AddMessage(message, field) : reflection->MutableMessage(message, field);
+            fill(child, depth + 1);
+            break;
+        }
+        }
+    }
+
+public:
+    MessageGenerator(const grpc_mock_server::SyntheticResponseSettings &settings, uint64_t seed, size_t string_size)
+        : m_settings(settings), m_random(seed), m_string_random(~seed), m_string_size(string_size) {
+    }
+
+    size_t stringCount() const { return m_string_count; }
+
+    void fill(Message *message, int depth) {
+        const Descriptor *descriptor = message->GetDescriptor();
+
+        // Only one field of every oneof can be set
+        std::vector<const FieldDescriptor*> oneof_choices;
+        for (int i = 0; i < descriptor->oneof_decl_count(); ++i) {
+            const auto *oneof = descriptor->oneof_decl(i);
+            oneof_choices.push_back(oneof->field(static_cast<int>(m_random() % oneof->field_count())));
+        }
+
+        for (int i = 0; i < descriptor->field_count(); ++i) {
+            const FieldDescriptor *field = descriptor->field(i);
+            if (field->containing_oneof() != nullptr
+                && std::find(oneof_choices.begin(), oneof_choices.end(), field) == oneof_choices.end()) {
+                continue;
+            }
+            // The deepest messages are left empty
+            if (field->cpp_type() == FieldDescriptor::CPPTYPE_MESSAGE && depth >= MAX_MESSAGE_DEPTH) {
+                continue;
+            }
+
+            const int count = field->is_repeated() ? m_settings.repeated_field_count : 1;
+            for (int j = 0; j < count; ++j) {
+                addValue(message, field, depth);
+            }
+        }
+    }
+};
+
+} // anonymous namespace
+
+std::unique_ptr<google::protobuf::Message> generateSyntheticMessage(
+    const google::protobuf::Descriptor *descriptor,
+    const grpc_mock_server::SyntheticResponseSettings &settings,
+    uint64_t seed
+) {
+    const auto *prototype = google::protobuf::MessageFactory::generated_factory()->GetPrototype(descriptor);
+    if (prototype == nullptr) return nullptr;
+
+    // Measure the message with short strings first, then spread the rest of the target size over its strings
+    std::unique_ptr<Message> message(prototype->New());
+    MessageGenerator probe(settings, seed, PROBE_STRING_SIZE);
+    probe.fill(message.get(), 0);
+
+    const auto probe_size = message->ByteSizeLong();
+    const auto target_size = static_cast<size_t>(std::max(settings.target_size_bytes, 0));
+    if (probe.stringCount() == 0 || probe_size == target_size) return message;
+
+    size_t string_size = PROBE_STRING_SIZE;
+    if (probe_size < target_size) {
+        string_size += (target_size - probe_size) / probe.stringCount();
+    }
+    else {
+        string_size -= std::min(string_size - 1, (probe_size - target_size) / probe.stringCount());
+    }
+
+    message.reset(prototype->New());
+    MessageGenerator generator(settings, seed, string_size);
+    generator.fill(message.get(), 0);
+    return message;
+}
+
+size_t SyntheticResponsePool::build(
+    const std::vector<std::string> &methods,
+    const grpc_mock_server::SyntheticResponseSettings &settings
+) {
+    m_entries.clear();
+    m_synthetic_only = settings.synthetic_only;
+    const int pool_size = std::max(settings.pool_size, 1);
+
+    for (const auto &method : methods) {
+        // Descriptors use dots only: "package.Service.Method"
+        std::string descriptor_name = method;
+        std::replace(descriptor_name.begin(), descriptor_name.end(), '/', '.');
+        const auto *method_descriptor = google::protobuf::DescriptorPool::generated_pool()->FindMethodByName(descriptor_name);
+        if (method_descriptor == nullptr) {
+            GMS_LOG_DEBUG(LogCategory::Config, "No synthetic responses for unknown method '{}'", method);
+            continue;
+        }
+
+        auto entry = std::make_unique<Entry>();
+        const uint64_t method_seed = hashMethodName(method) ^ settings.seed;
+        for (int i = 0; i < pool_size; ++i) {
+            auto message = generateSyntheticMessage(method_descriptor->output_type(), settings, method_seed + i);
+            if (!message) break;
+
+            std::string data;
+            if (!serializeDeterministic(*message, data)) break;
+            entry->responses.emplace_back(data);
+        }
+        if (entry->responses.empty()) {
+            GMS_LOG_WARN(LogCategory::Config, "Unable to generate synthetic responses for '{}'", method);
+            continue;
+        }
+        m_entries.emplace(method, std::move(entry));
+    }
+    return m_entries.size();
+}
+
+const grpc::Slice *SyntheticResponsePool::nextResponse(const std::string &method) const {
+    auto iter = m_entries.find(method);
+    if (iter == m_entries.end()) return nullptr;
+
+    const auto &entry = *iter->second;
+    auto index = entry.next_index.fetch_add(1, std::memory_order_relaxed);
+    return &entry.responses[index % entry.responses.size()];
+}
+
+bool SyntheticResponsePool::next(const std::string &method, grpc::ByteBuffer *response) const {
+    const auto *slice = nextResponse(method);
+    if (slice == nullptr) return false;
+
+    // The slice is reference-counted, the response shares its data
+    grpc::ByteBuffer buffer(slice, 1);
+    response->Swap(&buffer);
+    return true;
+}
+
+bool SyntheticResponsePool::next(const std::string &method, google::protobuf::Message *response) const {
+    const auto *slice = nextResponse(method);
+    if (slice == nullptr) return false;
+    return response->ParseFromArray(slice->begin(), static_cast<int>(slice->size()));
+}
+
+bool grpcMockServerLoadSyntheticResponse(const std::string &method, google::protobuf::Message *response) {
+    auto pool = BusinessLogic::getInstance().syntheticResponses();
+    if (!pool) return false;
+    return pool->next(method, response);
+}
@@ -0,0 +1,77 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_SYNTHETIC_RESPONSES_H
+#define GRPC_MOCK_SERVER_SYNTHETIC_RESPONSES_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
+
+#include <grpcpp/support/slice.h>
+#include <grpcpp/support/byte_buffer.h>
+
+#include "grpc_mock_server_library.h"
+
+namespace google::protobuf { class Descriptor; class Message; }
+
+// Fills every field of a new `descriptor` message through reflection: the same seed gives the same message.
+// The string fields are sized so that the serialized message is close to `target_size_bytes`,
+// unless the rest of the message alone is larger
+std::unique_ptr<google::protobuf::Message> generateSyntheticMessage(
+    const google::protobuf::Descriptor *descriptor,
+    const grpc_mock_server::SyntheticResponseSettings &settings,
+    uint64_t seed
+);
+
+/// <summary>
+/// Responses generated for every method before the server starts and kept serialized,
+/// so that a call only takes the next one in turn; immutable once built
+/// </summary>
+class SyntheticResponsePool {
+    struct Entry {
+        std::vector<grpc::Slice> responses;
+        mutable std::atomic<uint64_t> next_index { 0 };
+    };
+
+    std::unordered_map<std::string, std::unique_ptr<Entry>> m_entries;
+    bool m_synthetic_only = false;
+
+    const grpc::Slice *nextResponse(const std::string &method) const;
+
+public:
+    // `methods` are full method names like "package.Service/Method"; the ones missing
+    // from the generated descriptor pool are skipped. Returns the number of methods generated
+    size_t build(const std::vector<std::string> &methods, const grpc_mock_server::SyntheticResponseSettings &settings);
+
+    size_t size() const { return m_entries.size(); }
+    // The upstream server is not called for the methods having synthetic responses
+    bool isSyntheticOnly() const { return m_synthetic_only; }
+
+    // Return false if there are no responses for the method
+    bool next(const std::string &method, grpc::ByteBuffer *response) const;
+    bool next(const std::string &method, google::protobuf::Message *response) const;
+};
+
+// This function will be called by protobuf compiler generated code when the method has no fixture
+// and the upstream call failed, the upstream proxy falls back to the same responses by itself
+bool grpcMockServerLoadSyntheticResponse(const std::string &method, google::protobuf::Message *response);
+
+#endif // GRPC_MOCK_SERVER_SYNTHETIC_RESPONSES_H
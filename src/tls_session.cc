@@ -0,0 +1,276 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "tls_session.h"
+#include "event_logger.h"
+
+#include <cstring>
+#include <cassert>
+
+#include <grpc_mock_server_logger.h>
+
+#include <grpc/grpc_security.h>
+#include <grpc/grpc_security_constants.h>
+#include <grpcpp/security/tls_credentials_options.h>
+#include <grpcpp/security/tls_certificate_verifier.h>
+
+namespace {
+
+// Added to the auth context of a connection once its handshake is counted
+constexpr char COUNTED_PROPERTY_NAME[] = "x-gms-handshake-counted";
+
+// The watches are re-armed this often, so that the channels nobody else uses are released
+constexpr auto CHANNEL_WATCH_INTERVAL = std::chrono::seconds(1);
+
+class HandshakeCountingInterceptor : public grpc::experimental::Interceptor {
+    TlsSessionTracker *m_tracker;
+    grpc::experimental::ServerRpcInfo *m_info;
+
+public:
+    HandshakeCountingInterceptor(TlsSessionTracker *tracker, grpc::experimental::ServerRpcInfo *info)
+        : m_tracker(tracker), m_info(info) {
+    }
+
+    void Intercept(grpc::experimental::InterceptorBatchMethods *methods) override {
+        if (methods->QueryInterceptionHookPoint(
+            grpc::experimental::InterceptionHookPoints::POST_RECV_INITIAL_METADATA)) {
+            m_tracker->onServerCall(m_info->server_context());
+        }
+        methods->Proceed();
+    }
+};
+
+class HandshakeCountingInterceptorFactory : public grpc::experimental::ServerInterceptorFactoryInterface {
+    TlsSessionTracker *m_tracker;
+
+public:
+    explicit HandshakeCountingInterceptorFactory(TlsSessionTracker *tracker) : m_tracker(tracker) {
+    }
+
+    grpc::experimental::Interceptor *CreateServerInterceptor(grpc::experimental::ServerRpcInfo *info) override {
+        return new HandshakeCountingInterceptor(m_tracker, info);
+    }
+};
+
+void updateMaximum(std::atomic<uint64_t> &maximum, uint64_t value) {
+    uint64_t current = maximum.load(std::memory_order_relaxed);
+    while (value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+bool hasProperty(const grpc_auth_context *context, const char *name, const char *value) {
+    auto iterator = grpc_auth_context_find_properties_by_name(context, name);
+    const size_t value_length = strlen(value);
+    while (const grpc_auth_property *property = grpc_auth_property_iterator_next(&iterator)) {
+        if (property->value_length == value_length && memcmp(property->value, value, value_length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t connectionLock(const grpc_auth_context *context, size_t lock_count) {
+    auto key = reinterpret_cast<uintptr_t>(context) >> 4;
+    return static_cast<size_t>(key * 0x9E3779B97F4A7C15ULL) % lock_count;
+}
+
+} // anonymous namespace
+
+struct TlsSessionTracker::ChannelWatch {
+    std::shared_ptr<grpc::Channel> channel;
+    grpc_connectivity_state state = GRPC_CHANNEL_IDLE;
+    bool connecting = false;
+    std::chrono::steady_clock::time_point connecting_since;
+};
+
+TlsSessionTracker::TlsSessionTracker(size_t session_cache_capacity) {
+    m_session_cache = grpc_ssl_session_cache_create_lru(session_cache_capacity);
+}
+
+TlsSessionTracker::~TlsSessionTracker() {
+    {
+        std::lock_guard<std::mutex> lock(m_watch_mutex);
+        m_watch_stopping = true;
+        if (m_watch_queue) m_watch_queue->Shutdown();
+    }
+    // The pending watches expire within the watch interval
+    if (m_watch_thread.joinable()) m_watch_thread.join();
+
+    grpc_ssl_session_cache_destroy(m_session_cache);
+}
+
+void TlsSessionTracker::applySessionCache(grpc::ChannelArguments &args) const {
+    // The channel argument holds its own reference to the cache
+    grpc_arg arg = grpc_ssl_session_cache_create_channel_arg(m_session_cache);
+    args.SetPointerWithVtable(arg.key, arg.value.pointer.p, arg.value.pointer.vtable);
+}
+
+void TlsSessionTracker::watchChannel(const std::shared_ptr<grpc::Channel> &channel) {
+    assert(channel);
+
+    auto watch = new ChannelWatch;
+    watch->channel = channel;
+    watch->state = channel->GetState(false);
+
+    std::lock_guard<std::mutex> lock(m_watch_mutex);
+    if (m_watch_stopping) {
+        delete watch;
+        return;
+    }
+    if (!m_watch_queue) {
+        m_watch_queue = std::make_unique<grpc::CompletionQueue>();
+        m_watch_thread = std::thread(&TlsSessionTracker::watchLoop, this);
+    }
+    armWatch(watch);
+}
+
+void TlsSessionTracker::armWatch(ChannelWatch *watch) {
+    // Called with the watch mutex locked, so the queue isn't shut down meanwhile
+    watch->channel->NotifyOnStateChange(
+        watch->state,
+        std::chrono::system_clock::now() + CHANNEL_WATCH_INTERVAL,
+        m_watch_queue.get(),
+        watch
+    );
+}
+
+void TlsSessionTracker::watchLoop() {
+    void *tag = nullptr;
+    bool changed = false;
+    while (m_watch_queue->Next(&tag, &changed)) {
+        auto watch = static_cast<ChannelWatch*>(tag);
+
+        if (changed) {
+            auto state = watch->channel->GetState(false);
+            auto now = std::chrono::steady_clock::now();
+            if (state == GRPC_CHANNEL_CONNECTING && !watch->connecting) {
+                watch->connecting = true;
+                watch->connecting_since = now;
+            }
+            else if (state == GRPC_CHANNEL_READY && watch->connecting) {
+                // A connection set up faster than the state change was seen isn't timed
+                auto elapsed_us = static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::microseconds>(now - watch->connecting_since).count()
+                );
+                m_client_handshakes.fetch_add(1, std::memory_order_relaxed);
+                m_client_handshake_time_us_total.fetch_add(elapsed_us, std::memory_order_relaxed);
+                updateMaximum(m_client_handshake_time_us_max, elapsed_us);
+                watch->connecting = false;
+                GMS_LOG_DEBUG(LogCategory::Tls, "Channel connected in {} us", elapsed_us);
+            }
+            else if (state != GRPC_CHANNEL_CONNECTING) {
+                watch->connecting = false;
+            }
+            watch->state = state;
+        }
+
+        std::lock_guard<std::mutex> lock(m_watch_mutex);
+        if (m_watch_stopping || watch->channel.use_count() == 1) {
+            delete watch;
+            continue;
+        }
+        armWatch(watch);
+    }
+}
+
+bool TlsSessionTracker::waitForConnected(
+    const std::shared_ptr<grpc::Channel> &channel,
+    std::chrono::milliseconds timeout
+) {
+    auto state = channel->GetState(false);
+    if (state == GRPC_CHANNEL_READY) return true;
+
+    // The setup time is recorded by the watch
+    if (!channel->WaitForConnected(std::chrono::system_clock::now() + timeout)) {
+        GMS_LOG_WARN(LogCategory::Tls, "Channel was not connected in {} ms", timeout.count());
+        return false;
+    }
+    return true;
+}
+
+bool TlsSessionTracker::probeServerHandshake(const std::string &target, std::chrono::milliseconds timeout) {
+    // Only the time matters, so the server certificate is taken as is, whichever provider serves it
+    grpc::experimental::TlsChannelCredentialsOptions options;
+    options.set_verify_server_certs(false);
+    options.set_check_call_host(false);
+    options.set_certificate_verifier(std::make_shared<grpc::experimental::NoOpCertificateVerifier>());
+
+    // Neither the shared session cache nor a pooled connection, so that the handshake is a full one
+    grpc::ChannelArguments args;
+    args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+    auto channel = grpc::CreateCustomChannel(target, grpc::experimental::TlsCredentials(options), args);
+
+    auto started = std::chrono::steady_clock::now();
+    if (!channel->WaitForConnected(std::chrono::system_clock::now() + timeout)) {
+        GMS_LOG_WARN(LogCategory::Tls, "Server handshake probe was not connected in {} ms", timeout.count());
+        return false;
+    }
+    auto elapsed_us = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count()
+    );
+    m_server_handshake_probe_time_us.store(elapsed_us, std::memory_order_relaxed);
+    GMS_LOG_DEBUG(LogCategory::Tls, "Server handshake probe connected in {} us", elapsed_us);
+    return true;
+}
+
+void TlsSessionTracker::onServerCall(grpc::ServerContextBase *server_context) {
+    grpc_auth_context *context = grpc_call_auth_context(server_context->c_call());
+    if (context == nullptr) return;
+
+    // The auth context lives exactly as long as its connection, so the mark neither outlives it
+    // nor is found by another connection that happens to reuse the address
+    bool full_handshake = false;
+    bool resumed_handshake = false;
+    {
+        std::lock_guard<std::mutex> lock(m_connection_locks[connectionLock(context, CONNECTION_LOCK_COUNT)]);
+        if (!hasProperty(context, COUNTED_PROPERTY_NAME, "true")) {
+            grpc_auth_context_add_cstring_property(context, COUNTED_PROPERTY_NAME, "true");
+
+            const bool tls = hasProperty(context, GRPC_TRANSPORT_SECURITY_TYPE_PROPERTY_NAME, GRPC_TLS_TRANSPORT_SECURITY_TYPE)
+                || hasProperty(context, GRPC_TRANSPORT_SECURITY_TYPE_PROPERTY_NAME, GRPC_SSL_TRANSPORT_SECURITY_TYPE);
+            if (tls) {
+                resumed_handshake = hasProperty(context, GRPC_SSL_SESSION_REUSED_PROPERTY, "true");
+                full_handshake = !resumed_handshake;
+            }
+        }
+    }
+    grpc_auth_context_release(context);
+
+    if (full_handshake) m_server_full_handshakes.fetch_add(1, std::memory_order_relaxed);
+    if (resumed_handshake) m_server_resumed_handshakes.fetch_add(1, std::memory_order_relaxed);
+}
+
+void TlsSessionTracker::onCertificateUpdated() {
+    m_certificate_updates.fetch_add(1, std::memory_order_relaxed);
+}
+
+grpc_mock_server::TlsStatistics TlsSessionTracker::statistics() const {
+    grpc_mock_server::TlsStatistics result;
+    result.server_full_handshakes = m_server_full_handshakes.load(std::memory_order_relaxed);
+    result.server_resumed_handshakes = m_server_resumed_handshakes.load(std::memory_order_relaxed);
+    result.server_handshake_probe_time_us = m_server_handshake_probe_time_us.load(std::memory_order_relaxed);
+    result.client_handshakes = m_client_handshakes.load(std::memory_order_relaxed);
+    result.client_handshake_time_us_total = m_client_handshake_time_us_total.load(std::memory_order_relaxed);
+    result.client_handshake_time_us_max = m_client_handshake_time_us_max.load(std::memory_order_relaxed);
+    result.certificate_updates = m_certificate_updates.load(std::memory_order_relaxed);
+    return result;
+}
+
+std::unique_ptr<grpc::experimental::ServerInterceptorFactoryInterface> TlsSessionTracker::createInterceptorFactory() {
+    return std::make_unique<HandshakeCountingInterceptorFactory>(this);
+}
@@ -0,0 +1,97 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_TLS_SESSION_H
+#define GRPC_MOCK_SERVER_TLS_SESSION_H
+
+#include <grpc_mock_server_export.h>
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <grpc++/grpc++.h>
+#include <grpcpp/support/server_interceptor.h>
+
+#include "grpc_mock_server_library.h"
+
+struct grpc_ssl_session_cache;
+
+/// <summary>
+/// Keeps the TLS session state shared by all channels the library creates
+/// and counts the handshakes performed on both sides of the mock server.
+/// The server side marks the auth context of a connection, which all its calls share, on the first call;
+/// the client side watches the connectivity state of the channels, so the lazy connects are measured too
+/// </summary>
+class TlsSessionTracker {
+    struct ChannelWatch;
+
+    static constexpr size_t CONNECTION_LOCK_COUNT = 64;
+
+    grpc_ssl_session_cache* m_session_cache = nullptr;
+
+    // Adding the mark may move the properties of the auth context, so the calls of the same connection
+    // look at them under the lock; the connections hashed to the same lock merely wait for each other
+    std::mutex m_connection_locks[CONNECTION_LOCK_COUNT];
+
+    std::mutex m_watch_mutex;
+    bool m_watch_stopping = false;
+    std::unique_ptr<grpc::CompletionQueue> m_watch_queue;
+    std::thread m_watch_thread;
+
+    std::atomic<uint64_t> m_server_full_handshakes = 0;
+    std::atomic<uint64_t> m_server_resumed_handshakes = 0;
+    std::atomic<uint64_t> m_server_handshake_probe_time_us = 0;
+    std::atomic<uint64_t> m_client_handshakes = 0;
+    std::atomic<uint64_t> m_client_handshake_time_us_total = 0;
+    std::atomic<uint64_t> m_client_handshake_time_us_max = 0;
+    std::atomic<uint64_t> m_certificate_updates = 0;
+
+    void watchLoop();
+    void armWatch(ChannelWatch *watch);
+
+public:
+    explicit TlsSessionTracker(size_t session_cache_capacity);
+    ~TlsSessionTracker();
+
+    TlsSessionTracker(const TlsSessionTracker&) = delete;
+    TlsSessionTracker &operator=(const TlsSessionTracker&) = delete;
+
+    // Adds the shared client-side session cache to the channel arguments, so that
+    // reconnects to an already known host resume the TLS session instead of doing a full handshake
+    void applySessionCache(grpc::ChannelArguments &args) const;
+
+    // Records the connection (TCP + TLS) setup times of the channel for as long as someone else uses it
+    void watchChannel(const std::shared_ptr<grpc::Channel> &channel);
+    bool waitForConnected(const std::shared_ptr<grpc::Channel> &channel, std::chrono::milliseconds timeout);
+
+    // Times a full handshake with the local server over a fresh loopback connection
+    bool probeServerHandshake(const std::string &target, std::chrono::milliseconds timeout);
+
+    void onServerCall(grpc::ServerContextBase *server_context);
+    void onCertificateUpdated();
+
+    grpc_mock_server::TlsStatistics statistics() const;
+
+    std::unique_ptr<grpc::experimental::ServerInterceptorFactoryInterface> createInterceptorFactory();
+};
+
+#endif // GRPC_MOCK_SERVER_TLS_SESSION_H
@@ -0,0 +1,173 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "traffic_capture.h"
+
+#include <chrono>
+
+#include <google/protobuf/message.h>
+
+#include <grpc_mock_server_logger.h>
+
+#include "business_logic.h"
+#include "event_logger.h"
+#include "warm_up.h"
+
+namespace {
+
+// The writer thread wakes up at least this often, so that a stopped process loses little traffic
+constexpr auto FLUSH_INTERVAL = std::chrono::milliseconds(100);
+constexpr size_t FLUSH_THRESHOLD = 1024 * 1024;
+
+// Records are dropped rather than blocking the calls if the disk can't keep up
+constexpr size_t MAX_PENDING_SIZE = 64 * 1024 * 1024;
+
+} // anonymous namespace
+
+TrafficCapture::~TrafficCapture() {
+    stop();
+}
+
+bool TrafficCapture::start(const std::string &directory, uint64_t segment_size) {
+    stop();
+
+    std::string error;
+    if (!m_writer.open(directory, segment_size, error)) {
+        SystemLogger->error("Unable to start the traffic capture: {}", error);
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending.clear();
+        m_stop_requested = false;
+        m_dropped_records = 0;
+    }
+    m_writer_thread = std::thread(&TrafficCapture::writerLoop, this);
+    m_enabled = true;
+
+    SystemLogger->info("Traffic capture started in '{}'", directory);
+    return true;
+}
+
+void TrafficCapture::stop() {
+    if (!m_writer_thread.joinable()) return;
+
+    m_enabled = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop_requested = true;
+    }
+    m_cv.notify_one();
+    m_writer_thread.join();
+    m_writer.close();
+
+    if (m_dropped_records > 0) {
+        SystemLogger->warn("Traffic capture dropped {} records", m_dropped_records);
+    }
+    SystemLogger->info("Traffic capture stopped");
+}
+
+void TrafficCapture::capture(
+    const grpc::ServerContext *server_context,
+    const std::string &method,
+    const std::string &serialized_request
+) {
+    if (!isEnabled()) return;
+
+    CaptureRecord record;
+    record.arrival_time_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()
+    ).count());
+    record.method = method;
+    record.payload = serialized_request;
+    if (server_context != nullptr) {
+        for (const auto &[key, value] : server_context->client_metadata()) {
+            record.metadata.emplace_back(std::string_view(key.data(), key.size()), std::string_view(value.data(), value.size()));
+        }
+    }
+
+    thread_local std::string encoded;
+    encoded.clear();
+    encodeCaptureRecord(record, encoded);
+
+    bool notify = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_pending.size() + encoded.size() > MAX_PENDING_SIZE) {
+            ++m_dropped_records;
+            return;
+        }
+        m_pending.append(encoded);
+        notify = m_pending.size() >= FLUSH_THRESHOLD;
+    }
+    if (notify) m_cv.notify_one();
+}
+
+void TrafficCapture::writerLoop() {
+    std::string writing;
+    std::string error;
+    bool stop_requested = false;
+    while (!stop_requested) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait_for(lock, FLUSH_INTERVAL, [this]() {
+                return m_stop_requested || m_pending.size() >= FLUSH_THRESHOLD;
+            });
+            stop_requested = m_stop_requested;
+            writing.swap(m_pending);
+        }
+        if (writing.empty()) continue;
+
+        // The buffer holds whole records, split it so that the segments are rotated on record boundaries
+        std::string_view records = writing;
+        while (!records.empty()) {
+            uint32_t record_size = 0;
+            for (size_t i = 0; i < sizeof(uint32_t); ++i) {
+                record_size |= static_cast<uint32_t>(static_cast<unsigned char>(records[i])) << (8 * i);
+            }
+            auto size = sizeof(uint32_t) + record_size;
+            if (!m_writer.append(records.substr(0, size), error)) {
+                SystemLogger->error("Traffic capture write failed: {}", error);
+                break;
+            }
+            records.remove_prefix(size);
+        }
+        m_writer.flush();
+        writing.clear();
+    }
+}
+
+void grpcMockServerRequestCallback(
+    const grpc::ServerContext *server_context,
+    const std::string &method,
+    const google::protobuf::Message &request
+) {
+    // Called first by every generated handler, so the history of the call knows if it is a warm-up one
+    markWarmUpCall(server_context);
+
+    auto &traffic_capture = BusinessLogic::getInstance().trafficCapture();
+    if (!traffic_capture.isEnabled() || isCurrentCallWarmUp()) return;
+
+    std::string serialized_request;
+    if (!request.SerializeToString(&serialized_request)) {
+        GMS_LOG_ERROR_RATE_LIMITED(LogCategory::Rpc, 1, "Unable to serialize the '{}' request for the traffic capture", method);
+        return;
+    }
+    traffic_capture.capture(server_context, method, serialized_request);
+}
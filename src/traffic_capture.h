@@ -0,0 +1,79 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_TRAFFIC_CAPTURE_H
+#define GRPC_MOCK_SERVER_TRAFFIC_CAPTURE_H
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include <grpc++/grpc++.h>
+
+#include "capture_segment.h"
+
+namespace google::protobuf { class Message; }
+
+/// <summary>
+/// Appends the incoming calls to the capture segment files, to be re-issued later by the replay tool.
+/// The calling thread only encodes the record into a memory buffer,
+/// the buffer is written to the disk by a background thread
+/// </summary>
+class TrafficCapture {
+    std::atomic<bool> m_enabled { false };
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::string m_pending;
+    bool m_stop_requested = false;
+    uint64_t m_dropped_records = 0;
+
+    CaptureSegmentWriter m_writer;
+    std::thread m_writer_thread;
+
+    void writerLoop();
+
+public:
+    TrafficCapture() = default;
+    ~TrafficCapture();
+
+    TrafficCapture(const TrafficCapture&) = delete;
+    TrafficCapture &operator=(const TrafficCapture&) = delete;
+
+    bool start(const std::string &directory, uint64_t segment_size);
+    void stop();
+    bool isEnabled() const { return m_enabled.load(std::memory_order_relaxed); }
+
+    // `method` is a full method name like "package.Service/Method"
+    void capture(
+        const grpc::ServerContext *server_context,
+        const std::string &method,
+        const std::string &serialized_request
+    );
+};
+
+// This function will be called by protobuf compiler generated code when a request is received
+void grpcMockServerRequestCallback(
+    const grpc::ServerContext *server_context,
+    const std::string &method,
+    const google::protobuf::Message &request
+);
+
+#endif // GRPC_MOCK_SERVER_TRAFFIC_CAPTURE_H
@@ -0,0 +1,274 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "tuning_profile.h"
+
+#include <grpc_mock_server_logger.h>
+
+#include <pugixml.hpp>
+
+namespace {
+
+// HTTP/2 frame size limits (RFC 7540, section 4.2)
+constexpr int MIN_HTTP2_FRAME_SIZE = 16384;
+constexpr int MAX_HTTP2_FRAME_SIZE = 16777215;
+
+grpc_mock_server::TuningProfile lowLatencyProfile() {
+    grpc_mock_server::TuningProfile profile;
+    // Keep enough pollers ready, so that a call never waits for a thread to be spawned
+    profile.min_pollers = 4;
+    profile.cq_timeout_ms = 10;
+    // Keep the connections warm
+    profile.keepalive_time_ms = 10000;
+    profile.keepalive_timeout_ms = 5000;
+    profile.keepalive_permit_without_calls = true;
+    profile.max_pings_without_data = 0;
+    profile.min_ping_interval_without_data_ms = 5000;
+    // Compression costs more than it saves on the small payloads
+    profile.compression = false;
+    return profile;
+}
+
+grpc_mock_server::TuningProfile bulkPayloadProfile() {
+    grpc_mock_server::TuningProfile profile;
+    profile.max_receive_message_size = -1;
+    profile.max_send_message_size = -1;
+    // Large windows and frames, so that a big message is not throttled by the flow control
+    profile.stream_lookahead_bytes = 8 * 1024 * 1024;
+    profile.max_frame_size = MAX_HTTP2_FRAME_SIZE;
+    profile.memory_quota_bytes = 1024LL * 1024 * 1024;
+    return profile;
+}
+
+void readAttribute(const pugi::xml_node &node, const char *name, int &value) {
+    auto attribute = node.attribute(name);
+    if (attribute) value = attribute.as_int(value);
+}
+
+void readAttribute(const pugi::xml_node &node, const char *name, int64_t &value) {
+    auto attribute = node.attribute(name);
+    if (attribute) value = static_cast<int64_t>(attribute.as_llong(value));
+}
+
+void readAttribute(const pugi::xml_node &node, const char *name, bool &value) {
+    auto attribute = node.attribute(name);
+    if (attribute) value = attribute.as_bool(value);
+}
+
+} // anonymous namespace
+
+bool findTuningProfile(const std::string &name, grpc_mock_server::TuningProfile &profile) {
+    if (name == "default") {
+        profile = grpc_mock_server::TuningProfile();
+    }
+    else if (name == "low-latency") {
+        profile = lowLatencyProfile();
+    }
+    else if (name == "bulk-payload") {
+        profile = bulkPayloadProfile();
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+bool parseTuningProfileXml(const std::string &data, grpc_mock_server::TuningProfile &profile, std::string &error) {
+    pugi::xml_document doc;
+    pugi::xml_parse_result parser_result = doc.load_buffer(data.data(), data.size());
+    if (!parser_result) {
+        error = parser_result.description();
+        return false;
+    }
+
+    auto tuning_node = doc.child("root").child("tuning");
+    if (!tuning_node) tuning_node = doc.child("tuning");
+    if (!tuning_node) {
+        error = "<tuning> element not found";
+        return false;
+    }
+
+    // The named profile is the base, the elements below override its values
+    grpc_mock_server::TuningProfile result;
+    std::string base_name = tuning_node.attribute("profile").as_string("default");
+    if (!findTuningProfile(base_name, result)) {
+        error = "unknown tuning profile '" + base_name + "'";
+        return false;
+    }
+
+    auto server_node = tuning_node.child("server");
+    readAttribute(server_node, "num_cqs", result.num_cqs);
+    readAttribute(server_node, "min_pollers", result.min_pollers);
+    readAttribute(server_node, "max_pollers", result.max_pollers);
+    readAttribute(server_node, "cq_timeout_ms", result.cq_timeout_ms);
+    readAttribute(server_node, "compression", result.compression);
+
+    auto quota_node = tuning_node.child("resource_quota");
+    readAttribute(quota_node, "max_threads", result.max_threads);
+    readAttribute(quota_node, "memory_bytes", result.memory_quota_bytes);
+
+    auto messages_node = tuning_node.child("messages");
+    readAttribute(messages_node, "max_receive_size", result.max_receive_message_size);
+    readAttribute(messages_node, "max_send_size", result.max_send_message_size);
+
+    auto flow_control_node = tuning_node.child("flow_control");
+    readAttribute(flow_control_node, "bdp_probe", result.bdp_probe);
+    readAttribute(flow_control_node, "stream_lookahead_bytes", result.stream_lookahead_bytes);
+    readAttribute(flow_control_node, "max_frame_size", result.max_frame_size);
+
+    auto keepalive_node = tuning_node.child("keepalive");
+    readAttribute(keepalive_node, "time_ms", result.keepalive_time_ms);
+    readAttribute(keepalive_node, "timeout_ms", result.keepalive_timeout_ms);
+    readAttribute(keepalive_node, "permit_without_calls", result.keepalive_permit_without_calls);
+    readAttribute(keepalive_node, "max_pings_without_data", result.max_pings_without_data);
+    readAttribute(keepalive_node, "min_ping_interval_without_data_ms", result.min_ping_interval_without_data_ms);
+
+    auto channel_keepalive_node = tuning_node.child("channel_keepalive");
+    readAttribute(channel_keepalive_node, "time_ms", result.channel_keepalive_time_ms);
+    readAttribute(channel_keepalive_node, "timeout_ms", result.channel_keepalive_timeout_ms);
+    readAttribute(channel_keepalive_node, "permit_without_calls", result.channel_keepalive_permit_without_calls);
+
+    profile = result;
+    return true;
+}
+
+bool validateTuningProfile(const grpc_mock_server::TuningProfile &profile, std::string &error) {
+    if (profile.num_cqs < 0 || profile.min_pollers < 0 || profile.max_pollers < 0 || profile.cq_timeout_ms < 0) {
+        error = "server polling settings must not be negative";
+        return false;
+    }
+    if (profile.min_pollers > 0 && profile.max_pollers > 0 && profile.min_pollers > profile.max_pollers) {
+        error = "min_pollers must not exceed max_pollers";
+        return false;
+    }
+    if (profile.max_threads < 0 || profile.memory_quota_bytes < 0) {
+        error = "resource quota settings must not be negative";
+        return false;
+    }
+    // Every poller and every running call hold a thread of the quota
+    if (profile.max_threads > 0 && profile.min_pollers > 0 && profile.max_threads <= profile.min_pollers) {
+        error = "max_threads must exceed min_pollers, otherwise no thread is left to run the calls";
+        return false;
+    }
+    if (profile.max_receive_message_size < -1 || profile.max_send_message_size < -1) {
+        error = "message size limits must be positive, zero (default) or -1 (unlimited)";
+        return false;
+    }
+    if (profile.stream_lookahead_bytes < 0) {
+        error = "stream_lookahead_bytes must not be negative";
+        return false;
+    }
+    if (profile.max_frame_size != 0
+        && (profile.max_frame_size < MIN_HTTP2_FRAME_SIZE || profile.max_frame_size > MAX_HTTP2_FRAME_SIZE)) {
+        error = "max_frame_size must be between 16384 and 16777215";
+        return false;
+    }
+    if (profile.keepalive_time_ms < 0 || profile.keepalive_timeout_ms < 0 || profile.min_ping_interval_without_data_ms < 0) {
+        error = "keepalive intervals must not be negative";
+        return false;
+    }
+    if (profile.keepalive_time_ms > 0 && profile.keepalive_timeout_ms >= profile.keepalive_time_ms) {
+        error = "keepalive timeout_ms must be less than time_ms";
+        return false;
+    }
+    if (profile.channel_keepalive_time_ms < 0 || profile.channel_keepalive_timeout_ms < 0) {
+        error = "channel keepalive intervals must not be negative";
+        return false;
+    }
+    if (profile.channel_keepalive_time_ms > 0 && profile.channel_keepalive_timeout_ms >= profile.channel_keepalive_time_ms) {
+        error = "channel keepalive timeout_ms must be less than time_ms";
+        return false;
+    }
+    if (profile.max_pings_without_data < -1) {
+        error = "max_pings_without_data must be non-negative or -1 (default)";
+        return false;
+    }
+    return true;
+}
+
+void applyTuningProfile(const grpc_mock_server::TuningProfile &profile, grpc::ServerBuilder &builder) {
+    if (profile.num_cqs > 0) builder.SetSyncServerOption(grpc::ServerBuilder::NUM_CQS, profile.num_cqs);
+    if (profile.min_pollers > 0) builder.SetSyncServerOption(grpc::ServerBuilder::MIN_POLLERS, profile.min_pollers);
+    if (profile.max_pollers > 0) builder.SetSyncServerOption(grpc::ServerBuilder::MAX_POLLERS, profile.max_pollers);
+    if (profile.cq_timeout_ms > 0) builder.SetSyncServerOption(grpc::ServerBuilder::CQ_TIMEOUT_MSEC, profile.cq_timeout_ms);
+
+    if (profile.max_threads > 0 || profile.memory_quota_bytes > 0) {
+        grpc::ResourceQuota quota("grpc_mock_server");
+        if (profile.max_threads > 0) quota.SetMaxThreads(profile.max_threads);
+        if (profile.memory_quota_bytes > 0) quota.Resize(static_cast<size_t>(profile.memory_quota_bytes));
+        builder.SetResourceQuota(quota);
+    }
+
+    if (profile.max_receive_message_size != 0) builder.SetMaxReceiveMessageSize(profile.max_receive_message_size);
+    if (profile.max_send_message_size != 0) builder.SetMaxSendMessageSize(profile.max_send_message_size);
+
+    builder.AddChannelArgument(GRPC_ARG_HTTP2_BDP_PROBE, profile.bdp_probe ? 1 : 0);
+    if (profile.stream_lookahead_bytes > 0) {
+        builder.AddChannelArgument(GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES, profile.stream_lookahead_bytes);
+    }
+    if (profile.max_frame_size > 0) builder.AddChannelArgument(GRPC_ARG_HTTP2_MAX_FRAME_SIZE, profile.max_frame_size);
+
+    if (profile.keepalive_time_ms > 0) builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_TIME_MS, profile.keepalive_time_ms);
+    if (profile.keepalive_timeout_ms > 0) {
+        builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_TIMEOUT_MS, profile.keepalive_timeout_ms);
+    }
+    builder.AddChannelArgument(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, profile.keepalive_permit_without_calls ? 1 : 0);
+    if (profile.max_pings_without_data >= 0) {
+        builder.AddChannelArgument(GRPC_ARG_HTTP2_MAX_PINGS_WITHOUT_DATA, profile.max_pings_without_data);
+    }
+    if (profile.min_ping_interval_without_data_ms > 0) {
+        builder.AddChannelArgument(
+            GRPC_ARG_HTTP2_MIN_RECV_PING_INTERVAL_WITHOUT_DATA_MS,
+            profile.min_ping_interval_without_data_ms
+        );
+    }
+
+    // Set the default compression algorithm for the server
+    if (profile.compression) builder.SetDefaultCompressionAlgorithm(GRPC_COMPRESS_GZIP);
+}
+
+void applyTuningProfile(const grpc_mock_server::TuningProfile &profile, grpc::ChannelArguments &args) {
+    if (profile.memory_quota_bytes > 0) {
+        // All the channels share one quota, a quota per channel would multiply the limit
+        static grpc::ResourceQuota channel_quota("grpc_mock_server_channel");
+        channel_quota.Resize(static_cast<size_t>(profile.memory_quota_bytes));
+        args.SetResourceQuota(channel_quota);
+    }
+
+    if (profile.max_receive_message_size != 0) args.SetMaxReceiveMessageSize(profile.max_receive_message_size);
+    if (profile.max_send_message_size != 0) args.SetMaxSendMessageSize(profile.max_send_message_size);
+
+    args.SetInt(GRPC_ARG_HTTP2_BDP_PROBE, profile.bdp_probe ? 1 : 0);
+    if (profile.stream_lookahead_bytes > 0) args.SetInt(GRPC_ARG_HTTP2_STREAM_LOOKAHEAD_BYTES, profile.stream_lookahead_bytes);
+    if (profile.max_frame_size > 0) args.SetInt(GRPC_ARG_HTTP2_MAX_FRAME_SIZE, profile.max_frame_size);
+
+    // The server keepalive settings are not applied here: the channel pings only if asked to explicitly
+    if (profile.channel_keepalive_time_ms > 0) {
+        args.SetInt(GRPC_ARG_KEEPALIVE_TIME_MS, profile.channel_keepalive_time_ms);
+        if (profile.channel_keepalive_timeout_ms > 0) {
+            args.SetInt(GRPC_ARG_KEEPALIVE_TIMEOUT_MS, profile.channel_keepalive_timeout_ms);
+        }
+        args.SetInt(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, profile.channel_keepalive_permit_without_calls ? 1 : 0);
+        if (profile.max_pings_without_data >= 0) {
+            args.SetInt(GRPC_ARG_HTTP2_MAX_PINGS_WITHOUT_DATA, profile.max_pings_without_data);
+        }
+    }
+    if (profile.min_ping_interval_without_data_ms > 0) {
+        args.SetInt(GRPC_ARG_HTTP2_MIN_SENT_PING_INTERVAL_WITHOUT_DATA_MS, profile.min_ping_interval_without_data_ms);
+    }
+}
@@ -0,0 +1,39 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_TUNING_PROFILE_H
+#define GRPC_MOCK_SERVER_TUNING_PROFILE_H
+
+#include <string>
+
+#include <grpc++/grpc++.h>
+
+#include "grpc_mock_server_library.h"
+
+// Finds one of the built-in profiles: "default", "low-latency" or "bulk-payload"
+bool findTuningProfile(const std::string &name, grpc_mock_server::TuningProfile &profile);
+
+// Parses the profile from the tuning XML, see `config_template.txt`
+bool parseTuningProfileXml(const std::string &data, grpc_mock_server::TuningProfile &profile, std::string &error);
+
+bool validateTuningProfile(const grpc_mock_server::TuningProfile &profile, std::string &error);
+
+void applyTuningProfile(const grpc_mock_server::TuningProfile &profile, grpc::ServerBuilder &builder);
+void applyTuningProfile(const grpc_mock_server::TuningProfile &profile, grpc::ChannelArguments &args);
+
+#endif // GRPC_MOCK_SERVER_TUNING_PROFILE_H
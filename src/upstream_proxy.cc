@@ -0,0 +1,552 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "upstream_proxy.h"
+#include "business_logic.h"
+#include "admission_control.h"
+#include "upstream_router.h"
+#include "rpc_tracing.h"
+#include "event_logger.h"
+#include "synthetic_responses.h"
+#include "warm_up.h"
+
+#include <grpc_mock_server_logger.h>
+
+#include <algorithm>
+#include <string_view>
+
+#define XXH_STATIC_LINKING_ONLY
+#include <xxhash.h>
+
+#include <grpcpp/impl/codegen/proto_utils.h>
+#include <google/protobuf/message.h>
+
+namespace {
+
+// Number of recent upstream latencies kept per method for the percentile-based hedging delay
+constexpr size_t LATENCY_WINDOW_SIZE = 256;
+// Fixed hedging delay is used until there are enough latencies to estimate the percentile
+constexpr size_t MIN_LATENCY_SAMPLES = 16;
+// Number of new latencies after which the percentile is recomputed
+constexpr size_t PERCENTILE_UPDATE_INTERVAL = 32;
+constexpr int MAX_ATTEMPTS = 2;
+// A coalesced call waiting for the shared one notices the cancellation of its own call that late at most
+constexpr auto FOLLOWER_CANCELLATION_CHECK_INTERVAL = std::chrono::milliseconds(50);
+
+struct Attempt {
+    std::unique_ptr<grpc::ClientContext> context;
+    grpc::ByteBuffer response;
+    grpc::Status status;
+    std::chrono::steady_clock::time_point started_at;
+    std::chrono::steady_clock::time_point finished_at;
+    bool finished = false;
+};
+
+// Shared with the completion callbacks, so the loser attempts may safely finish after `forward` returned
+struct HedgedCall {
+    std::mutex mutex;
+    std::condition_variable finished_cv;
+    Attempt attempts[MAX_ATTEMPTS];
+    int started = 0;
+    int finished = 0;
+    int winner = -1;
+    // A hedged attempt may still be sent, so a non-fatal failure of the first one is not final
+    bool hedge_pending = false;
+};
+
+std::chrono::milliseconds latencyPercentile(std::vector<std::chrono::microseconds> latencies, double percentile) {
+    auto nth = latencies.begin() + static_cast<ptrdiff_t>(
+        percentile / 100.0 * static_cast<double>(latencies.size() - 1)
+    );
+    std::nth_element(latencies.begin(), nth, latencies.end());
+    return std::max(
+        std::chrono::duration_cast<std::chrono::milliseconds>(*nth),
+        std::chrono::milliseconds(1)
+    );
+}
+
+// Same idea as the non-fatal status codes of the gRPC hedging policy:
+// another attempt still may succeed, so such a reply is not taken while other attempts are running
+bool isCommittable(const grpc::Status &status) {
+    return status.error_code() != grpc::StatusCode::UNAVAILABLE
+        && status.error_code() != grpc::StatusCode::RESOURCE_EXHAUSTED;
+}
+
+std::unique_ptr<grpc::ClientContext> createClientContext(grpc::ServerContextBase *server_context, bool propagate_cancellation) {
+    if (server_context == nullptr) return std::make_unique<grpc::ClientContext>();
+
+    // Inherit the deadline and the cancellation of the incoming call, so that the upstream
+    // does not keep working on the calls nobody waits for
+    grpc::PropagationOptions options;
+    if (!propagate_cancellation) options.disable_cancellation_propagation();
+    return grpc::ClientContext::FromServerContext(*server_context, options);
+}
+
+// Key of the coalesced calls, the request slices are hashed in place
+uint64_t flightKey(const std::string &method, const std::vector<grpc::Slice> &request_slices) {
+    XXH3_state_t state;
+    XXH3_64bits_reset_withSeed(&state, XXH3_64bits(method.data(), method.size()));
+    for (const auto &slice : request_slices) {
+        XXH3_64bits_update(&state, slice.begin(), slice.size());
+    }
+    return XXH3_64bits_digest(&state);
+}
+
+bool isSameRequest(const std::string &data, const std::vector<grpc::Slice> &request_slices) {
+    size_t offset = 0;
+    for (const auto &slice : request_slices) {
+        if (slice.size() > data.size() - offset) return false;
+        if (data.compare(offset, slice.size(), reinterpret_cast<const char*>(slice.begin()), slice.size()) != 0) return false;
+        offset += slice.size();
+    }
+    return offset == data.size();
+}
+
+std::string flattenSlices(const std::vector<grpc::Slice> &slices) {
+    std::string result;
+    size_t size = 0;
+    for (const auto &slice : slices) size += slice.size();
+
+    result.reserve(size);
+    for (const auto &slice : slices) {
+        result.append(reinterpret_cast<const char*>(slice.begin()), slice.size());
+    }
+    return result;
+}
+
+} // anonymous namespace
+
+UpstreamProxy::UpstreamProxy(AdmissionController *admission_controller, UpstreamRouter *router)
+    : m_admission_controller(admission_controller), m_router(router) {
+    assert(admission_controller != nullptr);
+    assert(router != nullptr);
+}
+
+void UpstreamProxy::setChannel(const std::shared_ptr<grpc::Channel> &channel) {
+    assert(channel);
+
+    m_channel = channel;
+    m_stub = std::make_unique<grpc::GenericStub>(channel);
+}
+
+void UpstreamProxy::setHedgingPolicy(const std::string &method, int delay_ms, double delay_percentile) {
+    assert(!method.empty());
+    assert(delay_ms >= 0);
+    assert(delay_percentile >= 0.0 && delay_percentile < 100.0);
+
+    std::lock_guard<std::mutex> lock(m_methods_mutex);
+    auto &state = m_methods[method];
+    state.hedging_enabled = delay_ms > 0 || delay_percentile > 0.0;
+    state.hedging_policy.delay = std::chrono::milliseconds(delay_ms);
+    state.hedging_policy.delay_percentile = delay_percentile;
+    state.has_percentile_delay = false;
+    state.latencies_since_update = 0;
+
+    SystemLogger->info(
+        "Hedging of method '{}' is {} (delay {} ms, percentile {})",
+        method,
+        state.hedging_enabled ? "enabled" : "disabled",
+        delay_ms,
+        delay_percentile
+    );
+}
+
+void UpstreamProxy::setCoalescingEnabled(const std::string &method, bool enabled) {
+    assert(!method.empty());
+
+    std::lock_guard<std::mutex> lock(m_methods_mutex);
+    m_methods[method].coalescing_enabled = enabled;
+
+    SystemLogger->info("Coalescing of method '{}' is {}", method, enabled ? "enabled" : "disabled");
+}
+
+bool UpstreamProxy::isCoalescingEnabled(const std::string &method) const {
+    std::lock_guard<std::mutex> lock(m_methods_mutex);
+    auto iter = m_methods.find(method);
+    return iter != m_methods.end() && iter->second.coalescing_enabled;
+}
+
+grpc_mock_server::UpstreamStatistics UpstreamProxy::statistics(const std::string &method) const {
+    std::lock_guard<std::mutex> lock(m_methods_mutex);
+    auto iter = m_methods.find(method);
+    return iter != m_methods.end() ? iter->second.statistics : grpc_mock_server::UpstreamStatistics();
+}
+
+std::chrono::milliseconds UpstreamProxy::hedgingDelay(const std::string &method, bool &hedging_enabled) {
+    std::lock_guard<std::mutex> lock(m_methods_mutex);
+    auto iter = m_methods.find(method);
+    hedging_enabled = iter != m_methods.end() && iter->second.hedging_enabled;
+    if (!hedging_enabled) return std::chrono::milliseconds(0);
+
+    const auto &state = iter->second;
+    if (state.hedging_policy.delay_percentile <= 0.0) return state.hedging_policy.delay;
+    if (state.has_percentile_delay) return state.percentile_delay;
+
+    // Without the fixed delay, the calls are not hedged until there are enough latencies for the percentile
+    hedging_enabled = state.hedging_policy.delay.count() > 0;
+    return state.hedging_policy.delay;
+}
+
+void UpstreamProxy::recordCall(const std::string &method, std::chrono::microseconds latency, bool hedged, bool hedge_won) {
+    std::vector<std::chrono::microseconds> latencies;
+    double percentile = 0.0;
+    {
+        std::lock_guard<std::mutex> lock(m_methods_mutex);
+        auto &state = m_methods[method];
+        if (state.latencies.size() < LATENCY_WINDOW_SIZE) {
+            state.latencies.push_back(latency);
+        }
+        else {
+            state.latencies[state.next_latency_index] = latency;
+            state.next_latency_index = (state.next_latency_index + 1) % LATENCY_WINDOW_SIZE;
+        }
+
+        state.statistics.calls++;
+        if (hedged) state.statistics.hedged_calls++;
+        if (hedge_won) state.statistics.hedge_wins++;
+
+        // Recomputed outside of the lock, the window is copied anyway
+        percentile = state.hedging_policy.delay_percentile;
+        if (percentile > 0.0 && state.latencies.size() >= MIN_LATENCY_SAMPLES
+            && (!state.has_percentile_delay || ++state.latencies_since_update >= PERCENTILE_UPDATE_INTERVAL)) {
+            state.latencies_since_update = 0;
+            latencies = state.latencies;
+        }
+    }
+    if (latencies.empty()) return;
+
+    auto delay = latencyPercentile(std::move(latencies), percentile);
+    std::lock_guard<std::mutex> lock(m_methods_mutex);
+    auto &state = m_methods[method];
+    if (state.hedging_policy.delay_percentile != percentile) return;
+    state.percentile_delay = delay;
+    state.has_percentile_delay = true;
+}
+
+void UpstreamProxy::recordFailure(const std::string &method) {
+    std::lock_guard<std::mutex> lock(m_methods_mutex);
+    m_methods[method].statistics.failed_calls++;
+}
+
+void UpstreamProxy::recordCoalescedCall(const std::string &method) {
+    std::lock_guard<std::mutex> lock(m_methods_mutex);
+    m_methods[method].statistics.coalesced_calls++;
+}
+
+grpc::Status UpstreamProxy::forward(
+    grpc::ServerContextBase *server_context,
+    const std::string &method,
+    const grpc::ByteBuffer &request,
+    grpc::ByteBuffer *response
+) {
+    assert(m_stub);
+    assert(response != nullptr);
+
+    // The warm-up calls prepare the server only: an empty message is the default instance of any response
+    if (isWarmUpCall(server_context)) {
+        response->Clear();
+        return grpc::Status::OK;
+    }
+
+    // The call is only forwarded if there is no full fixture, so a synthetic response is all that is left
+    auto synthetic_responses = BusinessLogic::getInstance().syntheticResponses();
+    if (synthetic_responses && synthetic_responses->isSyntheticOnly() && synthetic_responses->next(method, response)) {
+        return grpc::Status::OK;
+    }
+
+    TraceSpan trace_span("upstream_call");
+    auto status = isCoalescingEnabled(method)
+        ? forwardCoalesced(server_context, method, request, response)
+        : forwardAdmitted(server_context, true, method, request, response);
+
+    if (status.error_code() == grpc::StatusCode::UNAVAILABLE || status.error_code() == grpc::StatusCode::DEADLINE_EXCEEDED) {
+        if (synthetic_responses && synthetic_responses->next(method, response)) {
+            GMS_LOG_DEBUG_RATE_LIMITED(
+                LogCategory::Upstream,
+                1,
+                "Upstream call failed ({}), synthetic response of '{}' returned",
+                static_cast<int>(status.error_code()),
+                method
+            );
+            return grpc::Status::OK;
+        }
+    }
+    return status;
+}
+
+grpc::Status UpstreamProxy::forwardCoalesced(
+    grpc::ServerContextBase *server_context,
+    const std::string &method,
+    const grpc::ByteBuffer &request,
+    grpc::ByteBuffer *response
+) {
+    // Only the calls of the coalesced methods get here, the others are forwarded without looking into the request
+    std::vector<grpc::Slice> request_slices;
+    if (!request.Dump(&request_slices).ok()) {
+        return forwardAdmitted(server_context, true, method, request, response);
+    }
+    auto key = flightKey(method, request_slices);
+
+    std::shared_ptr<Flight> flight;
+    {
+        std::unique_lock<std::mutex> lock(m_flights_mutex);
+        auto range = m_flights.equal_range(key);
+        for (auto iter = range.first; iter != range.second; ++iter) {
+            // Hash collisions must not mix up the replies
+            if (iter->second->method == method && isSameRequest(iter->second->request, request_slices)) {
+                flight = iter->second;
+                break;
+            }
+        }
+
+        if (flight) {
+            recordCoalescedCall(method);
+
+            // Wait for the leader, but not longer than own deadline allows, nor after own client went away
+            auto is_finished = [&flight]() { return flight->finished; };
+            auto deadline = server_context != nullptr
+                ? server_context->deadline()
+                : std::chrono::system_clock::time_point::max();
+            if (server_context == nullptr) {
+                flight->finished_cv.wait(lock, is_finished);
+            }
+            else {
+                while (!flight->finished) {
+                    // There is no notification of the cancellation, so it is checked now and then
+                    if (server_context->IsCancelled()) {
+                        return grpc::Status(grpc::StatusCode::CANCELLED, "Call cancelled waiting for the coalesced call");
+                    }
+                    auto now = std::chrono::system_clock::now();
+                    if (now >= deadline) {
+                        return grpc::Status(grpc::StatusCode::DEADLINE_EXCEEDED, "Deadline exceeded waiting for the coalesced call");
+                    }
+                    auto wait_until = deadline - now > FOLLOWER_CANCELLATION_CHECK_INTERVAL
+                        ? now + FOLLOWER_CANCELLATION_CHECK_INTERVAL
+                        : deadline;
+                    flight->finished_cv.wait_until(lock, wait_until, is_finished);
+                }
+            }
+
+            // The shared call ran out of the leader's deadline; a follower with time left makes its own call
+            if (flight->status.error_code() == grpc::StatusCode::DEADLINE_EXCEEDED
+                && std::chrono::system_clock::now() < deadline) {
+                lock.unlock();
+                return forwardAdmitted(server_context, true, method, request, response);
+            }
+
+            if (flight->status.ok()) *response = flight->response;
+            return flight->status;
+        }
+
+        flight = std::make_shared<Flight>();
+        flight->method = method;
+        flight->request = flattenSlices(request_slices);
+        m_flights.emplace(key, flight);
+    }
+
+    // The leader call is shared, so the leader's client going away must not cancel it for the others
+    auto status = forwardAdmitted(server_context, false, method, request, response);
+
+    {
+        std::lock_guard<std::mutex> lock(m_flights_mutex);
+        auto range = m_flights.equal_range(key);
+        for (auto iter = range.first; iter != range.second; ++iter) {
+            if (iter->second == flight) {
+                m_flights.erase(iter);
+                break;
+            }
+        }
+
+        flight->finished = true;
+        flight->status = status;
+        if (status.ok()) flight->response = *response;
+    }
+    flight->finished_cv.notify_all();
+
+    return status;
+}
+
+grpc::Status UpstreamProxy::forwardAdmitted(
+    grpc::ServerContextBase *server_context,
+    bool propagate_cancellation,
+    const std::string &method,
+    const grpc::ByteBuffer &request,
+    grpc::ByteBuffer *response
+) {
+    // Only the calls which really go upstream are limited: a slow upstream must not
+    // pile up all the server threads waiting for it
+    AdmissionController::Permit permit;
+    auto status = m_admission_controller->admit(server_context, method, permit);
+    if (!status.ok()) return status;
+
+    status = forwardHedged(server_context, propagate_cancellation, method, request, response);
+    permit.setStatus(status);
+    return status;
+}
+
+grpc::Status UpstreamProxy::forwardHedged(
+    grpc::ServerContextBase *server_context,
+    bool propagate_cancellation,
+    const std::string &method,
+    const grpc::ByteBuffer &request,
+    grpc::ByteBuffer *response
+) {
+    bool hedging_enabled = false;
+    auto hedging_delay = hedgingDelay(method, hedging_enabled);
+
+    auto call = std::make_shared<HedgedCall>();
+    auto method_path = "/" + method;
+
+    // The hedged attempt goes to another endpoint of the group, if there is one
+    std::shared_ptr<UpstreamRouter::Endpoint> first_endpoint;
+    auto start_attempt = [&](int index) {
+        auto &attempt = call->attempts[index];
+        attempt.context = createClientContext(server_context, propagate_cancellation);
+        attempt.started_at = std::chrono::steady_clock::now();
+
+        auto endpoint = m_router->pick(method, first_endpoint.get());
+        if (index == 0) first_endpoint = endpoint;
+        auto stub = endpoint ? endpoint->stub.get() : m_stub.get();
+        stub->UnaryCall(
+            attempt.context.get(),
+            method_path,
+            grpc::StubOptions(),
+            &request,
+            &attempt.response,
+            [call, index, endpoint, router = m_router](grpc::Status status) {
+                if (endpoint) {
+                    auto latency = std::chrono::steady_clock::now() - call->attempts[index].started_at;
+                    router->release(endpoint, std::chrono::duration_cast<std::chrono::microseconds>(latency), status);
+                }
+
+                std::lock_guard<std::mutex> lock(call->mutex);
+                auto &attempt = call->attempts[index];
+                attempt.status = std::move(status);
+                attempt.finished_at = std::chrono::steady_clock::now();
+                attempt.finished = true;
+                call->finished++;
+                if (call->winner < 0 && (isCommittable(attempt.status)
+                    || (call->finished == call->started && !call->hedge_pending))) {
+                    call->winner = index;
+                }
+                call->finished_cv.notify_all();
+            }
+        );
+    };
+
+    call->started = 1;
+    call->hedge_pending = hedging_enabled;
+    start_attempt(0);
+
+    AdmissionController::Permit hedge_permit;
+    std::vector<grpc::ClientContext*> losers;
+    int winner = -1;
+    int started = 0;
+    {
+        std::unique_lock<std::mutex> lock(call->mutex);
+        auto has_winner = [&call]() { return call->winner >= 0; };
+        if (hedging_enabled) {
+            // The hedge goes as soon as the first attempt failed with a non-fatal status, not after the delay
+            auto first_failed = [&call]() { return call->finished == call->started; };
+            call->finished_cv.wait_for(lock, hedging_delay, [&]() { return has_winner() || first_failed(); });
+            // The hedged attempt is an upstream call of its own, so it is only sent if the limits allow it now
+            if (!has_winner() && !m_admission_controller->tryAdmit(method, hedge_permit)) {
+                GMS_LOG_DEBUG_RATE_LIMITED(
+                    LogCategory::Upstream,
+                    10,
+                    "Hedged attempt of '{}' is not sent: concurrency limit reached",
+                    method
+                );
+                call->hedge_pending = false;
+                // A failed first attempt is final now, its callback has already run
+                if (first_failed()) call->winner = 0;
+            }
+            else if (!has_winner()) {
+                GMS_LOG_DEBUG_RATE_LIMITED(
+                    LogCategory::Upstream,
+                    10,
+                    "Sending a hedged attempt of '{}' (first attempt failed: {}, delay {} ms)",
+                    method,
+                    first_failed(),
+                    hedging_delay.count()
+                );
+                call->started = 2;
+                call->hedge_pending = false;
+                lock.unlock();
+                start_attempt(1);
+                lock.lock();
+            }
+            else {
+                call->hedge_pending = false;
+            }
+        }
+        call->finished_cv.wait(lock, has_winner);
+
+        winner = call->winner;
+        started = call->started;
+        for (int i = 0; i < started; ++i) {
+            if (i != winner && !call->attempts[i].finished) losers.push_back(call->attempts[i].context.get());
+        }
+        // An overloaded upstream shrinks the limits through the hedged attempt too
+        if (started > 1 && call->attempts[1].finished) hedge_permit.setStatus(call->attempts[1].status);
+    }
+
+    // Cancellation may complete the call inline, so it must be done without the lock held
+    for (auto loser : losers) loser->TryCancel();
+
+    const auto &attempt = call->attempts[winner];
+    recordCall(
+        method,
+        std::chrono::duration_cast<std::chrono::microseconds>(attempt.finished_at - attempt.started_at),
+        started > 1,
+        winner > 0
+    );
+
+    if (!attempt.status.ok()) {
+        recordFailure(method);
+        return attempt.status;
+    }
+
+    *response = attempt.response;
+    return attempt.status;
+}
+
+grpc::Status grpcMockServerForwardCall(
+    grpc::ServerContext *server_context,
+    const std::string &method,
+    const google::protobuf::Message &request,
+    google::protobuf::Message *response
+) {
+    using MessageSerializationTraits = grpc::SerializationTraits<google::protobuf::Message>;
+
+    grpc::ByteBuffer request_buffer;
+    bool own_buffer = false;
+    auto status = MessageSerializationTraits::Serialize(request, &request_buffer, &own_buffer);
+    if (!status.ok()) return status;
+
+    grpc::ByteBuffer response_buffer;
+    status = BusinessLogic::getInstance().upstreamProxy().forward(
+        server_context,
+        method,
+        request_buffer,
+        &response_buffer
+    );
+    if (!status.ok()) return status;
+
+    return MessageSerializationTraits::Deserialize(&response_buffer, response);
+}
@@ -0,0 +1,146 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_UPSTREAM_PROXY_H
+#define GRPC_MOCK_SERVER_UPSTREAM_PROXY_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <condition_variable>
+#include <unordered_map>
+
+#include <grpc++/grpc++.h>
+#include <grpcpp/generic/generic_stub.h>
+
+#include "grpc_mock_server_library.h"
+
+namespace google::protobuf { class Message; }
+class AdmissionController;
+class UpstreamRouter;
+
+/// <summary>
+/// Forwards the calls received by the mock server to the upstream server.
+/// The upstream call inherits the deadline and the cancellation of the incoming call,
+/// and may be hedged: if no reply came after a configured delay, a second attempt is sent
+/// and the first reply wins. Identical concurrent calls of the opted-in methods are coalesced
+/// into a single upstream call. The routed methods go to the endpoint picked by the router
+/// for every attempt, the rest to the default upstream channel
+/// </summary>
+class UpstreamProxy {
+    struct HedgingPolicy {
+        std::chrono::milliseconds delay { 0 };
+        double delay_percentile = 0.0;
+    };
+
+    // Upstream call shared by the identical concurrent calls
+    struct Flight {
+        std::string method;
+        std::string request;
+        // Guarded by the flights mutex; only the followers of this flight are woken up
+        std::condition_variable finished_cv;
+        bool finished = false;
+        grpc::Status status;
+        grpc::ByteBuffer response;
+    };
+
+    struct MethodState {
+        HedgingPolicy hedging_policy;
+        bool hedging_enabled = false;
+        bool coalescing_enabled = false;
+
+        // Recent upstream latencies, used to derive the hedging delay from a percentile
+        std::vector<std::chrono::microseconds> latencies;
+        size_t next_latency_index = 0;
+        // The percentile is recomputed every few calls, not by every call
+        std::chrono::milliseconds percentile_delay { 0 };
+        bool has_percentile_delay = false;
+        size_t latencies_since_update = 0;
+
+        grpc_mock_server::UpstreamStatistics statistics;
+    };
+
+    AdmissionController *m_admission_controller;
+    UpstreamRouter *m_router;
+    std::shared_ptr<grpc::Channel> m_channel;
+    std::unique_ptr<grpc::GenericStub> m_stub;
+
+    mutable std::mutex m_methods_mutex;
+    std::unordered_map<std::string, MethodState> m_methods;
+
+    std::mutex m_flights_mutex;
+    std::unordered_multimap<uint64_t, std::shared_ptr<Flight>> m_flights;
+
+    bool isCoalescingEnabled(const std::string &method) const;
+    std::chrono::milliseconds hedgingDelay(const std::string &method, bool &hedging_enabled);
+    void recordCall(const std::string &method, std::chrono::microseconds latency, bool hedged, bool hedge_won);
+    void recordFailure(const std::string &method);
+    void recordCoalescedCall(const std::string &method);
+
+    grpc::Status forwardCoalesced(
+        grpc::ServerContextBase *server_context,
+        const std::string &method,
+        const grpc::ByteBuffer &request,
+        grpc::ByteBuffer *response
+    );
+    grpc::Status forwardAdmitted(
+        grpc::ServerContextBase *server_context,
+        bool propagate_cancellation,
+        const std::string &method,
+        const grpc::ByteBuffer &request,
+        grpc::ByteBuffer *response
+    );
+    grpc::Status forwardHedged(
+        grpc::ServerContextBase *server_context,
+        bool propagate_cancellation,
+        const std::string &method,
+        const grpc::ByteBuffer &request,
+        grpc::ByteBuffer *response
+    );
+
+public:
+    UpstreamProxy(AdmissionController *admission_controller, UpstreamRouter *router);
+
+    UpstreamProxy(const UpstreamProxy&) = delete;
+    UpstreamProxy &operator=(const UpstreamProxy&) = delete;
+
+    void setChannel(const std::shared_ptr<grpc::Channel> &channel);
+    void setHedgingPolicy(const std::string &method, int delay_ms, double delay_percentile);
+    void setCoalescingEnabled(const std::string &method, bool enabled);
+    grpc_mock_server::UpstreamStatistics statistics(const std::string &method) const;
+
+    // `method` is a full method name like "package.Service/Method"
+    grpc::Status forward(
+        grpc::ServerContextBase *server_context,
+        const std::string &method,
+        const grpc::ByteBuffer &request,
+        grpc::ByteBuffer *response
+    );
+};
+
+// This function will be called by protobuf compiler generated code instead of calling the upstream stub
+grpc::Status grpcMockServerForwardCall(
+    grpc::ServerContext *server_context,
+    const std::string &method,
+    const google::protobuf::Message &request,
+    google::protobuf::Message *response
+);
+
+#endif // GRPC_MOCK_SERVER_UPSTREAM_PROXY_H
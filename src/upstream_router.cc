@@ -0,0 +1,357 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "upstream_router.h"
+
+#include <cmath>
+#include <cassert>
+#include <limits>
+#include <algorithm>
+
+#include <pugixml.hpp>
+
+#include <grpc_mock_server_logger.h>
+
+namespace {
+
+// Latency EWMA decay time: older observations lose weight with e^(-elapsed / decay)
+constexpr double LATENCY_DECAY_US = 10.0 * 1000 * 1000;
+// Repeated ejections of the same endpoint last longer, up to this many times the ejection time
+constexpr int MAX_EJECTION_MULTIPLIER = 10;
+
+bool matchesPrefix(const std::string &method, const std::string &prefix) {
+    if (method.size() < prefix.size() || method.compare(0, prefix.size(), prefix) != 0) return false;
+    if (method.size() == prefix.size()) return true;
+
+    // "package" must not match "packageX.Service/Method"
+    auto next = method[prefix.size()];
+    return next == '.' || next == '/';
+}
+
+// Only the failures telling about the endpoint itself, not about the request
+bool isEndpointFailure(const grpc::Status &status) {
+    return status.error_code() == grpc::StatusCode::UNAVAILABLE
+        || status.error_code() == grpc::StatusCode::DEADLINE_EXCEEDED
+        || status.error_code() == grpc::StatusCode::RESOURCE_EXHAUSTED;
+}
+
+} // anonymous namespace
+
+UpstreamRouter::UpstreamRouter(ChannelFactory channel_factory)
+    : m_channel_factory(std::move(channel_factory)) {
+    assert(m_channel_factory);
+}
+
+bool UpstreamRouter::addGroup(const std::string &name, const std::vector<std::string> &targets) {
+    if (name.empty() || targets.empty()) {
+        SystemLogger->error("Upstream group must have a name and at least one endpoint");
+        return false;
+    }
+
+    auto group = createGroup(targets);
+
+    std::unique_lock<std::shared_mutex> lock(m_config_mutex);
+    if (m_groups.count(name) > 0) {
+        SystemLogger->error("Upstream group '{}' already exists", name);
+        return false;
+    }
+    m_groups.emplace(name, std::move(group));
+
+    SystemLogger->info("Upstream group '{}' added: {} endpoints", name, targets.size());
+    return true;
+}
+
+bool UpstreamRouter::addRoute(const std::string &prefix, const std::string &group_name) {
+    std::unique_lock<std::shared_mutex> lock(m_config_mutex);
+    auto iter = m_groups.find(group_name);
+    if (prefix.empty() || iter == m_groups.end()) {
+        SystemLogger->error("Unable to add upstream route '{}': unknown group '{}'", prefix, group_name);
+        return false;
+    }
+
+    m_routes.push_back({ prefix, iter->second });
+    sortRoutes(m_routes);
+
+    SystemLogger->info("Calls of '{}' are routed to upstream group '{}'", prefix, group_name);
+    return true;
+}
+
+void UpstreamRouter::setEjectionPolicy(int max_consecutive_failures, int ejection_time_ms) {
+    assert(max_consecutive_failures > 0);
+    assert(ejection_time_ms >= 0);
+
+    std::unique_lock<std::shared_mutex> lock(m_config_mutex);
+    m_max_consecutive_failures = max_consecutive_failures;
+    m_ejection_time = std::chrono::milliseconds(ejection_time_ms);
+}
+
+bool UpstreamRouter::parseXml(const std::string &data, std::string &error) {
+    pugi::xml_document doc;
+    pugi::xml_parse_result parser_result = doc.load_buffer(data.data(), data.size());
+    if (!parser_result) {
+        error = parser_result.description();
+        return false;
+    }
+
+    auto upstreams_node = doc.child("root").child("upstreams");
+    if (!upstreams_node) upstreams_node = doc.child("upstreams");
+    if (!upstreams_node) {
+        error = "<upstreams> element not found";
+        return false;
+    }
+
+    auto max_consecutive_failures = upstreams_node.attribute("consecutive_failures").as_int(5);
+    auto ejection_time_ms = upstreams_node.attribute("ejection_time_ms").as_int(30000);
+    if (max_consecutive_failures <= 0 || ejection_time_ms < 0) {
+        error = "invalid ejection policy";
+        return false;
+    }
+
+    // Built aside and swapped in only when valid, so a bad configuration leaves the current one working
+    std::unordered_map<std::string, std::shared_ptr<Group>> groups;
+    for (auto group_node : upstreams_node.children("group")) {
+        std::string group_name = group_node.attribute("name").as_string();
+        std::vector<std::string> targets;
+        for (auto endpoint_node : group_node.children("endpoint")) {
+            targets.push_back(endpoint_node.attribute("target").as_string());
+        }
+        if (group_name.empty() || targets.empty() || groups.count(group_name) > 0) {
+            error = "invalid group '" + group_name + "'";
+            return false;
+        }
+        groups.emplace(group_name, createGroup(targets));
+    }
+
+    std::vector<Route> routes;
+    for (auto route_node : upstreams_node.children("route")) {
+        std::string prefix = route_node.attribute("prefix").as_string();
+        std::string group_name = route_node.attribute("group").as_string();
+        auto iter = groups.find(group_name);
+        if (prefix.empty() || iter == groups.end()) {
+            error = "invalid route '" + prefix + "'";
+            return false;
+        }
+        routes.push_back({ prefix, iter->second });
+    }
+    sortRoutes(routes);
+
+    auto group_count = groups.size();
+    auto route_count = routes.size();
+    {
+        // The endpoints of the calls in progress stay alive until released
+        std::unique_lock<std::shared_mutex> lock(m_config_mutex);
+        m_groups.swap(groups);
+        m_routes.swap(routes);
+        m_max_consecutive_failures = max_consecutive_failures;
+        m_ejection_time = std::chrono::milliseconds(ejection_time_ms);
+    }
+
+    SystemLogger->info("Upstream configuration loaded: {} groups, {} routes", group_count, route_count);
+    return true;
+}
+
+void UpstreamRouter::clear() {
+    // The endpoints of the calls in progress stay alive until released
+    std::unique_lock<std::shared_mutex> lock(m_config_mutex);
+    m_routes.clear();
+    m_groups.clear();
+}
+
+std::shared_ptr<UpstreamRouter::Group> UpstreamRouter::createGroup(const std::vector<std::string> &targets) {
+    auto group = std::make_shared<Group>();
+    for (const auto &target : targets) {
+        auto endpoint = std::make_shared<Endpoint>();
+        endpoint->target = target;
+        group->endpoints.push_back(std::move(endpoint));
+    }
+    return group;
+}
+
+void UpstreamRouter::sortRoutes(std::vector<Route> &routes) {
+    std::stable_sort(routes.begin(), routes.end(), [](const Route &lhs, const Route &rhs) {
+        return lhs.prefix.size() > rhs.prefix.size();
+    });
+}
+
+std::shared_ptr<UpstreamRouter::Group> UpstreamRouter::findGroup(const std::string &method) const {
+    std::shared_lock<std::shared_mutex> lock(m_config_mutex);
+    for (const auto &route : m_routes) {
+        if (matchesPrefix(method, route.prefix)) return route.group;
+    }
+    return nullptr;
+}
+
+void UpstreamRouter::createChannels(Group &group) {
+    // Channels are created on the first use (or the warm-up), when the credentials are surely set
+    for (auto &endpoint : group.endpoints) {
+        if (!endpoint->channel) {
+            endpoint->channel = m_channel_factory(endpoint->target);
+            endpoint->stub = std::make_unique<grpc::GenericStub>(endpoint->channel);
+        }
+    }
+}
+
+std::vector<std::shared_ptr<grpc::Channel>> UpstreamRouter::channels() {
+    std::vector<std::shared_ptr<Group>> groups;
+    {
+        std::shared_lock<std::shared_mutex> lock(m_config_mutex);
+        for (const auto &[name, group] : m_groups) groups.push_back(group);
+    }
+
+    std::vector<std::shared_ptr<grpc::Channel>> result;
+    for (const auto &group : groups) {
+        std::lock_guard<std::mutex> lock(group->mutex);
+        createChannels(*group);
+        for (const auto &endpoint : group->endpoints) result.push_back(endpoint->channel);
+    }
+    return result;
+}
+
+std::shared_ptr<UpstreamRouter::Endpoint> UpstreamRouter::pick(const std::string &method, const Endpoint *exclude) {
+    auto group = findGroup(method);
+    if (!group) return nullptr;
+
+    size_t start_index = 0;
+    {
+        std::lock_guard<std::mutex> lock(group->mutex);
+        // Rotate the scan start, so that the endpoints with equal scores share the load
+        start_index = group->next_index++ % group->endpoints.size();
+
+        createChannels(*group);
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    std::shared_ptr<Endpoint> best;
+    double best_score = std::numeric_limits<double>::max();
+    // Used only if every endpoint is ejected: better to try one than to fail the call
+    std::shared_ptr<Endpoint> earliest_ejected;
+    auto earliest_ejected_until = std::chrono::steady_clock::time_point::max();
+
+    auto count = group->endpoints.size();
+    for (size_t i = 0; i < count; ++i) {
+        const auto &endpoint = group->endpoints[(start_index + i) % count];
+        if (endpoint.get() == exclude && count > 1) continue;
+
+        std::lock_guard<std::mutex> lock(endpoint->mutex);
+        if (endpoint->ejected_until > now) {
+            if (endpoint->ejected_until < earliest_ejected_until) {
+                earliest_ejected_until = endpoint->ejected_until;
+                earliest_ejected = endpoint;
+            }
+            continue;
+        }
+
+        // Endpoints without a latency yet are tried first
+        double score = endpoint->has_latency
+            ? endpoint->latency_ewma_us * static_cast<double>(endpoint->outstanding + 1)
+            : 0.0;
+        if (score < best_score) {
+            best_score = score;
+            best = endpoint;
+        }
+    }
+
+    if (!best) best = earliest_ejected;
+    if (!best) return nullptr;
+
+    std::lock_guard<std::mutex> lock(best->mutex);
+    best->outstanding++;
+    best->statistics.in_flight = best->outstanding;
+    return best;
+}
+
+void UpstreamRouter::release(
+    const std::shared_ptr<Endpoint> &endpoint,
+    std::chrono::microseconds latency,
+    const grpc::Status &status
+) {
+    assert(endpoint);
+
+    int max_consecutive_failures = 0;
+    std::chrono::milliseconds ejection_time;
+    {
+        std::shared_lock<std::shared_mutex> lock(m_config_mutex);
+        max_consecutive_failures = m_max_consecutive_failures;
+        ejection_time = m_ejection_time;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(endpoint->mutex);
+    assert(endpoint->outstanding > 0);
+    endpoint->outstanding--;
+    endpoint->statistics.in_flight = endpoint->outstanding;
+    endpoint->statistics.calls++;
+
+    // Cancelled calls (e.g. the hedging losers) tell nothing about the endpoint
+    if (status.error_code() == grpc::StatusCode::CANCELLED) return;
+
+    // Peak-sensitive EWMA: a slower observation is taken at once, faster ones are averaged in
+    auto latency_us = static_cast<double>(latency.count());
+    if (!endpoint->has_latency || latency_us > endpoint->latency_ewma_us) {
+        endpoint->latency_ewma_us = latency_us;
+        endpoint->has_latency = true;
+    }
+    else {
+        auto elapsed_us = static_cast<double>(
+            std::chrono::duration_cast<std::chrono::microseconds>(now - endpoint->last_update_at).count()
+        );
+        auto weight = std::exp(-elapsed_us / LATENCY_DECAY_US);
+        endpoint->latency_ewma_us = endpoint->latency_ewma_us * weight + latency_us * (1.0 - weight);
+    }
+    endpoint->last_update_at = now;
+    endpoint->statistics.latency_ewma_us = endpoint->latency_ewma_us;
+
+    if (!isEndpointFailure(status)) {
+        endpoint->consecutive_failures = 0;
+        endpoint->consecutive_ejections = 0;
+        endpoint->statistics.ejected = false;
+        return;
+    }
+
+    endpoint->statistics.failed_calls++;
+    if (++endpoint->consecutive_failures < max_consecutive_failures) return;
+
+    // Once back from the ejection a single failure ejects the endpoint again, for longer
+    endpoint->consecutive_failures = max_consecutive_failures - 1;
+    endpoint->consecutive_ejections = std::min(endpoint->consecutive_ejections + 1, MAX_EJECTION_MULTIPLIER);
+    endpoint->ejected_until = now + ejection_time * endpoint->consecutive_ejections;
+    endpoint->statistics.ejections++;
+    endpoint->statistics.ejected = true;
+
+    SystemLogger->warn(
+        "Upstream endpoint '{}' ejected for {} ms after {} consecutive failures",
+        endpoint->target,
+        (ejection_time * endpoint->consecutive_ejections).count(),
+        max_consecutive_failures
+    );
+}
+
+grpc_mock_server::UpstreamEndpointStatistics UpstreamRouter::statistics(const std::string &target) const {
+    std::shared_lock<std::shared_mutex> lock(m_config_mutex);
+    for (const auto &[name, group] : m_groups) {
+        for (const auto &endpoint : group->endpoints) {
+            if (endpoint->target != target) continue;
+
+            std::lock_guard<std::mutex> endpoint_lock(endpoint->mutex);
+            auto result = endpoint->statistics;
+            result.ejected = endpoint->ejected_until > std::chrono::steady_clock::now();
+            return result;
+        }
+    }
+    return grpc_mock_server::UpstreamEndpointStatistics();
+}
@@ -0,0 +1,116 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_UPSTREAM_ROUTER_H
+#define GRPC_MOCK_SERVER_UPSTREAM_ROUTER_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+
+#include <grpc++/grpc++.h>
+#include <grpcpp/generic/generic_stub.h>
+
+#include "grpc_mock_server_library.h"
+
+/// <summary>
+/// Routes the upstream calls by package or service to the named groups of endpoints.
+/// Within a group every attempt goes to the endpoint with the lowest latency EWMA multiplied
+/// by the number of its outstanding calls, so that the slow and the busy endpoints get less traffic.
+/// An endpoint failing several times in a row is ejected from the rotation for a while.
+/// The methods without a route use the default upstream channel
+/// </summary>
+class UpstreamRouter {
+public:
+    using ChannelFactory = std::function<std::shared_ptr<grpc::Channel>(const std::string &target)>;
+
+    struct Endpoint {
+        std::string target;
+        std::shared_ptr<grpc::Channel> channel;
+        std::unique_ptr<grpc::GenericStub> stub;
+
+        std::mutex mutex;
+        // The fields below are guarded by the mutex
+        uint64_t outstanding = 0;
+        double latency_ewma_us = 0.0;
+        bool has_latency = false;
+        std::chrono::steady_clock::time_point last_update_at;
+        int consecutive_failures = 0;
+        int consecutive_ejections = 0;
+        std::chrono::steady_clock::time_point ejected_until;
+        grpc_mock_server::UpstreamEndpointStatistics statistics;
+    };
+
+private:
+    struct Group {
+        std::mutex mutex;
+        std::vector<std::shared_ptr<Endpoint>> endpoints;
+        size_t next_index = 0;
+    };
+
+    struct Route {
+        std::string prefix;
+        std::shared_ptr<Group> group;
+    };
+
+    ChannelFactory m_channel_factory;
+
+    mutable std::shared_mutex m_config_mutex;
+    std::unordered_map<std::string, std::shared_ptr<Group>> m_groups;
+    // Sorted by the prefix length, longest first
+    std::vector<Route> m_routes;
+    int m_max_consecutive_failures = 5;
+    std::chrono::milliseconds m_ejection_time { 30000 };
+
+    static std::shared_ptr<Group> createGroup(const std::vector<std::string> &targets);
+    static void sortRoutes(std::vector<Route> &routes);
+
+    std::shared_ptr<Group> findGroup(const std::string &method) const;
+    // Must be called with the group mutex locked
+    void createChannels(Group &group);
+
+public:
+    explicit UpstreamRouter(ChannelFactory channel_factory);
+
+    UpstreamRouter(const UpstreamRouter&) = delete;
+    UpstreamRouter &operator=(const UpstreamRouter&) = delete;
+
+    bool addGroup(const std::string &name, const std::vector<std::string> &targets);
+    // `prefix` is a package ("package"), a service ("package.Service") or a method ("package.Service/Method")
+    bool addRoute(const std::string &prefix, const std::string &group_name);
+    void setEjectionPolicy(int max_consecutive_failures, int ejection_time_ms);
+    // Replaces the whole configuration; it is left untouched if the data is invalid
+    bool parseXml(const std::string &data, std::string &error);
+    void clear();
+
+    // Returns nullptr if the method has no route; `exclude` is the endpoint of the previous attempt, if any.
+    // Every picked endpoint must be reported back with `release`
+    std::shared_ptr<Endpoint> pick(const std::string &method, const Endpoint *exclude);
+    void release(const std::shared_ptr<Endpoint> &endpoint, std::chrono::microseconds latency, const grpc::Status &status);
+
+    grpc_mock_server::UpstreamEndpointStatistics statistics(const std::string &target) const;
+    // Channels of all the endpoints, created now if they were not used yet
+    std::vector<std::shared_ptr<grpc::Channel>> channels();
+};
+
+#endif // GRPC_MOCK_SERVER_UPSTREAM_ROUTER_H
@@ -0,0 +1,221 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "warm_up.h"
+#include "tls_session.h"
+#include "event_logger.h"
+
+#include <mutex>
+#include <random>
+#include <algorithm>
+#include <condition_variable>
+
+#include <grpcpp/generic/generic_stub.h>
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/util/json_util.h>
+
+#include <grpc_mock_server_logger.h>
+
+namespace {
+
+// Size of the random value of the warm-up metadata
+constexpr size_t WARM_UP_TOKEN_BYTES = 16;
+
+thread_local bool t_warm_up_call = false;
+
+// The metadata key alone can be sent by any client to skip the history, the capture and the upstream,
+// so the value must match the one generated by this process
+const std::string &warmUpToken() {
+    static const std::string token = []() {
+        static const char HEX_DIGITS[] = "0123456789abcdef";
+        std::random_device random;
+        std::string result;
+        result.reserve(WARM_UP_TOKEN_BYTES * 2);
+        for (size_t i = 0; i < WARM_UP_TOKEN_BYTES; ++i) {
+            auto byte = random() & 0xFF;
+            result.push_back(HEX_DIGITS[byte >> 4]);
+            result.push_back(HEX_DIGITS[byte & 0x0F]);
+        }
+        return result;
+    }();
+    return token;
+}
+
+const google::protobuf::MethodDescriptor *findMethod(const std::string &method) {
+    // Descriptors use dots only: "package.Service.Method"
+    std::string descriptor_name = method;
+    std::replace(descriptor_name.begin(), descriptor_name.end(), '/', '.');
+    return google::protobuf::DescriptorPool::generated_pool()->FindMethodByName(descriptor_name);
+}
+
+void warmUpMessageType(const google::protobuf::Descriptor *descriptor) {
+    auto prototype = google::protobuf::MessageFactory::generated_factory()->GetPrototype(descriptor);
+    if (prototype == nullptr) return;
+
+    // Both directions of the JSON conversion resolve the type on their first use
+    std::string json;
+    auto status = google::protobuf::util::MessageToJsonString(*prototype, &json);
+    if (!status.ok()) return;
+
+    std::unique_ptr<google::protobuf::Message> message(prototype->New());
+    status = google::protobuf::util::JsonStringToMessage(json, message.get());
+    if (!status.ok()) {
+        GMS_LOG_DEBUG(LogCategory::Config, "JSON conversion of '{}' failed during warm-up", descriptor->full_name());
+    }
+}
+
+} // anonymous namespace
+
+const char WARM_UP_METADATA_KEY[] = "x-gms-warm-up";
+
+bool isWarmUpCall(const grpc::ServerContextBase *server_context) {
+    if (server_context == nullptr) return false;
+    const auto &metadata = server_context->client_metadata();
+    auto iter = metadata.find(WARM_UP_METADATA_KEY);
+    if (iter == metadata.end()) return false;
+    const auto &token = warmUpToken();
+    return iter->second.size() == token.size() && std::equal(token.begin(), token.end(), iter->second.begin());
+}
+
+void markWarmUpCall(const grpc::ServerContextBase *server_context) {
+    t_warm_up_call = isWarmUpCall(server_context);
+}
+
+bool isCurrentCallWarmUp() {
+    return t_warm_up_call;
+}
+
+bool createWarmUpRequest(
+    const std::string &method,
+    const std::string &request_json,
+    WarmUpRequest &request,
+    std::string &error
+) {
+    auto method_descriptor = findMethod(method);
+    if (method_descriptor == nullptr) {
+        error = "unknown method '" + method + "'";
+        return false;
+    }
+    auto prototype = google::protobuf::MessageFactory::generated_factory()->GetPrototype(method_descriptor->input_type());
+    if (prototype == nullptr) {
+        error = "no generated message for '" + method_descriptor->input_type()->full_name() + "'";
+        return false;
+    }
+
+    std::unique_ptr<google::protobuf::Message> message(prototype->New());
+    auto status = google::protobuf::util::JsonStringToMessage(request_json, message.get());
+    if (!status.ok()) {
+        error = "request doesn't match '" + method_descriptor->input_type()->full_name() + "': " + std::string(status.message());
+        return false;
+    }
+
+    request.method = method;
+    if (!message->SerializeToString(&request.payload)) {
+        error = "unable to serialize the request";
+        return false;
+    }
+    return true;
+}
+
+size_t warmUpMessageTypes(const std::vector<std::string> &methods) {
+    size_t found = 0;
+    for (const auto &method : methods) {
+        auto method_descriptor = findMethod(method);
+        if (method_descriptor == nullptr) continue;
+
+        warmUpMessageType(method_descriptor->input_type());
+        warmUpMessageType(method_descriptor->output_type());
+        ++found;
+    }
+    return found;
+}
+
+size_t connectChannels(
+    TlsSessionTracker &tls_session_tracker,
+    const std::vector<std::shared_ptr<grpc::Channel>> &channels,
+    std::chrono::milliseconds timeout
+) {
+    // Start connecting all of them before waiting for the first one
+    for (const auto &channel : channels) {
+        channel->GetState(true);
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    size_t connected = 0;
+    for (const auto &channel : channels) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (tls_session_tracker.waitForConnected(channel, std::max(remaining, std::chrono::milliseconds(0)))) {
+            ++connected;
+        }
+    }
+    return connected;
+}
+
+size_t sendWarmUpRequests(
+    const std::shared_ptr<grpc::Channel> &channel,
+    const std::vector<WarmUpRequest> &requests,
+    std::chrono::milliseconds timeout
+) {
+    struct Call {
+        grpc::ClientContext context;
+        grpc::ByteBuffer request;
+        grpc::ByteBuffer response;
+    };
+
+    std::mutex mutex;
+    std::condition_variable finished_cv;
+    size_t finished = 0;
+    size_t succeeded = 0;
+
+    grpc::GenericStub stub(channel);
+    auto deadline = std::chrono::system_clock::now() + timeout;
+    std::vector<std::unique_ptr<Call>> calls;
+    for (const auto &request : requests) {
+        auto call = std::make_unique<Call>();
+        call->context.set_deadline(deadline);
+        call->context.AddMetadata(WARM_UP_METADATA_KEY, warmUpToken());
+        grpc::Slice slice(request.payload);
+        grpc::ByteBuffer buffer(&slice, 1);
+        call->request.Swap(&buffer);
+
+        stub.UnaryCall(
+            &call->context,
+            "/" + request.method,
+            grpc::StubOptions(),
+            &call->request,
+            &call->response,
+            [&, method = request.method](grpc::Status status) {
+                if (!status.ok()) {
+                    GMS_LOG_WARN(LogCategory::Rpc, "Warm-up request of '{}' failed: {}", method, status.error_message());
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                if (status.ok()) ++succeeded;
+                ++finished;
+                finished_cv.notify_all();
+            }
+        );
+        calls.push_back(std::move(call));
+    }
+
+    // The deadline finishes every call, so the callbacks never outlive the locals
+    std::unique_lock<std::mutex> lock(mutex);
+    finished_cv.wait(lock, [&]() { return finished == calls.size(); });
+    return succeeded;
+}
@@ -0,0 +1,79 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_WARM_UP_H
+#define GRPC_MOCK_SERVER_WARM_UP_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+
+#include <grpc++/grpc++.h>
+
+class TlsSessionTracker;
+
+// The first call of a method otherwise pays for the upstream connection and TLS handshake,
+// the descriptor lookups, the message prototypes and the JSON converter type resolution.
+// These functions do it all before the server reports being started
+
+struct WarmUpRequest {
+    // Full method name like "package.Service/Method"
+    std::string method;
+    // Request message in the protobuf wire format
+    std::string payload;
+};
+
+// Converts the JSON request of the method, validating it against the generated message descriptor
+bool createWarmUpRequest(
+    const std::string &method,
+    const std::string &request_json,
+    WarmUpRequest &request,
+    std::string &error
+);
+
+// Returns the number of methods found in the generated descriptor pool
+size_t warmUpMessageTypes(const std::vector<std::string> &methods);
+
+// All the channels connect at once; returns the number of them connected within `timeout`
+size_t connectChannels(
+    TlsSessionTracker &tls_session_tracker,
+    const std::vector<std::shared_ptr<grpc::Channel>> &channels,
+    std::chrono::milliseconds timeout
+);
+
+// Client metadata key of the warm-up calls: they are answered by the server itself,
+// without being recorded in the history, captured or forwarded upstream.
+// Its value is a random token of the process, so that the other clients can't tag their calls
+extern const char WARM_UP_METADATA_KEY[];
+
+bool isWarmUpCall(const grpc::ServerContextBase *server_context);
+// The generated handlers report the history without the server context, so the request callback
+// marks the thread handling the call instead
+void markWarmUpCall(const grpc::ServerContextBase *server_context);
+bool isCurrentCallWarmUp();
+
+// Sends all the requests at once, tagged as the warm-up calls;
+// returns the number of them answered with OK within `timeout`
+size_t sendWarmUpRequests(
+    const std::shared_ptr<grpc::Channel> &channel,
+    const std::vector<WarmUpRequest> &requests,
+    std::chrono::milliseconds timeout
+);
+
+#endif // GRPC_MOCK_SERVER_WARM_UP_H
@@ -0,0 +1,208 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <thread>
+#include <chrono>
+
+#include <gtest/gtest.h>
+
+#include "admission_control.h"
+
+namespace {
+
+const auto NO_DEADLINE = std::chrono::system_clock::time_point::max();
+const auto LATENCY = std::chrono::microseconds(1000);
+
+} // anonymous namespace
+
+TEST(ConcurrencyLimiterTest, RejectsBeyondLimit) {
+    ConcurrencyLimiter limiter(2, 1, 10, false, 0, std::chrono::milliseconds(0));
+
+    EXPECT_TRUE(limiter.acquire(NO_DEADLINE));
+    EXPECT_TRUE(limiter.acquire(NO_DEADLINE));
+    EXPECT_FALSE(limiter.acquire(NO_DEADLINE));
+
+    limiter.cancel();
+    EXPECT_TRUE(limiter.acquire(NO_DEADLINE));
+
+    auto statistics = limiter.statistics();
+    EXPECT_EQ(statistics.in_flight, 2u);
+    EXPECT_EQ(statistics.admitted, 3u);
+    EXPECT_EQ(statistics.rejected, 1u);
+}
+
+TEST(ConcurrencyLimiterTest, FixedLimitNotAdapted) {
+    ConcurrencyLimiter limiter(4, 4, 4, false, 0, std::chrono::milliseconds(0));
+
+    ASSERT_TRUE(limiter.acquire(NO_DEADLINE));
+    limiter.release(LATENCY, true);
+
+    EXPECT_DOUBLE_EQ(limiter.statistics().limit, 4.0);
+}
+
+TEST(ConcurrencyLimiterTest, LimitGrowsAdditively) {
+    ConcurrencyLimiter limiter(4, 1, 10, true, 0, std::chrono::milliseconds(0));
+    for (int i = 0; i < 4; ++i) ASSERT_TRUE(limiter.acquire(NO_DEADLINE));
+
+    limiter.release(LATENCY, false);
+    EXPECT_DOUBLE_EQ(limiter.statistics().limit, 4.25);
+}
+
+TEST(ConcurrencyLimiterTest, LimitGrowthCapped) {
+    ConcurrencyLimiter limiter(4, 1, 4, true, 0, std::chrono::milliseconds(0));
+    for (int i = 0; i < 4; ++i) ASSERT_TRUE(limiter.acquire(NO_DEADLINE));
+
+    limiter.release(LATENCY, false);
+    EXPECT_DOUBLE_EQ(limiter.statistics().limit, 4.0);
+}
+
+TEST(ConcurrencyLimiterTest, IdleLimitNotGrown) {
+    ConcurrencyLimiter limiter(10, 1, 20, true, 0, std::chrono::milliseconds(0));
+
+    ASSERT_TRUE(limiter.acquire(NO_DEADLINE));
+    limiter.release(LATENCY, false);
+
+    EXPECT_DOUBLE_EQ(limiter.statistics().limit, 10.0);
+}
+
+TEST(ConcurrencyLimiterTest, LimitShrinksOncePerCallDuration) {
+    ConcurrencyLimiter limiter(10, 1, 20, true, 0, std::chrono::milliseconds(0));
+    const auto long_latency = std::chrono::seconds(10);
+
+    ASSERT_TRUE(limiter.acquire(NO_DEADLINE));
+    limiter.release(long_latency, true);
+    EXPECT_DOUBLE_EQ(limiter.statistics().limit, 9.0);
+
+    // The same congestion seen by another running call does not shrink the limit again
+    ASSERT_TRUE(limiter.acquire(NO_DEADLINE));
+    limiter.release(long_latency, true);
+    EXPECT_DOUBLE_EQ(limiter.statistics().limit, 9.0);
+}
+
+TEST(ConcurrencyLimiterTest, LimitNotBelowMinimum) {
+    ConcurrencyLimiter limiter(2, 2, 4, true, 0, std::chrono::milliseconds(0));
+
+    ASSERT_TRUE(limiter.acquire(NO_DEADLINE));
+    limiter.release(LATENCY, true);
+
+    EXPECT_DOUBLE_EQ(limiter.statistics().limit, 2.0);
+}
+
+TEST(ConcurrencyLimiterTest, LatencyJumpShrinksLimit) {
+    ConcurrencyLimiter limiter(10, 1, 20, true, 0, std::chrono::milliseconds(0));
+    for (int i = 0; i < 10; ++i) {
+        ASSERT_TRUE(limiter.acquire(NO_DEADLINE));
+        limiter.release(LATENCY, false);
+    }
+    ASSERT_DOUBLE_EQ(limiter.statistics().limit, 10.0);
+
+    ASSERT_TRUE(limiter.acquire(NO_DEADLINE));
+    limiter.release(LATENCY * 5, false);
+    EXPECT_DOUBLE_EQ(limiter.statistics().limit, 9.0);
+}
+
+TEST(ConcurrencyLimiterTest, QueuedCallAdmittedOnRelease) {
+    ConcurrencyLimiter limiter(1, 1, 1, false, 1, std::chrono::milliseconds(5000));
+    ASSERT_TRUE(limiter.acquire(NO_DEADLINE));
+
+    bool acquired = false;
+    std::thread waiter([&]() { acquired = limiter.acquire(NO_DEADLINE); });
+    while (limiter.statistics().queued == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    // The queue holds a single call, the next one is rejected at once
+    EXPECT_FALSE(limiter.acquire(NO_DEADLINE));
+
+    limiter.release(LATENCY, false);
+    waiter.join();
+    EXPECT_TRUE(acquired);
+    EXPECT_EQ(limiter.statistics().in_flight, 1u);
+}
+
+TEST(ConcurrencyLimiterTest, QueuedCallRejectedAfterTimeout) {
+    ConcurrencyLimiter limiter(1, 1, 1, false, 1, std::chrono::milliseconds(20));
+    ASSERT_TRUE(limiter.acquire(NO_DEADLINE));
+
+    EXPECT_FALSE(limiter.acquire(NO_DEADLINE));
+    EXPECT_FALSE(limiter.acquire(std::chrono::system_clock::now()));
+
+    auto statistics = limiter.statistics();
+    EXPECT_EQ(statistics.queued, 0u);
+    EXPECT_EQ(statistics.rejected, 2u);
+}
+
+TEST(AdmissionControllerTest, DisabledAdmitsAll) {
+    AdmissionController controller;
+
+    AdmissionController::Permit permit;
+    EXPECT_TRUE(controller.admit(nullptr, "test.Service/Method", permit).ok());
+    EXPECT_EQ(controller.statistics("test.Service/Method").admitted, 0u);
+}
+
+TEST(AdmissionControllerTest, GlobalLimitRejects) {
+    AdmissionController controller;
+    controller.setLimits(1, 2, 1, 4, 0, 0);
+
+    {
+        AdmissionController::Permit permit;
+        ASSERT_TRUE(controller.admit(nullptr, "test.Service/First", permit).ok());
+
+        AdmissionController::Permit rejected_permit;
+        auto status = controller.admit(nullptr, "test.Service/Second", rejected_permit);
+        EXPECT_EQ(status.error_code(), grpc::StatusCode::RESOURCE_EXHAUSTED);
+        // The method slot taken before the global limit was checked is given back
+        EXPECT_EQ(controller.statistics("test.Service/Second").in_flight, 0u);
+    }
+
+    AdmissionController::Permit permit;
+    EXPECT_TRUE(controller.admit(nullptr, "test.Service/Second", permit).ok());
+    EXPECT_EQ(controller.statistics("").rejected, 1u);
+}
+
+TEST(AdmissionControllerTest, MethodLimitRejects) {
+    AdmissionController controller;
+    controller.setLimits(0, 1, 1, 4, 0, 0);
+
+    AdmissionController::Permit permit;
+    ASSERT_TRUE(controller.admit(nullptr, "test.Service/Method", permit).ok());
+
+    AdmissionController::Permit other_method_permit;
+    EXPECT_TRUE(controller.admit(nullptr, "test.Service/Other", other_method_permit).ok());
+
+    AdmissionController::Permit rejected_permit;
+    auto status = controller.admit(nullptr, "test.Service/Method", rejected_permit);
+    EXPECT_EQ(status.error_code(), grpc::StatusCode::RESOURCE_EXHAUSTED);
+}
+
+TEST(AdmissionControllerTest, OverloadStatusShrinksMethodLimit) {
+    AdmissionController controller;
+    controller.setLimits(0, 10, 1, 20, 0, 0);
+
+    {
+        AdmissionController::Permit permit;
+        ASSERT_TRUE(controller.admit(nullptr, "test.Service/Method", permit).ok());
+        permit.setStatus(grpc::Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "overloaded"));
+    }
+    EXPECT_DOUBLE_EQ(controller.statistics("test.Service/Method").limit, 9.0);
+
+    {
+        AdmissionController::Permit permit;
+        ASSERT_TRUE(controller.admit(nullptr, "test.Service/Other", permit).ok());
+        permit.setStatus(grpc::Status(grpc::StatusCode::NOT_FOUND, "not found"));
+    }
+    EXPECT_DOUBLE_EQ(controller.statistics("test.Service/Other").limit, 10.0);
+}
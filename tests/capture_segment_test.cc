@@ -0,0 +1,194 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <filesystem>
+
+#include <gtest/gtest.h>
+
+#include "capture_segment.h"
+
+namespace {
+
+class CaptureSegmentTest : public ::testing::Test {
+protected:
+    std::filesystem::path m_directory;
+
+    void SetUp() override {
+        auto test_name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+        auto suffix = std::chrono::steady_clock::now().time_since_epoch().count();
+        m_directory = std::filesystem::temp_directory_path() / ("gms-capture-" + std::string(test_name) + "-" + std::to_string(suffix));
+    }
+
+    void TearDown() override {
+        std::error_code error;
+        std::filesystem::remove_all(m_directory, error);
+    }
+
+    static std::string encode(uint64_t arrival_time_ns, std::string_view method, std::string_view payload) {
+        CaptureRecord record;
+        record.arrival_time_ns = arrival_time_ns;
+        record.method = method;
+        record.payload = payload;
+
+        std::string result;
+        encodeCaptureRecord(record, result);
+        return result;
+    }
+
+    void write(const std::vector<std::string> &records, uint64_t segment_size) {
+        std::string error;
+        CaptureSegmentWriter writer;
+        ASSERT_TRUE(writer.open(m_directory, segment_size, error)) << error;
+        for (const auto &record : records) {
+            ASSERT_TRUE(writer.append(record, error)) << error;
+        }
+        writer.close();
+    }
+};
+
+} // anonymous namespace
+
+TEST_F(CaptureSegmentTest, RecordRoundTrip) {
+    // The payload is binary, the embedded zero byte must survive
+    const std::string payload("\x0a\x03" "abc" "\x00\xff", 7);
+
+    CaptureRecord record;
+    record.arrival_time_ns = 1700000000123456789ull;
+    record.method = "package.Service/Method";
+    record.metadata = { { "x-request-id", "42" }, { "authorization", "" } };
+    record.payload = payload;
+
+    std::string encoded;
+    encodeCaptureRecord(record, encoded);
+    write({ encoded }, 1024 * 1024);
+
+    auto segments = listCaptureSegments(m_directory);
+    ASSERT_EQ(segments.size(), 1u);
+
+    std::string error;
+    CaptureSegmentReader reader;
+    ASSERT_TRUE(reader.open(segments.front(), error)) << error;
+
+    CaptureRecord read_record;
+    ASSERT_TRUE(reader.next(read_record));
+    EXPECT_EQ(read_record.arrival_time_ns, record.arrival_time_ns);
+    EXPECT_EQ(read_record.method, record.method);
+    ASSERT_EQ(read_record.metadata.size(), 2u);
+    EXPECT_EQ(read_record.metadata[0].first, "x-request-id");
+    EXPECT_EQ(read_record.metadata[0].second, "42");
+    EXPECT_EQ(read_record.metadata[1].first, "authorization");
+    EXPECT_EQ(read_record.metadata[1].second, "");
+    EXPECT_EQ(read_record.payload, payload);
+
+    EXPECT_FALSE(reader.next(read_record));
+    EXPECT_FALSE(reader.truncated());
+}
+
+TEST_F(CaptureSegmentTest, SegmentsRotatedInOrder) {
+    const int RECORD_COUNT = 10;
+    std::vector<std::string> records;
+    for (int i = 0; i < RECORD_COUNT; ++i) {
+        records.push_back(encode(i, "package.Service/Method", std::string(100, static_cast<char>('a' + i))));
+    }
+    // Room for about three records per segment
+    write(records, sizeof(CAPTURE_SEGMENT_MAGIC) + 3 * records.front().size());
+
+    auto segments = listCaptureSegments(m_directory);
+    EXPECT_EQ(segments.size(), 4u);
+
+    uint64_t expected_time = 0;
+    for (const auto &segment : segments) {
+        std::string error;
+        CaptureSegmentReader reader;
+        ASSERT_TRUE(reader.open(segment, error)) << error;
+
+        CaptureRecord record;
+        while (reader.next(record)) {
+            EXPECT_EQ(record.arrival_time_ns, expected_time);
+            EXPECT_EQ(record.payload, std::string(100, static_cast<char>('a' + expected_time)));
+            expected_time++;
+        }
+        EXPECT_FALSE(reader.truncated());
+    }
+    EXPECT_EQ(expected_time, static_cast<uint64_t>(RECORD_COUNT));
+}
+
+TEST_F(CaptureSegmentTest, OversizedRecordGetsOwnSegment) {
+    write({ encode(0, "a.B/C", std::string(1000, 'x')), encode(1, "a.B/C", "y") }, 64);
+
+    EXPECT_EQ(listCaptureSegments(m_directory).size(), 2u);
+}
+
+TEST_F(CaptureSegmentTest, TruncatedTailSkipped) {
+    auto first = encode(1, "a.B/C", "first");
+    auto second = encode(2, "a.B/C", "second");
+    write({ first, second }, 1024 * 1024);
+
+    auto segments = listCaptureSegments(m_directory);
+    ASSERT_EQ(segments.size(), 1u);
+    std::filesystem::resize_file(segments.front(), std::filesystem::file_size(segments.front()) - 3);
+
+    std::string error;
+    CaptureSegmentReader reader;
+    ASSERT_TRUE(reader.open(segments.front(), error)) << error;
+
+    CaptureRecord record;
+    ASSERT_TRUE(reader.next(record));
+    EXPECT_EQ(record.payload, "first");
+    EXPECT_FALSE(reader.next(record));
+    EXPECT_TRUE(reader.truncated());
+}
+
+TEST_F(CaptureSegmentTest, MalformedRecordSkipped) {
+    auto record = encode(1, "a.B/C", "payload");
+    // The record claims more metadata than its size holds
+    auto metadata_count_offset = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(uint16_t) + 5;
+    record[metadata_count_offset] = 0x10;
+    write({ record }, 1024 * 1024);
+
+    std::string error;
+    CaptureSegmentReader reader;
+    ASSERT_TRUE(reader.open(listCaptureSegments(m_directory).front(), error)) << error;
+
+    CaptureRecord read_record;
+    EXPECT_FALSE(reader.next(read_record));
+    EXPECT_TRUE(reader.truncated());
+}
+
+TEST_F(CaptureSegmentTest, ForeignFileRejected) {
+    std::filesystem::create_directories(m_directory);
+    auto file_path = m_directory / "foreign.seg";
+    std::ofstream(file_path, std::ios::binary) << "not a capture segment";
+
+    std::string error;
+    CaptureSegmentReader reader;
+    EXPECT_FALSE(reader.open(file_path, error));
+    EXPECT_FALSE(error.empty());
+}
+
+TEST_F(CaptureSegmentTest, FilePathListedAsItself) {
+    auto file_path = m_directory / "single.seg";
+
+    auto segments = listCaptureSegments(file_path);
+    ASSERT_EQ(segments.size(), 1u);
+    EXPECT_EQ(segments.front(), file_path);
+}
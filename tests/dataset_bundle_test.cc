@@ -0,0 +1,231 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <filesystem>
+
+#include <gtest/gtest.h>
+
+#include "dataset_bundle.h"
+
+namespace {
+
+// Offsets of the bundle header fields
+constexpr size_t ENTRY_COUNT_OFFSET = 8;
+constexpr size_t INDEX_OFFSET_OFFSET = 16;
+constexpr size_t NAME_SIZE_OFFSET = 32;
+// Offsets of the index entry fields
+constexpr size_t INDEX_ENTRY_SIZE = 32;
+constexpr size_t METHOD_OFFSET_OFFSET = 0;
+constexpr size_t PAYLOAD_SIZE_OFFSET = 24;
+
+class DatasetBundleTest : public ::testing::Test {
+protected:
+    std::string m_path;
+
+    void SetUp() override {
+        auto test_name = ::testing::UnitTest::GetInstance()->current_test_info()->name();
+        auto suffix = std::chrono::steady_clock::now().time_since_epoch().count();
+        auto path = std::filesystem::temp_directory_path() / ("gms-bundle-" + std::string(test_name) + "-" + std::to_string(suffix) + ".bundle");
+        m_path = path.string();
+    }
+
+    void TearDown() override {
+        std::error_code error;
+        std::filesystem::remove(m_path, error);
+    }
+
+    void writeBundle() {
+        std::vector<DatasetFixture> fixtures = {
+            { "package.Service/Second", DATASET_FIXTURE_FULL, "second" },
+            { "package.Service/First", DATASET_FIXTURE_PARTIAL, "first partial" },
+            { "package.Service/First", DATASET_FIXTURE_FULL, std::string("first\0full", 10) }
+        };
+        std::string error;
+        ASSERT_TRUE(writeDatasetBundle("dataset", fixtures, m_path, error)) << error;
+    }
+
+    std::string readFile() const {
+        std::ifstream file(m_path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    void writeFile(const std::string &data) const {
+        std::ofstream file(m_path, std::ios::binary | std::ios::trunc);
+        file.write(data.data(), static_cast<std::streamsize>(data.size()));
+    }
+
+    template <typename T>
+    static T readInteger(const std::string &data, size_t offset) {
+        uint64_t result = 0;
+        for (size_t i = 0; i < sizeof(T); ++i) {
+            result |= static_cast<uint64_t>(static_cast<unsigned char>(data[offset + i])) << (8 * i);
+        }
+        return static_cast<T>(result);
+    }
+
+    template <typename T>
+    void patchInteger(size_t offset, T value) const {
+        auto data = readFile();
+        for (size_t i = 0; i < sizeof(T); ++i) {
+            data[offset + i] = static_cast<char>((static_cast<uint64_t>(value) >> (8 * i)) & 0xFF);
+        }
+        writeFile(data);
+    }
+
+    size_t indexOffset() const {
+        return static_cast<size_t>(readInteger<uint64_t>(readFile(), INDEX_OFFSET_OFFSET));
+    }
+};
+
+} // anonymous namespace
+
+TEST_F(DatasetBundleTest, FixturesFound) {
+    writeBundle();
+
+    std::string error;
+    DatasetBundle bundle;
+    ASSERT_TRUE(bundle.open(m_path, error)) << error;
+
+    EXPECT_EQ(bundle.datasetName(), "dataset");
+    EXPECT_EQ(bundle.size(), 3u);
+    EXPECT_EQ(bundle.methodNames(), (std::vector<std::string> { "package.Service/First", "package.Service/Second" }));
+
+    std::string_view payload;
+    ASSERT_TRUE(bundle.find("package.Service/First", DATASET_FIXTURE_FULL, payload));
+    EXPECT_EQ(payload, std::string_view("first\0full", 10));
+    ASSERT_TRUE(bundle.find("package.Service/First", DATASET_FIXTURE_PARTIAL, payload));
+    EXPECT_EQ(payload, "first partial");
+    ASSERT_TRUE(bundle.find("package.Service/Second", DATASET_FIXTURE_FULL, payload));
+    EXPECT_EQ(payload, "second");
+
+    EXPECT_FALSE(bundle.find("package.Service/Second", DATASET_FIXTURE_PARTIAL, payload));
+    EXPECT_FALSE(bundle.find("package.Service/Third", DATASET_FIXTURE_FULL, payload));
+    EXPECT_FALSE(bundle.find("", DATASET_FIXTURE_FULL, payload));
+}
+
+TEST_F(DatasetBundleTest, EmptyBundle) {
+    std::string error;
+    ASSERT_TRUE(writeDatasetBundle("empty", {}, m_path, error)) << error;
+
+    DatasetBundle bundle;
+    ASSERT_TRUE(bundle.open(m_path, error)) << error;
+    EXPECT_EQ(bundle.size(), 0u);
+    EXPECT_TRUE(bundle.methodNames().empty());
+
+    std::string_view payload;
+    EXPECT_FALSE(bundle.find("package.Service/Method", DATASET_FIXTURE_FULL, payload));
+}
+
+TEST_F(DatasetBundleTest, DuplicateFixtureRejected) {
+    std::vector<DatasetFixture> fixtures = {
+        { "package.Service/Method", DATASET_FIXTURE_FULL, "first" },
+        { "package.Service/Method", DATASET_FIXTURE_FULL, "second" }
+    };
+    std::string error;
+    EXPECT_FALSE(writeDatasetBundle("dataset", fixtures, m_path, error));
+    EXPECT_FALSE(error.empty());
+}
+
+TEST_F(DatasetBundleTest, ForeignFileRejected) {
+    writeFile("not a dataset bundle, but long enough for the header");
+
+    std::string error;
+    DatasetBundle bundle;
+    EXPECT_FALSE(bundle.open(m_path, error));
+    EXPECT_FALSE(error.empty());
+}
+
+TEST_F(DatasetBundleTest, ShortFileRejected) {
+    writeFile(std::string(DATASET_BUNDLE_MAGIC, sizeof(DATASET_BUNDLE_MAGIC)));
+
+    std::string error;
+    DatasetBundle bundle;
+    EXPECT_FALSE(bundle.open(m_path, error));
+}
+
+TEST_F(DatasetBundleTest, TruncatedIndexRejected) {
+    writeBundle();
+    auto data = readFile();
+    writeFile(data.substr(0, data.size() - 1));
+
+    std::string error;
+    DatasetBundle bundle;
+    EXPECT_FALSE(bundle.open(m_path, error));
+    EXPECT_NE(error.find("truncated"), std::string::npos);
+}
+
+TEST_F(DatasetBundleTest, EntryCountBeyondFileRejected) {
+    writeBundle();
+    patchInteger<uint32_t>(ENTRY_COUNT_OFFSET, 0xFFFFFFFF);
+
+    std::string error;
+    DatasetBundle bundle;
+    EXPECT_FALSE(bundle.open(m_path, error));
+}
+
+TEST_F(DatasetBundleTest, IndexOffsetBeyondFileRejected) {
+    writeBundle();
+    patchInteger<uint64_t>(INDEX_OFFSET_OFFSET, 0xFFFFFFFFFFFFFFF0ull);
+
+    std::string error;
+    DatasetBundle bundle;
+    EXPECT_FALSE(bundle.open(m_path, error));
+}
+
+TEST_F(DatasetBundleTest, NameBeyondFileRejected) {
+    writeBundle();
+    patchInteger<uint32_t>(NAME_SIZE_OFFSET, 0xFFFFFFFF);
+
+    std::string error;
+    DatasetBundle bundle;
+    EXPECT_FALSE(bundle.open(m_path, error));
+}
+
+TEST_F(DatasetBundleTest, PayloadBeyondFileNotFound) {
+    writeBundle();
+    // The first index entry is the full fixture of the first method
+    patchInteger<uint64_t>(indexOffset() + PAYLOAD_SIZE_OFFSET, 0xFFFFFFFFFFFFull);
+
+    std::string error;
+    DatasetBundle bundle;
+    ASSERT_TRUE(bundle.open(m_path, error)) << error;
+
+    std::string_view payload;
+    EXPECT_FALSE(bundle.find("package.Service/First", DATASET_FIXTURE_FULL, payload));
+    EXPECT_TRUE(bundle.find("package.Service/Second", DATASET_FIXTURE_FULL, payload));
+}
+
+TEST_F(DatasetBundleTest, MethodBeyondFileSkipped) {
+    writeBundle();
+    // The last index entry is the fixture of the second method
+    patchInteger<uint64_t>(indexOffset() + 2 * INDEX_ENTRY_SIZE + METHOD_OFFSET_OFFSET, 0xFFFFFFFFFFFFull);
+
+    std::string error;
+    DatasetBundle bundle;
+    ASSERT_TRUE(bundle.open(m_path, error)) << error;
+
+    EXPECT_EQ(bundle.methodNames(), std::vector<std::string> { "package.Service/First" });
+    std::string_view payload;
+    EXPECT_FALSE(bundle.find("package.Service/Second", DATASET_FIXTURE_FULL, payload));
+}
@@ -0,0 +1,208 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <SQLiteCpp/SQLiteCpp.h>
+
+#include "payload_store.h"
+
+namespace {
+
+// Enough payloads for the dictionary training
+constexpr int TRAINING_PAYLOAD_COUNT = 2000;
+
+std::string makePayload(int index) {
+    return "{\"id\": " + std::to_string(index) + ", \"name\": \"user-" + std::to_string(index)
+        + "\", \"email\": \"user-" + std::to_string(index) + "@example.com\", \"status\": \"ACTIVE\"}";
+}
+
+class PayloadStoreTest : public ::testing::Test {
+protected:
+    SQLite::Database m_database { ":memory:", SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE };
+    PayloadStore m_store;
+
+    void SetUp() override {
+        PayloadStore::createTables(m_database);
+    }
+
+    int64_t queryInteger(const std::string &query, int64_t id) {
+        SQLite::Statement statement(m_database, query);
+        statement.bind(1, id);
+        if (!statement.executeStep()) return -1;
+        return statement.getColumn(0).getInt64();
+    }
+
+    int64_t payloadCount() {
+        SQLite::Statement statement(m_database, "SELECT COUNT(*) FROM payloads");
+        statement.executeStep();
+        return statement.getColumn(0).getInt64();
+    }
+
+    int64_t refcount(int64_t id) {
+        return queryInteger("SELECT refcount FROM payloads WHERE id = ?", id);
+    }
+
+    std::string read(int64_t id) {
+        std::string data;
+        std::string error;
+        EXPECT_TRUE(PayloadStore::read(m_database, id, data, error)) << error;
+        return data;
+    }
+
+    // Stores the payloads in a committed transaction, as the history writer does
+    std::vector<int64_t> addCommitted(const std::vector<std::string> &payloads) {
+        std::vector<int64_t> ids;
+        SQLite::Transaction transaction(m_database);
+        for (const auto &payload : payloads) ids.push_back(m_store.add(payload));
+        m_store.commitReferences();
+        transaction.commit();
+        m_store.commit();
+        return ids;
+    }
+
+    void addRolledBack(const std::vector<std::string> &payloads) {
+        {
+            SQLite::Transaction transaction(m_database);
+            for (const auto &payload : payloads) m_store.add(payload);
+            m_store.commitReferences();
+        }
+        m_store.rollback();
+    }
+};
+
+} // anonymous namespace
+
+TEST_F(PayloadStoreTest, IdenticalPayloadsStoredOnce) {
+    m_store.open(&m_database, PayloadStore::Settings());
+
+    auto ids = addCommitted({ "first", "second", "first", std::string("bin\0ary", 7) });
+    EXPECT_EQ(ids[0], ids[2]);
+    EXPECT_NE(ids[0], ids[1]);
+    EXPECT_EQ(payloadCount(), 3);
+    EXPECT_EQ(refcount(ids[0]), 2);
+    EXPECT_EQ(refcount(ids[1]), 1);
+
+    EXPECT_EQ(read(ids[0]), "first");
+    EXPECT_EQ(read(ids[1]), "second");
+    EXPECT_EQ(read(ids[3]), std::string("bin\0ary", 7));
+}
+
+TEST_F(PayloadStoreTest, PayloadsFoundAcrossTransactionsAndReopening) {
+    m_store.open(&m_database, PayloadStore::Settings());
+    auto first_ids = addCommitted({ "payload" });
+    auto second_ids = addCommitted({ "payload" });
+
+    // A reopened store has no cached ids, the payload is found in the table
+    m_store.open(&m_database, PayloadStore::Settings());
+    auto third_ids = addCommitted({ "payload" });
+
+    EXPECT_EQ(first_ids[0], second_ids[0]);
+    EXPECT_EQ(first_ids[0], third_ids[0]);
+    EXPECT_EQ(payloadCount(), 1);
+    EXPECT_EQ(refcount(first_ids[0]), 3);
+}
+
+TEST_F(PayloadStoreTest, RolledBackPayloadsForgotten) {
+    m_store.open(&m_database, PayloadStore::Settings());
+    auto committed_ids = addCommitted({ "committed" });
+
+    addRolledBack({ "rolled back", "committed" });
+    EXPECT_EQ(payloadCount(), 1);
+    EXPECT_EQ(refcount(committed_ids[0]), 1);
+
+    // The ids cached in the rolled back transaction must not be reused
+    auto ids = addCommitted({ "rolled back", "committed" });
+    EXPECT_EQ(payloadCount(), 2);
+    EXPECT_EQ(read(ids[0]), "rolled back");
+    EXPECT_EQ(refcount(ids[0]), 1);
+    EXPECT_EQ(ids[1], committed_ids[0]);
+    EXPECT_EQ(refcount(ids[1]), 2);
+}
+
+TEST_F(PayloadStoreTest, CompressedPayloadsRead) {
+    PayloadStore::Settings settings;
+    settings.compression = true;
+    settings.train_dictionary = false;
+    m_store.open(&m_database, settings);
+
+    const std::string large(4096, 'x');
+    const std::string small = "short";
+    auto ids = addCommitted({ large, small });
+
+    EXPECT_EQ(queryInteger("SELECT compression FROM payloads WHERE id = ?", ids[0]), PayloadStore::COMPRESSION_ZSTD);
+    EXPECT_EQ(queryInteger("SELECT compression FROM payloads WHERE id = ?", ids[1]), PayloadStore::COMPRESSION_NONE);
+    EXPECT_EQ(read(ids[0]), large);
+    EXPECT_EQ(read(ids[1]), small);
+}
+
+TEST_F(PayloadStoreTest, RolledBackDictionaryNotUsed) {
+    PayloadStore::Settings settings;
+    settings.compression = true;
+    m_store.open(&m_database, settings);
+
+    std::vector<std::string> payloads;
+    for (int i = 0; i < TRAINING_PAYLOAD_COUNT; ++i) payloads.push_back(makePayload(i));
+    addRolledBack(payloads);
+
+    auto ids = addCommitted({ makePayload(TRAINING_PAYLOAD_COUNT) });
+    EXPECT_EQ(queryInteger("SELECT dictionary_id FROM payloads WHERE id = ?", ids[0]), 0);
+    EXPECT_EQ(read(ids[0]), makePayload(TRAINING_PAYLOAD_COUNT));
+}
+
+TEST_F(PayloadStoreTest, CommittedDictionaryKeptOnRollback) {
+    PayloadStore::Settings settings;
+    settings.compression = true;
+    m_store.open(&m_database, settings);
+
+    std::vector<std::string> payloads;
+    for (int i = 0; i < TRAINING_PAYLOAD_COUNT; ++i) payloads.push_back(makePayload(i));
+    addCommitted(payloads);
+
+    addRolledBack({ makePayload(TRAINING_PAYLOAD_COUNT) });
+
+    auto ids = addCommitted({ makePayload(TRAINING_PAYLOAD_COUNT + 1) });
+    auto dictionary_id = queryInteger("SELECT dictionary_id FROM payloads WHERE id = ?", ids[0]);
+    EXPECT_NE(dictionary_id, 0);
+    EXPECT_EQ(queryInteger("SELECT COUNT(*) FROM payload_dictionaries WHERE id = ?", dictionary_id), 1);
+    EXPECT_EQ(read(ids[0]), makePayload(TRAINING_PAYLOAD_COUNT + 1));
+}
+
+TEST_F(PayloadStoreTest, MissingPayloadNotRead) {
+    std::string data;
+    std::string error;
+    EXPECT_FALSE(PayloadStore::read(m_database, 42, data, error));
+    EXPECT_FALSE(error.empty());
+}
+
+TEST_F(PayloadStoreTest, CompressionLevelValidated) {
+    PayloadStore::Settings settings;
+    settings.compression_level = 1000;
+
+    std::string error;
+    EXPECT_TRUE(PayloadStore::validateSettings(settings, error));
+
+    settings.compression = true;
+    EXPECT_FALSE(PayloadStore::validateSettings(settings, error));
+    EXPECT_FALSE(error.empty());
+
+    settings.compression_level = 3;
+    EXPECT_TRUE(PayloadStore::validateSettings(settings, error));
+}
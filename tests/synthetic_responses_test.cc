@@ -0,0 +1,172 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <set>
+
+#include <gtest/gtest.h>
+#include <google/protobuf/util/message_differencer.h>
+
+#include "synthetic_responses.h"
+#include "test_upstream.h"
+
+// Generated headers
+#include <proto/synthetic_test.pb.h>
+
+namespace {
+
+const char GET_METHOD[] = "gms.test.SyntheticTestService/Get";
+const char PING_METHOD[] = "gms.test.SyntheticTestService/Ping";
+
+grpc_mock_server::SyntheticResponseSettings testSettings() {
+    grpc_mock_server::SyntheticResponseSettings settings;
+    settings.enabled = true;
+    settings.seed = 42;
+    settings.pool_size = 4;
+    return settings;
+}
+
+std::vector<std::string> responses(const SyntheticResponsePool &pool, const std::string &method, int count) {
+    std::vector<std::string> result;
+    for (int i = 0; i < count; ++i) {
+        grpc::ByteBuffer buffer;
+        EXPECT_TRUE(pool.next(method, &buffer));
+        result.push_back(byteBufferToString(buffer));
+    }
+    return result;
+}
+
+int treeDepth(const gms::test::Node &node) {
+    int depth = 0;
+    for (const auto &child : node.children()) depth = std::max(depth, treeDepth(child));
+    return depth + 1;
+}
+
+} // anonymous namespace
+
+TEST(SyntheticResponsePoolTest, SameSeedSameResponses) {
+    SyntheticResponsePool first_pool;
+    SyntheticResponsePool second_pool;
+    ASSERT_EQ(first_pool.build({ GET_METHOD }, testSettings()), 1u);
+    ASSERT_EQ(second_pool.build({ GET_METHOD }, testSettings()), 1u);
+
+    EXPECT_EQ(responses(first_pool, GET_METHOD, 4), responses(second_pool, GET_METHOD, 4));
+}
+
+TEST(SyntheticResponsePoolTest, OtherSeedOtherResponses) {
+    auto settings = testSettings();
+    SyntheticResponsePool first_pool;
+    ASSERT_EQ(first_pool.build({ GET_METHOD }, settings), 1u);
+
+    settings.seed++;
+    SyntheticResponsePool second_pool;
+    ASSERT_EQ(second_pool.build({ GET_METHOD }, settings), 1u);
+
+    EXPECT_NE(responses(first_pool, GET_METHOD, 4), responses(second_pool, GET_METHOD, 4));
+}
+
+TEST(SyntheticResponsePoolTest, ResponsesReturnedInTurn) {
+    SyntheticResponsePool pool;
+    ASSERT_EQ(pool.build({ GET_METHOD }, testSettings()), 1u);
+
+    auto result = responses(pool, GET_METHOD, 8);
+    EXPECT_EQ(std::set<std::string>(result.begin(), result.end()).size(), 4u);
+    for (int i = 0; i < 4; ++i) EXPECT_EQ(result[i], result[i + 4]);
+}
+
+TEST(SyntheticResponsePoolTest, EveryFieldFilled) {
+    auto settings = testSettings();
+    settings.repeated_field_count = 3;
+    SyntheticResponsePool pool;
+    ASSERT_EQ(pool.build({ GET_METHOD }, settings), 1u);
+
+    gms::test::SyntheticResponse response;
+    ASSERT_TRUE(pool.next(GET_METHOD, &response));
+    EXPECT_FALSE(response.text().empty());
+    EXPECT_FALSE(response.data().empty());
+    EXPECT_EQ(response.items_size(), 3);
+    EXPECT_EQ(response.counters_size(), 3);
+    EXPECT_NE(response.choice_case(), gms::test::SyntheticResponse::CHOICE_NOT_SET);
+    EXPECT_TRUE(response.has_tree());
+}
+
+TEST(SyntheticResponsePoolTest, RecursiveMessageBounded) {
+    SyntheticResponsePool pool;
+    ASSERT_EQ(pool.build({ GET_METHOD }, testSettings()), 1u);
+
+    gms::test::SyntheticResponse response;
+    ASSERT_TRUE(pool.next(GET_METHOD, &response));
+    EXPECT_GT(treeDepth(response.tree()), 1);
+    EXPECT_LE(treeDepth(response.tree()), 5);
+}
+
+TEST(SyntheticResponsePoolTest, ResponseSizeCloseToTarget) {
+    for (int target_size : { 256, 1024, 8192 }) {
+        auto settings = testSettings();
+        settings.target_size_bytes = target_size;
+        SyntheticResponsePool pool;
+        ASSERT_EQ(pool.build({ GET_METHOD }, settings), 1u);
+
+        for (const auto &response : responses(pool, GET_METHOD, 4)) {
+            EXPECT_GT(response.size(), static_cast<size_t>(target_size) * 3 / 4) << target_size;
+            EXPECT_LT(response.size(), static_cast<size_t>(target_size) * 5 / 4) << target_size;
+        }
+    }
+}
+
+TEST(SyntheticResponsePoolTest, UnknownMethodSkipped) {
+    SyntheticResponsePool pool;
+    EXPECT_EQ(pool.build({ "unknown.Service/Method", GET_METHOD, PING_METHOD }, testSettings()), 2u);
+    EXPECT_EQ(pool.size(), 2u);
+
+    grpc::ByteBuffer buffer;
+    EXPECT_FALSE(pool.next("unknown.Service/Method", &buffer));
+
+    // An empty message is a valid response too
+    ASSERT_TRUE(pool.next(PING_METHOD, &buffer));
+    EXPECT_EQ(byteBufferToString(buffer), "");
+}
+
+TEST(SyntheticResponsePoolTest, RebuildReplacesResponses) {
+    auto settings = testSettings();
+    SyntheticResponsePool pool;
+    ASSERT_EQ(pool.build({ GET_METHOD }, settings), 1u);
+    EXPECT_FALSE(pool.isSyntheticOnly());
+
+    settings.synthetic_only = true;
+    ASSERT_EQ(pool.build({ PING_METHOD }, settings), 1u);
+    EXPECT_TRUE(pool.isSyntheticOnly());
+
+    grpc::ByteBuffer buffer;
+    EXPECT_FALSE(pool.next(GET_METHOD, &buffer));
+}
+
+TEST(SyntheticMessageTest, SameSeedSameMessage) {
+    const auto *descriptor = gms::test::SyntheticResponse::descriptor();
+    auto settings = testSettings();
+
+    auto first = generateSyntheticMessage(descriptor, settings, 7);
+    auto second = generateSyntheticMessage(descriptor, settings, 7);
+    auto third = generateSyntheticMessage(descriptor, settings, 8);
+    ASSERT_TRUE(first && second && third);
+
+    using google::protobuf::util::MessageDifferencer;
+    EXPECT_TRUE(MessageDifferencer::Equals(*first, *second));
+    EXPECT_FALSE(MessageDifferencer::Equals(*first, *third));
+}
@@ -0,0 +1,137 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include "test_upstream.h"
+
+#include <cassert>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+// gRPC 1.51 may free the shared completion queue of the callback API twice when its last user goes away,
+// so a callback server is kept for the whole test run and the queue is never torn down between the tests
+class CallbackQueueKeeper : public ::testing::Environment {
+    std::unique_ptr<TestUpstream> m_upstream;
+
+public:
+    void SetUp() override {
+        m_upstream = std::make_unique<TestUpstream>("keeper");
+    }
+
+    void TearDown() override {
+        m_upstream.reset();
+    }
+};
+
+const auto *const callback_queue_keeper = ::testing::AddGlobalTestEnvironment(new CallbackQueueKeeper);
+
+class TestUpstreamReactor : public grpc::ServerGenericBidiReactor {
+    TestUpstream *m_upstream;
+    grpc::ByteBuffer m_request;
+    grpc::ByteBuffer m_response;
+
+public:
+    explicit TestUpstreamReactor(TestUpstream *upstream) : m_upstream(upstream) {
+        StartRead(&m_request);
+    }
+
+    void OnReadDone(bool ok) override {
+        if (!ok) {
+            Finish(grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "Request message expected"));
+            return;
+        }
+
+        m_upstream->schedule([this](const grpc::Status &status) {
+            if (!status.ok()) {
+                Finish(status);
+                return;
+            }
+            m_response = makeByteBuffer(m_upstream->name());
+            StartWriteAndFinish(&m_response, grpc::WriteOptions(), status);
+        });
+    }
+
+    void OnDone() override {
+        delete this;
+    }
+};
+
+} // anonymous namespace
+
+TestUpstream::TestUpstream(std::string name) : m_name(std::move(name)) {
+    grpc::ServerBuilder builder;
+    builder.RegisterCallbackGenericService(this);
+    m_server = builder.BuildAndStart();
+    assert(m_server);
+}
+
+TestUpstream::~TestUpstream() {
+    // Every delayed reply finishes its call, so the shutdown doesn't wait for them
+    std::vector<std::thread> reply_threads;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        reply_threads.swap(m_reply_threads);
+    }
+    for (auto &thread : reply_threads) thread.join();
+    m_server->Shutdown();
+}
+
+void TestUpstream::setReply(std::chrono::milliseconds delay, const grpc::Status &status) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_delay = delay;
+    m_status = status;
+}
+
+std::shared_ptr<grpc::Channel> TestUpstream::channel() {
+    return m_server->InProcessChannel(grpc::ChannelArguments());
+}
+
+void TestUpstream::schedule(std::function<void(const grpc::Status &status)> reply) {
+    ++m_calls;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_delay.count() == 0) {
+        reply(m_status);
+        return;
+    }
+    m_reply_threads.emplace_back([reply = std::move(reply), delay = m_delay, status = m_status]() {
+        std::this_thread::sleep_for(delay);
+        reply(status);
+    });
+}
+
+grpc::ServerGenericBidiReactor *TestUpstream::CreateReactor(grpc::GenericCallbackServerContext *context) {
+    return new TestUpstreamReactor(this);
+}
+
+grpc::ByteBuffer makeByteBuffer(const std::string &data) {
+    grpc::Slice slice(data);
+    return grpc::ByteBuffer(&slice, 1);
+}
+
+std::string byteBufferToString(const grpc::ByteBuffer &buffer) {
+    std::vector<grpc::Slice> slices;
+    std::string result;
+    if (!buffer.Dump(&slices).ok()) return result;
+
+    for (const auto &slice : slices) {
+        result.append(reinterpret_cast<const char*>(slice.begin()), slice.size());
+    }
+    return result;
+}
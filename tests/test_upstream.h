@@ -0,0 +1,69 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#ifndef GRPC_MOCK_SERVER_TEST_UPSTREAM_H
+#define GRPC_MOCK_SERVER_TEST_UPSTREAM_H
+
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <chrono>
+
+#include <grpc++/grpc++.h>
+#include <grpcpp/generic/async_generic_service.h>
+
+/// <summary>
+/// In-process upstream server of the tests: answers every unary call with its name as the payload,
+/// or with the configured error status, after the configured delay
+/// </summary>
+class TestUpstream : public grpc::CallbackGenericService {
+    std::string m_name;
+
+    mutable std::mutex m_mutex;
+    std::chrono::milliseconds m_delay { 0 };
+    grpc::Status m_status;
+    std::vector<std::thread> m_reply_threads;
+    std::atomic<int> m_calls = 0;
+
+    std::unique_ptr<grpc::Server> m_server;
+
+public:
+    explicit TestUpstream(std::string name);
+    ~TestUpstream() override;
+
+    TestUpstream(const TestUpstream&) = delete;
+    TestUpstream &operator=(const TestUpstream&) = delete;
+
+    void setReply(std::chrono::milliseconds delay, const grpc::Status &status = grpc::Status::OK);
+    std::shared_ptr<grpc::Channel> channel();
+    int calls() const { return m_calls.load(); }
+
+    // Runs `reply` now or on a thread of its own after the delay
+    void schedule(std::function<void(const grpc::Status &status)> reply);
+    const std::string &name() const { return m_name; }
+
+    grpc::ServerGenericBidiReactor *CreateReactor(grpc::GenericCallbackServerContext *context) override;
+};
+
+grpc::ByteBuffer makeByteBuffer(const std::string &data);
+std::string byteBufferToString(const grpc::ByteBuffer &buffer);
+
+#endif // GRPC_MOCK_SERVER_TEST_UPSTREAM_H
@@ -0,0 +1,261 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <functional>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "admission_control.h"
+#include "upstream_router.h"
+#include "upstream_proxy.h"
+#include "test_upstream.h"
+
+namespace {
+
+const char TEST_METHOD[] = "test.Service/Method";
+const char DEFAULT_METHOD[] = "other.Service/Method";
+
+// The router picks the endpoints in the group order while none of them has a latency yet,
+// so the first attempt goes to the slow endpoint and the hedged one to the fast endpoint
+class UpstreamProxyTest : public ::testing::Test {
+protected:
+    TestUpstream m_slow { "slow" };
+    TestUpstream m_fast { "fast" };
+    TestUpstream m_default { "default" };
+    UpstreamRouter m_router { [this](const std::string &target) { return channel(target); } };
+    AdmissionController m_admission_controller;
+    UpstreamProxy m_proxy { &m_admission_controller, &m_router };
+
+    void SetUp() override {
+        ASSERT_TRUE(m_router.addGroup("test", { "slow", "fast" }));
+        ASSERT_TRUE(m_router.addRoute("test.Service", "test"));
+        m_proxy.setChannel(m_default.channel());
+    }
+
+    void TearDown() override {
+        // The cancelled attempts report to the router when they complete
+        waitFor([this]() {
+            return m_router.statistics("slow").in_flight == 0 && m_router.statistics("fast").in_flight == 0;
+        });
+    }
+
+    std::shared_ptr<grpc::Channel> channel(const std::string &target) {
+        if (target == "slow") return m_slow.channel();
+        if (target == "fast") return m_fast.channel();
+        return m_default.channel();
+    }
+
+    grpc::Status forward(const std::string &method, std::string &response, const std::string &request = "request") {
+        grpc::ByteBuffer response_buffer;
+        auto status = m_proxy.forward(nullptr, method, makeByteBuffer(request), &response_buffer);
+        response = byteBufferToString(response_buffer);
+        return status;
+    }
+
+    static bool waitFor(const std::function<bool()> &condition) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!condition()) {
+            if (std::chrono::steady_clock::now() > deadline) return false;
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        return true;
+    }
+};
+
+} // anonymous namespace
+
+TEST_F(UpstreamProxyTest, HedgeWinsAfterDelay) {
+    m_slow.setReply(std::chrono::milliseconds(300));
+    m_proxy.setHedgingPolicy(TEST_METHOD, 20, 0.0);
+
+    std::string response;
+    auto status = forward(TEST_METHOD, response);
+
+    ASSERT_TRUE(status.ok()) << status.error_message();
+    EXPECT_EQ(response, "fast");
+    EXPECT_EQ(m_slow.calls(), 1);
+    EXPECT_EQ(m_fast.calls(), 1);
+
+    auto statistics = m_proxy.statistics(TEST_METHOD);
+    EXPECT_EQ(statistics.calls, 1u);
+    EXPECT_EQ(statistics.hedged_calls, 1u);
+    EXPECT_EQ(statistics.hedge_wins, 1u);
+    EXPECT_EQ(statistics.failed_calls, 0u);
+}
+
+TEST_F(UpstreamProxyTest, NoHedgeBeforeDelay) {
+    m_proxy.setHedgingPolicy(TEST_METHOD, 2000, 0.0);
+
+    std::string response;
+    auto status = forward(TEST_METHOD, response);
+
+    ASSERT_TRUE(status.ok()) << status.error_message();
+    EXPECT_EQ(response, "slow");
+    EXPECT_EQ(m_fast.calls(), 0);
+
+    auto statistics = m_proxy.statistics(TEST_METHOD);
+    EXPECT_EQ(statistics.hedged_calls, 0u);
+    EXPECT_EQ(statistics.hedge_wins, 0u);
+}
+
+TEST_F(UpstreamProxyTest, HedgeSentRightAfterFailure) {
+    m_slow.setReply(std::chrono::milliseconds(0), grpc::Status(grpc::StatusCode::UNAVAILABLE, "down"));
+    m_proxy.setHedgingPolicy(TEST_METHOD, 2000, 0.0);
+
+    auto started_at = std::chrono::steady_clock::now();
+    std::string response;
+    auto status = forward(TEST_METHOD, response);
+    auto elapsed = std::chrono::steady_clock::now() - started_at;
+
+    ASSERT_TRUE(status.ok()) << status.error_message();
+    EXPECT_EQ(response, "fast");
+    EXPECT_LT(elapsed, std::chrono::milliseconds(1000));
+
+    auto statistics = m_proxy.statistics(TEST_METHOD);
+    EXPECT_EQ(statistics.hedged_calls, 1u);
+    EXPECT_EQ(statistics.hedge_wins, 1u);
+}
+
+TEST_F(UpstreamProxyTest, PercentileHedgingWaitsForLatencies) {
+    m_slow.setReply(std::chrono::milliseconds(100));
+    m_proxy.setHedgingPolicy(TEST_METHOD, 0, 95.0);
+
+    std::string response;
+    auto status = forward(TEST_METHOD, response);
+
+    ASSERT_TRUE(status.ok()) << status.error_message();
+    EXPECT_EQ(response, "slow");
+    EXPECT_EQ(m_fast.calls(), 0);
+    EXPECT_EQ(m_proxy.statistics(TEST_METHOD).hedged_calls, 0u);
+}
+
+TEST_F(UpstreamProxyTest, HedgeNeedsFreeAdmissionSlot) {
+    m_admission_controller.setLimits(0, 1, 1, 1, 0, 0);
+    m_slow.setReply(std::chrono::milliseconds(100));
+    m_proxy.setHedgingPolicy(TEST_METHOD, 20, 0.0);
+
+    std::string response;
+    auto status = forward(TEST_METHOD, response);
+
+    ASSERT_TRUE(status.ok()) << status.error_message();
+    EXPECT_EQ(response, "slow");
+    EXPECT_EQ(m_fast.calls(), 0);
+    EXPECT_EQ(m_proxy.statistics(TEST_METHOD).hedged_calls, 0u);
+    EXPECT_EQ(m_admission_controller.statistics(TEST_METHOD).rejected, 0u);
+}
+
+TEST_F(UpstreamProxyTest, FailureReturnedWithoutAdmissionSlotForHedge) {
+    m_admission_controller.setLimits(0, 1, 1, 1, 0, 0);
+    m_slow.setReply(std::chrono::milliseconds(0), grpc::Status(grpc::StatusCode::UNAVAILABLE, "down"));
+    m_proxy.setHedgingPolicy(TEST_METHOD, 2000, 0.0);
+
+    auto started_at = std::chrono::steady_clock::now();
+    std::string response;
+    auto status = forward(TEST_METHOD, response);
+    auto elapsed = std::chrono::steady_clock::now() - started_at;
+
+    EXPECT_EQ(status.error_code(), grpc::StatusCode::UNAVAILABLE);
+    EXPECT_LT(elapsed, std::chrono::milliseconds(1000));
+    EXPECT_EQ(m_fast.calls(), 0);
+}
+
+TEST_F(UpstreamProxyTest, FailureReturnedWithoutHedging) {
+    m_slow.setReply(std::chrono::milliseconds(0), grpc::Status(grpc::StatusCode::UNAVAILABLE, "down"));
+
+    std::string response;
+    auto status = forward(TEST_METHOD, response);
+
+    EXPECT_EQ(status.error_code(), grpc::StatusCode::UNAVAILABLE);
+    EXPECT_EQ(m_fast.calls(), 0);
+
+    auto statistics = m_proxy.statistics(TEST_METHOD);
+    EXPECT_EQ(statistics.calls, 1u);
+    EXPECT_EQ(statistics.failed_calls, 1u);
+    EXPECT_EQ(statistics.hedged_calls, 0u);
+}
+
+TEST_F(UpstreamProxyTest, UnroutedMethodUsesDefaultChannel) {
+    std::string response;
+    auto status = forward(DEFAULT_METHOD, response);
+
+    ASSERT_TRUE(status.ok()) << status.error_message();
+    EXPECT_EQ(response, "default");
+    EXPECT_EQ(m_slow.calls() + m_fast.calls(), 0);
+}
+
+TEST_F(UpstreamProxyTest, IdenticalCallsCoalesced) {
+    const int CALL_COUNT = 4;
+    m_default.setReply(std::chrono::milliseconds(200));
+    m_proxy.setCoalescingEnabled(DEFAULT_METHOD, true);
+
+    std::vector<grpc::Status> statuses(CALL_COUNT);
+    std::vector<std::string> responses(CALL_COUNT);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < CALL_COUNT; ++i) {
+        threads.emplace_back([this, i, &statuses, &responses]() {
+            statuses[i] = forward(DEFAULT_METHOD, responses[i]);
+        });
+    }
+    for (auto &thread : threads) thread.join();
+
+    for (int i = 0; i < CALL_COUNT; ++i) {
+        EXPECT_TRUE(statuses[i].ok()) << statuses[i].error_message();
+        EXPECT_EQ(responses[i], "default");
+    }
+    EXPECT_EQ(m_default.calls(), 1);
+
+    auto statistics = m_proxy.statistics(DEFAULT_METHOD);
+    EXPECT_EQ(statistics.calls, 1u);
+    EXPECT_EQ(statistics.coalesced_calls, static_cast<uint64_t>(CALL_COUNT - 1));
+}
+
+TEST_F(UpstreamProxyTest, DifferentCallsNotCoalesced) {
+    m_default.setReply(std::chrono::milliseconds(200));
+    m_proxy.setCoalescingEnabled(DEFAULT_METHOD, true);
+
+    grpc::Status first_status;
+    grpc::Status second_status;
+    std::string first_response;
+    std::string second_response;
+    std::thread first_thread([&]() { first_status = forward(DEFAULT_METHOD, first_response, "first"); });
+    std::thread second_thread([&]() { second_status = forward(DEFAULT_METHOD, second_response, "second"); });
+    first_thread.join();
+    second_thread.join();
+
+    EXPECT_TRUE(first_status.ok()) << first_status.error_message();
+    EXPECT_TRUE(second_status.ok()) << second_status.error_message();
+    EXPECT_EQ(m_default.calls(), 2);
+    EXPECT_EQ(m_proxy.statistics(DEFAULT_METHOD).coalesced_calls, 0u);
+}
+
+TEST_F(UpstreamProxyTest, SequentialCallsNotCoalesced) {
+    m_proxy.setCoalescingEnabled(DEFAULT_METHOD, true);
+
+    std::string response;
+    ASSERT_TRUE(forward(DEFAULT_METHOD, response).ok());
+    ASSERT_TRUE(forward(DEFAULT_METHOD, response).ok());
+
+    // A finished flight is not reused by the later calls
+    EXPECT_EQ(m_default.calls(), 2);
+    EXPECT_EQ(m_proxy.statistics(DEFAULT_METHOD).coalesced_calls, 0u);
+}
@@ -0,0 +1,363 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include <gtest/gtest.h>
+
+#include "upstream_router.h"
+
+namespace {
+
+const auto LATENCY = std::chrono::microseconds(1000);
+const grpc::Status UNAVAILABLE_STATUS(grpc::StatusCode::UNAVAILABLE, "unavailable");
+
+const char UPSTREAMS_XML[] = R"(<?xml version="1.0" encoding="utf-8"?>
+<root>
+    <upstreams consecutive_failures="3" ejection_time_ms="1000">
+        <group name="orders">
+            <endpoint target="orders-1:443"/>
+            <endpoint target="orders-2:443"/>
+        </group>
+        <group name="users">
+            <endpoint target="users-1:443"/>
+        </group>
+        <route prefix="shop" group="orders"/>
+        <route prefix="shop.Users" group="users"/>
+    </upstreams>
+</root>
+)";
+
+// The channels are never connected: the router only hands them over
+class UpstreamRouterTest : public ::testing::Test {
+protected:
+    std::vector<std::string> m_created_channels;
+    UpstreamRouter m_router { [this](const std::string &target) {
+        m_created_channels.push_back(target);
+        return grpc::CreateChannel(target, grpc::InsecureChannelCredentials());
+    } };
+
+    std::string pickTarget(const std::string &method) {
+        auto endpoint = m_router.pick(method, nullptr);
+        if (!endpoint) return "";
+        m_router.release(endpoint, LATENCY, grpc::Status::OK);
+        return endpoint->target;
+    }
+
+    // Both endpoints of a two endpoint group, with a latency set
+    void pickBoth(const std::string &method, std::shared_ptr<UpstreamRouter::Endpoint> &first, std::shared_ptr<UpstreamRouter::Endpoint> &second) {
+        first = m_router.pick(method, nullptr);
+        second = m_router.pick(method, first.get());
+        ASSERT_TRUE(first && second);
+        ASSERT_NE(first, second);
+        m_router.release(first, LATENCY, grpc::Status::OK);
+        m_router.release(second, LATENCY, grpc::Status::OK);
+    }
+
+    void fail(const std::string &method, const std::shared_ptr<UpstreamRouter::Endpoint> &endpoint, const std::shared_ptr<UpstreamRouter::Endpoint> &other) {
+        auto picked = m_router.pick(method, other.get());
+        ASSERT_EQ(picked, endpoint);
+        m_router.release(picked, LATENCY, UNAVAILABLE_STATUS);
+    }
+};
+
+} // anonymous namespace
+
+TEST_F(UpstreamRouterTest, UnroutedMethodNotPicked) {
+    ASSERT_TRUE(m_router.addGroup("group", { "endpoint:443" }));
+    ASSERT_TRUE(m_router.addRoute("package.Service", "group"));
+
+    EXPECT_EQ(m_router.pick("package.Other/Method", nullptr), nullptr);
+    EXPECT_EQ(m_router.pick("package.ServiceX/Method", nullptr), nullptr);
+}
+
+TEST_F(UpstreamRouterTest, LongestPrefixWins) {
+    ASSERT_TRUE(m_router.addGroup("package", { "package:443" }));
+    ASSERT_TRUE(m_router.addGroup("service", { "service:443" }));
+    ASSERT_TRUE(m_router.addGroup("method", { "method:443" }));
+    ASSERT_TRUE(m_router.addRoute("package", "package"));
+    ASSERT_TRUE(m_router.addRoute("package.Service/Method", "method"));
+    ASSERT_TRUE(m_router.addRoute("package.Service", "service"));
+
+    EXPECT_EQ(pickTarget("package.Service/Method"), "method:443");
+    EXPECT_EQ(pickTarget("package.Service/Other"), "service:443");
+    EXPECT_EQ(pickTarget("package.Other/Method"), "package:443");
+    EXPECT_EQ(pickTarget("package.sub.Service/Method"), "package:443");
+    EXPECT_EQ(pickTarget("packageX.Service/Method"), "");
+}
+
+TEST_F(UpstreamRouterTest, InvalidConfigurationRejected) {
+    EXPECT_FALSE(m_router.addGroup("", { "endpoint:443" }));
+    EXPECT_FALSE(m_router.addGroup("group", {}));
+    ASSERT_TRUE(m_router.addGroup("group", { "endpoint:443" }));
+    EXPECT_FALSE(m_router.addGroup("group", { "other:443" }));
+    EXPECT_FALSE(m_router.addRoute("package", "unknown"));
+    EXPECT_FALSE(m_router.addRoute("", "group"));
+}
+
+TEST_F(UpstreamRouterTest, ChannelsCreatedOnFirstUse) {
+    ASSERT_TRUE(m_router.addGroup("group", { "first:443", "second:443" }));
+    ASSERT_TRUE(m_router.addRoute("package", "group"));
+    EXPECT_TRUE(m_created_channels.empty());
+
+    pickTarget("package.Service/Method");
+    pickTarget("package.Service/Method");
+    EXPECT_EQ(m_created_channels, (std::vector<std::string> { "first:443", "second:443" }));
+    EXPECT_EQ(m_router.channels().size(), 2u);
+    EXPECT_EQ(m_created_channels.size(), 2u);
+}
+
+TEST_F(UpstreamRouterTest, LowerLatencyPreferred) {
+    ASSERT_TRUE(m_router.addGroup("group", { "slow:443", "fast:443" }));
+    ASSERT_TRUE(m_router.addRoute("package", "group"));
+
+    auto slow = m_router.pick("package.Service/Method", nullptr);
+    auto fast = m_router.pick("package.Service/Method", slow.get());
+    ASSERT_EQ(slow->target, "slow:443");
+    ASSERT_EQ(fast->target, "fast:443");
+    m_router.release(slow, LATENCY * 10, grpc::Status::OK);
+    m_router.release(fast, LATENCY, grpc::Status::OK);
+
+    for (int i = 0; i < 4; ++i) EXPECT_EQ(pickTarget("package.Service/Method"), "fast:443");
+    EXPECT_DOUBLE_EQ(m_router.statistics("slow:443").latency_ewma_us, 10000.0);
+}
+
+TEST_F(UpstreamRouterTest, OutstandingCallsPenalized) {
+    ASSERT_TRUE(m_router.addGroup("group", { "first:443", "second:443" }));
+    ASSERT_TRUE(m_router.addRoute("package", "group"));
+
+    auto first = m_router.pick("package.Service/Method", nullptr);
+    auto second = m_router.pick("package.Service/Method", first.get());
+    m_router.release(first, LATENCY, grpc::Status::OK);
+    m_router.release(second, LATENCY * 3 / 2, grpc::Status::OK);
+
+    auto busy = m_router.pick("package.Service/Method", nullptr);
+    ASSERT_EQ(busy, first);
+    EXPECT_EQ(m_router.statistics("first:443").in_flight, 1u);
+    // The faster endpoint with a call in progress scores worse than the idle slower one
+    EXPECT_EQ(pickTarget("package.Service/Method"), "second:443");
+
+    m_router.release(busy, LATENCY, grpc::Status::OK);
+    EXPECT_EQ(m_router.statistics("first:443").in_flight, 0u);
+}
+
+TEST_F(UpstreamRouterTest, PreviousEndpointExcluded) {
+    ASSERT_TRUE(m_router.addGroup("group", { "first:443", "second:443" }));
+    ASSERT_TRUE(m_router.addRoute("package", "group"));
+
+    std::shared_ptr<UpstreamRouter::Endpoint> first;
+    std::shared_ptr<UpstreamRouter::Endpoint> second;
+    pickBoth("package.Service/Method", first, second);
+
+    for (int i = 0; i < 4; ++i) {
+        auto endpoint = m_router.pick("package.Service/Method", first.get());
+        EXPECT_EQ(endpoint, second);
+        m_router.release(endpoint, LATENCY, grpc::Status::OK);
+    }
+}
+
+TEST_F(UpstreamRouterTest, SingleEndpointNotExcluded) {
+    ASSERT_TRUE(m_router.addGroup("group", { "single:443" }));
+    ASSERT_TRUE(m_router.addRoute("package", "group"));
+
+    auto first = m_router.pick("package.Service/Method", nullptr);
+    auto second = m_router.pick("package.Service/Method", first.get());
+    EXPECT_EQ(first, second);
+    m_router.release(first, LATENCY, grpc::Status::OK);
+    m_router.release(second, LATENCY, grpc::Status::OK);
+}
+
+TEST_F(UpstreamRouterTest, FailingEndpointEjected) {
+    ASSERT_TRUE(m_router.addGroup("group", { "failing:443", "healthy:443" }));
+    ASSERT_TRUE(m_router.addRoute("package", "group"));
+    m_router.setEjectionPolicy(2, 60000);
+
+    std::shared_ptr<UpstreamRouter::Endpoint> failing;
+    std::shared_ptr<UpstreamRouter::Endpoint> healthy;
+    pickBoth("package.Service/Method", failing, healthy);
+
+    fail("package.Service/Method", failing, healthy);
+    EXPECT_FALSE(m_router.statistics("failing:443").ejected);
+    fail("package.Service/Method", failing, healthy);
+
+    auto statistics = m_router.statistics("failing:443");
+    EXPECT_TRUE(statistics.ejected);
+    EXPECT_EQ(statistics.ejections, 1u);
+    EXPECT_EQ(statistics.failed_calls, 2u);
+
+    // Even the lowest latency doesn't bring the ejected endpoint back
+    for (int i = 0; i < 4; ++i) EXPECT_EQ(pickTarget("package.Service/Method"), "healthy:443");
+}
+
+TEST_F(UpstreamRouterTest, SuccessResetsFailureCount) {
+    ASSERT_TRUE(m_router.addGroup("group", { "flaky:443", "healthy:443" }));
+    ASSERT_TRUE(m_router.addRoute("package", "group"));
+    m_router.setEjectionPolicy(2, 60000);
+
+    std::shared_ptr<UpstreamRouter::Endpoint> flaky;
+    std::shared_ptr<UpstreamRouter::Endpoint> healthy;
+    pickBoth("package.Service/Method", flaky, healthy);
+
+    fail("package.Service/Method", flaky, healthy);
+    auto picked = m_router.pick("package.Service/Method", healthy.get());
+    m_router.release(picked, LATENCY, grpc::Status::OK);
+    fail("package.Service/Method", flaky, healthy);
+
+    EXPECT_FALSE(m_router.statistics("flaky:443").ejected);
+}
+
+TEST_F(UpstreamRouterTest, RequestFailuresNotCounted) {
+    ASSERT_TRUE(m_router.addGroup("group", { "endpoint:443" }));
+    ASSERT_TRUE(m_router.addRoute("package", "group"));
+    m_router.setEjectionPolicy(1, 60000);
+
+    for (auto code : { grpc::StatusCode::NOT_FOUND, grpc::StatusCode::INVALID_ARGUMENT, grpc::StatusCode::CANCELLED }) {
+        auto endpoint = m_router.pick("package.Service/Method", nullptr);
+        m_router.release(endpoint, LATENCY, grpc::Status(code, "request failure"));
+    }
+
+    auto statistics = m_router.statistics("endpoint:443");
+    EXPECT_EQ(statistics.calls, 3u);
+    EXPECT_EQ(statistics.failed_calls, 0u);
+    EXPECT_FALSE(statistics.ejected);
+}
+
+TEST_F(UpstreamRouterTest, CancelledCallLatencyIgnored) {
+    ASSERT_TRUE(m_router.addGroup("group", { "endpoint:443" }));
+    ASSERT_TRUE(m_router.addRoute("package", "group"));
+
+    auto endpoint = m_router.pick("package.Service/Method", nullptr);
+    m_router.release(endpoint, LATENCY * 100, grpc::Status::CANCELLED);
+
+    EXPECT_DOUBLE_EQ(m_router.statistics("endpoint:443").latency_ewma_us, 0.0);
+}
+
+TEST_F(UpstreamRouterTest, EjectedEndpointPickedWhenAllEjected) {
+    ASSERT_TRUE(m_router.addGroup("group", { "endpoint:443" }));
+    ASSERT_TRUE(m_router.addRoute("package", "group"));
+    m_router.setEjectionPolicy(1, 60000);
+
+    auto endpoint = m_router.pick("package.Service/Method", nullptr);
+    m_router.release(endpoint, LATENCY, UNAVAILABLE_STATUS);
+    ASSERT_TRUE(m_router.statistics("endpoint:443").ejected);
+
+    EXPECT_EQ(pickTarget("package.Service/Method"), "endpoint:443");
+}
+
+TEST_F(UpstreamRouterTest, EjectionExpiresAndGrows) {
+    ASSERT_TRUE(m_router.addGroup("group", { "failing:443", "healthy:443" }));
+    ASSERT_TRUE(m_router.addRoute("package", "group"));
+    m_router.setEjectionPolicy(2, 20);
+
+    std::shared_ptr<UpstreamRouter::Endpoint> failing;
+    std::shared_ptr<UpstreamRouter::Endpoint> healthy;
+    pickBoth("package.Service/Method", failing, healthy);
+
+    fail("package.Service/Method", failing, healthy);
+    fail("package.Service/Method", failing, healthy);
+    ASSERT_TRUE(m_router.statistics("failing:443").ejected);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(m_router.statistics("failing:443").ejected);
+
+    // Back from the ejection, a single failure is enough to eject it again
+    fail("package.Service/Method", failing, healthy);
+    auto statistics = m_router.statistics("failing:443");
+    EXPECT_TRUE(statistics.ejected);
+    EXPECT_EQ(statistics.ejections, 2u);
+}
+
+TEST_F(UpstreamRouterTest, XmlConfigurationLoaded) {
+    std::string error;
+    ASSERT_TRUE(m_router.parseXml(UPSTREAMS_XML, error)) << error;
+
+    EXPECT_EQ(pickTarget("shop.Users/Get"), "users-1:443");
+    EXPECT_EQ(pickTarget("shop.Orders/Get").substr(0, 7), "orders-");
+    EXPECT_EQ(pickTarget("bank.Accounts/Get"), "");
+
+    // consecutive_failures="3"
+    auto endpoint = m_router.pick("shop.Users/Get", nullptr);
+    m_router.release(endpoint, LATENCY, UNAVAILABLE_STATUS);
+    endpoint = m_router.pick("shop.Users/Get", nullptr);
+    m_router.release(endpoint, LATENCY, UNAVAILABLE_STATUS);
+    EXPECT_FALSE(m_router.statistics("users-1:443").ejected);
+    endpoint = m_router.pick("shop.Users/Get", nullptr);
+    m_router.release(endpoint, LATENCY, UNAVAILABLE_STATUS);
+    EXPECT_TRUE(m_router.statistics("users-1:443").ejected);
+}
+
+TEST_F(UpstreamRouterTest, XmlConfigurationReplaced) {
+    ASSERT_TRUE(m_router.addGroup("group", { "previous:443" }));
+    ASSERT_TRUE(m_router.addRoute("bank", "group"));
+
+    std::string error;
+    ASSERT_TRUE(m_router.parseXml(UPSTREAMS_XML, error)) << error;
+
+    EXPECT_EQ(pickTarget("bank.Accounts/Get"), "");
+    EXPECT_EQ(pickTarget("shop.Users/Get"), "users-1:443");
+}
+
+TEST_F(UpstreamRouterTest, InvalidXmlKeepsConfiguration) {
+    std::string error;
+    ASSERT_TRUE(m_router.parseXml(UPSTREAMS_XML, error)) << error;
+
+    const std::vector<std::string> invalid_configurations = {
+        "<root><upstreams>",
+        "<root/>",
+        R"(<upstreams consecutive_failures="0"/>)",
+        R"(<upstreams ejection_time_ms="-1"/>)",
+        R"(<upstreams><group name="empty"/></upstreams>)",
+        R"(<upstreams><group><endpoint target="a:443"/></group></upstreams>)",
+        R"(<upstreams>
+            <group name="same"><endpoint target="a:443"/></group>
+            <group name="same"><endpoint target="b:443"/></group>
+        </upstreams>)",
+        R"(<upstreams>
+            <group name="group"><endpoint target="a:443"/></group>
+            <route prefix="bank" group="unknown"/>
+        </upstreams>)",
+        R"(<upstreams>
+            <group name="group"><endpoint target="a:443"/></group>
+            <route group="group"/>
+        </upstreams>)"
+    };
+    for (const auto &data : invalid_configurations) {
+        error.clear();
+        EXPECT_FALSE(m_router.parseXml(data, error)) << data;
+        EXPECT_FALSE(error.empty()) << data;
+    }
+
+    EXPECT_EQ(pickTarget("shop.Users/Get"), "users-1:443");
+    EXPECT_EQ(pickTarget("bank.Accounts/Get"), "");
+}
+
+TEST_F(UpstreamRouterTest, ClearedRoutesNotPicked) {
+    std::string error;
+    ASSERT_TRUE(m_router.parseXml(UPSTREAMS_XML, error)) << error;
+
+    auto endpoint = m_router.pick("shop.Users/Get", nullptr);
+    m_router.clear();
+    EXPECT_EQ(m_router.pick("shop.Users/Get", nullptr), nullptr);
+
+    // The endpoint of the call in progress is still valid
+    m_router.release(endpoint, LATENCY, grpc::Status::OK);
+    EXPECT_EQ(endpoint->statistics.calls, 1u);
+}
@@ -0,0 +1,111 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <future>
+#include <chrono>
+
+#include <gtest/gtest.h>
+#include <grpcpp/generic/generic_stub.h>
+#include <grpcpp/generic/async_generic_service.h>
+
+#include "warm_up.h"
+#include "test_upstream.h"
+
+namespace {
+
+const char TEST_METHOD[] = "test.Service/Method";
+
+// Answers every call with an empty message, counting the calls recognised as the warm-up ones
+class WarmUpServer : public grpc::CallbackGenericService {
+    std::unique_ptr<grpc::Server> m_server;
+
+    class Reactor : public grpc::ServerGenericBidiReactor {
+        grpc::ByteBuffer m_request;
+        grpc::ByteBuffer m_response;
+
+    public:
+        Reactor(WarmUpServer *server, grpc::GenericCallbackServerContext *context) {
+            if (isWarmUpCall(context)) ++server->m_warm_up_calls;
+            ++server->m_calls;
+            StartRead(&m_request);
+        }
+
+        void OnReadDone(bool ok) override {
+            m_response = makeByteBuffer("");
+            StartWriteAndFinish(&m_response, grpc::WriteOptions(), grpc::Status::OK);
+        }
+
+        void OnDone() override {
+            delete this;
+        }
+    };
+
+public:
+    std::atomic<int> m_calls = 0;
+    std::atomic<int> m_warm_up_calls = 0;
+
+    WarmUpServer() {
+        grpc::ServerBuilder builder;
+        builder.RegisterCallbackGenericService(this);
+        m_server = builder.BuildAndStart();
+    }
+
+    ~WarmUpServer() override {
+        m_server->Shutdown();
+    }
+
+    std::shared_ptr<grpc::Channel> channel() {
+        return m_server->InProcessChannel(grpc::ChannelArguments());
+    }
+
+    grpc::ServerGenericBidiReactor *CreateReactor(grpc::GenericCallbackServerContext *context) override {
+        return new Reactor(this, context);
+    }
+};
+
+} // anonymous namespace
+
+TEST(WarmUpTest, WarmUpRequestsRecognised) {
+    WarmUpServer server;
+    std::vector<WarmUpRequest> requests { { TEST_METHOD, "" }, { TEST_METHOD, "" } };
+
+    EXPECT_EQ(sendWarmUpRequests(server.channel(), requests, std::chrono::seconds(5)), 2u);
+    EXPECT_EQ(server.m_calls.load(), 2);
+    EXPECT_EQ(server.m_warm_up_calls.load(), 2);
+}
+
+TEST(WarmUpTest, ForgedMetadataIgnored) {
+    WarmUpServer server;
+    grpc::GenericStub stub(server.channel());
+
+    grpc::ClientContext context;
+    context.AddMetadata(WARM_UP_METADATA_KEY, "1");
+    auto request = makeByteBuffer("");
+    grpc::ByteBuffer response;
+    std::promise<grpc::Status> finished;
+    stub.UnaryCall(&context, std::string("/") + TEST_METHOD, grpc::StubOptions(), &request, &response, [&](grpc::Status status) {
+        finished.set_value(status);
+    });
+
+    EXPECT_TRUE(finished.get_future().get().ok());
+    EXPECT_EQ(server.m_calls.load(), 1);
+    EXPECT_EQ(server.m_warm_up_calls.load(), 0);
+}
@@ -0,0 +1,73 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Compiles the fixtures of a dataset into the bundle loaded by the mock server (see loadDatasetBundle)
+
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <filesystem>
+
+#include <argparse/argparse.hpp>
+
+#include "../src/grpc_mock_server_library.h"
+
+int main(int argc, char *argv[]) {
+    argparse::ArgumentParser program("grpc-mock-server-bundle");
+    program.add_argument("config")
+        .help("configuration XML file with the datasets");
+    program.add_argument("dataset")
+        .help("name of the dataset to compile");
+    program.add_argument("output")
+        .help("bundle file to create");
+    program.add_argument("--base-dir")
+        .help("directory the relative fixture paths are resolved against; the configuration file directory by default")
+        .default_value(std::string());
+
+    try {
+        program.parse_args(argc, argv);
+    }
+    catch (const std::runtime_error &error) {
+        std::cerr << error.what() << std::endl << program;
+        return 1;
+    }
+
+    auto config_path = program.get<std::string>("config");
+    std::ifstream config_file(config_path, std::ios::binary);
+    if (!config_file) {
+        std::cerr << "Unable to open '" << config_path << "'" << std::endl;
+        return 1;
+    }
+    std::stringstream config_data;
+    config_data << config_file.rdbuf();
+
+    auto base_directory = program.get<std::string>("--base-dir");
+    if (base_directory.empty()) {
+        base_directory = std::filesystem::absolute(config_path).parent_path().string();
+    }
+
+    // The errors are reported by the library logger
+    bool ok = grpc_mock_server::compileDatasetBundle(
+        config_data.str(),
+        program.get<std::string>("dataset"),
+        base_directory,
+        program.get<std::string>("output")
+    );
+    return ok ? 0 : 1;
+}
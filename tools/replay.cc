@@ -0,0 +1,302 @@
+/*
+ *
+ * Copyright 2018 gRPC authors, 2022-2023 Aleksandr Kamyshnikov
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// Re-issues the calls recorded by the mock server traffic capture against a gRPC server,
+// either at the original timing (optionally sped up) or open-loop at a fixed rate,
+// and reports the latency distribution.
+// The latency is measured from the time the call was scheduled to be sent rather than from
+// the time it was actually sent, so that a saturated client or server doesn't hide the queueing delay
+
+#include <cstdio>
+#include <cmath>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <map>
+
+#include <argparse/argparse.hpp>
+
+#include <grpc++/grpc++.h>
+#include <grpcpp/generic/generic_stub.h>
+
+#include "../src/capture_segment.h"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct ScheduledCall {
+    const CaptureRecord *record = nullptr;
+    Clock::duration offset { 0 };
+};
+
+struct PendingCall {
+    grpc::ClientContext context;
+    grpc::ByteBuffer response;
+    grpc::Status status;
+    std::unique_ptr<grpc::GenericClientAsyncResponseReader> reader;
+    Clock::time_point scheduled_at;
+};
+
+struct WorkerResult {
+    std::vector<int64_t> latencies_us;
+    std::map<int, uint64_t> errors;
+    Clock::duration max_send_lag { 0 };
+};
+
+// The transport sets these itself, replaying them would fail the call or confuse the server
+bool isReservedMetadata(std::string_view key) {
+    return key.empty()
+        || key.front() == ':'
+        || key.starts_with("grpc-")
+        || key == "content-type"
+        || key == "user-agent"
+        || key == "te";
+}
+
+void finishCall(PendingCall *call, WorkerResult &result) {
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - call->scheduled_at);
+    result.latencies_us.push_back(latency.count());
+    if (!call->status.ok()) ++result.errors[call->status.error_code()];
+    delete call;
+}
+
+void runWorker(
+    const std::shared_ptr<grpc::Channel> &channel,
+    const std::vector<ScheduledCall> &calls,
+    size_t worker_index,
+    size_t worker_count,
+    Clock::time_point start_time,
+    std::chrono::milliseconds timeout,
+    WorkerResult &result
+) {
+    grpc::GenericStub stub(channel);
+    grpc::CompletionQueue completion_queue;
+    size_t in_flight = 0;
+
+    auto drain_until = [&](Clock::time_point deadline) {
+        // The completion queue only accepts the system clock deadlines
+        auto system_deadline = std::chrono::system_clock::now()
+            + std::chrono::duration_cast<std::chrono::system_clock::duration>(deadline - Clock::now());
+        void *tag = nullptr;
+        bool ok = false;
+        while (in_flight > 0) {
+            auto next_status = completion_queue.AsyncNext(&tag, &ok, system_deadline);
+            if (next_status != grpc::CompletionQueue::GOT_EVENT) break;
+            finishCall(static_cast<PendingCall*>(tag), result);
+            --in_flight;
+        }
+    };
+
+    std::string method;
+    for (size_t i = worker_index; i < calls.size(); i += worker_count) {
+        const auto &call = calls[i];
+        auto scheduled_at = start_time + call.offset;
+
+        // Collect the replies while waiting for the time to send the next call
+        drain_until(scheduled_at);
+        std::this_thread::sleep_until(scheduled_at);
+        result.max_send_lag = std::max(result.max_send_lag, Clock::now() - scheduled_at);
+
+        auto *pending_call = new PendingCall();
+        pending_call->scheduled_at = scheduled_at;
+        pending_call->context.set_deadline(std::chrono::system_clock::now() + timeout);
+        for (const auto &[key, value] : call.record->metadata) {
+            if (isReservedMetadata(key)) continue;
+            pending_call->context.AddMetadata(std::string(key), std::string(value));
+        }
+
+        grpc::Slice payload_slice(call.record->payload.data(), call.record->payload.size());
+        grpc::ByteBuffer request(&payload_slice, 1);
+
+        method.assign("/");
+        method.append(call.record->method);
+        pending_call->reader = stub.PrepareUnaryCall(&pending_call->context, method, request, &completion_queue);
+        pending_call->reader->StartCall();
+        pending_call->reader->Finish(&pending_call->response, &pending_call->status, pending_call);
+        ++in_flight;
+    }
+
+    // Every call has a deadline, so the remaining replies arrive in bounded time
+    completion_queue.Shutdown();
+
+    void *tag = nullptr;
+    bool ok = false;
+    while (completion_queue.Next(&tag, &ok)) {
+        finishCall(static_cast<PendingCall*>(tag), result);
+    }
+}
+
+int64_t percentile(const std::vector<int64_t> &sorted_values, double value) {
+    if (sorted_values.empty()) return 0;
+
+    auto index = static_cast<size_t>(std::ceil(value / 100.0 * sorted_values.size()));
+    return sorted_values[std::clamp<size_t>(index, 1, sorted_values.size()) - 1];
+}
+
+std::shared_ptr<grpc::ChannelCredentials> createCredentials(const std::string &ca_cert_path) {
+    if (ca_cert_path.empty()) return grpc::InsecureChannelCredentials();
+
+    std::ifstream file(ca_cert_path);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+
+    grpc::SslCredentialsOptions ssl_options;
+    ssl_options.pem_root_certs = buffer.str();
+    return grpc::SslCredentials(ssl_options);
+}
+
+} // anonymous namespace
+
+int main(int argc, char *argv[]) {
+    argparse::ArgumentParser program("grpc-mock-server-replay");
+    program.add_argument("target")
+        .help("server address, e.g. localhost:50051");
+    program.add_argument("capture")
+        .help("capture directory or a single segment file");
+    program.add_argument("--speed")
+        .help("replay the original timing N times faster")
+        .default_value(1.0)
+        .scan<'g', double>();
+    program.add_argument("--rate")
+        .help("ignore the original timing and send the calls at a fixed rate (calls per second)")
+        .default_value(0.0)
+        .scan<'g', double>();
+    program.add_argument("--threads")
+        .help("number of worker threads, every one has its own connection")
+        .default_value(static_cast<int>(std::max(1u, std::thread::hardware_concurrency())))
+        .scan<'i', int>();
+    program.add_argument("--timeout-ms")
+        .help("deadline of every call")
+        .default_value(10000)
+        .scan<'i', int>();
+    program.add_argument("--ca-cert")
+        .help("PEM file with the root certificates; plaintext connection is used if not set")
+        .default_value(std::string());
+
+    try {
+        program.parse_args(argc, argv);
+    }
+    catch (const std::runtime_error &error) {
+        std::cerr << error.what() << std::endl << program;
+        return 1;
+    }
+
+    auto speed = program.get<double>("--speed");
+    auto rate = program.get<double>("--rate");
+    auto thread_count = static_cast<size_t>(std::max(1, program.get<int>("--threads")));
+    auto timeout = std::chrono::milliseconds(std::max(1, program.get<int>("--timeout-ms")));
+    if (speed <= 0.0 || rate < 0.0) {
+        std::fprintf(stderr, "--speed must be positive and --rate must not be negative\n");
+        return 1;
+    }
+
+    // The segments stay mapped for the whole replay: the records point directly into them
+    std::vector<CaptureSegmentReader> readers;
+    std::vector<CaptureRecord> records;
+    for (const auto &segment_path : listCaptureSegments(program.get<std::string>("capture"))) {
+        std::string error;
+        auto &reader = readers.emplace_back();
+        if (!reader.open(segment_path, error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+
+        CaptureRecord record;
+        while (reader.next(record)) records.push_back(record);
+        if (reader.truncated()) {
+            std::fprintf(stderr, "Segment '%s' has a truncated tail, skipped\n", segment_path.string().c_str());
+        }
+    }
+    if (records.empty()) {
+        std::fprintf(stderr, "No captured calls found\n");
+        return 1;
+    }
+
+    // Concurrent calls may have been written slightly out of order
+    std::stable_sort(records.begin(), records.end(), [](const CaptureRecord &lhs, const CaptureRecord &rhs) {
+        return lhs.arrival_time_ns < rhs.arrival_time_ns;
+    });
+
+    std::vector<ScheduledCall> calls(records.size());
+    for (size_t i = 0; i < records.size(); ++i) {
+        calls[i].record = &records[i];
+        if (rate > 0.0) {
+            calls[i].offset = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(i / rate));
+        }
+        else {
+            auto original_offset = std::chrono::nanoseconds(records[i].arrival_time_ns - records.front().arrival_time_ns);
+            calls[i].offset = std::chrono::duration_cast<Clock::duration>(original_offset / speed);
+        }
+    }
+
+    std::vector<std::shared_ptr<grpc::Channel>> channels;
+    auto credentials = createCredentials(program.get<std::string>("--ca-cert"));
+    for (size_t i = 0; i < thread_count; ++i) {
+        // Without the local subchannel pool the channels would share a single connection
+        grpc::ChannelArguments channel_args;
+        channel_args.SetInt(GRPC_ARG_USE_LOCAL_SUBCHANNEL_POOL, 1);
+        channels.push_back(grpc::CreateCustomChannel(program.get<std::string>("target"), credentials, channel_args));
+    }
+
+    std::printf("Replaying %zu calls with %zu threads\n", calls.size(), thread_count);
+
+    std::vector<WorkerResult> results(thread_count);
+    std::vector<std::thread> workers;
+    auto start_time = Clock::now() + std::chrono::milliseconds(100);
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers.emplace_back(runWorker, channels[i], std::cref(calls), i, thread_count, start_time, timeout, std::ref(results[i]));
+    }
+    for (auto &worker : workers) worker.join();
+    auto elapsed = std::chrono::duration<double>(Clock::now() - start_time).count();
+
+    std::vector<int64_t> latencies_us;
+    std::map<int, uint64_t> errors;
+    Clock::duration max_send_lag { 0 };
+    for (const auto &result : results) {
+        latencies_us.insert(latencies_us.end(), result.latencies_us.begin(), result.latencies_us.end());
+        for (const auto &[code, count] : result.errors) errors[code] += count;
+        max_send_lag = std::max(max_send_lag, result.max_send_lag);
+    }
+    std::sort(latencies_us.begin(), latencies_us.end());
+
+    uint64_t error_count = 0;
+    for (const auto &[code, count] : errors) error_count += count;
+
+    std::printf("Completed: %zu calls in %.3f s (%.1f calls/s), %llu failed\n",
+        latencies_us.size(), elapsed, latencies_us.size() / elapsed, static_cast<unsigned long long>(error_count));
+    for (const auto &[code, count] : errors) {
+        std::printf("  status %d: %llu\n", code, static_cast<unsigned long long>(count));
+    }
+    std::printf("Latency (ms): p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f\n",
+        percentile(latencies_us, 50.0) / 1000.0,
+        percentile(latencies_us, 90.0) / 1000.0,
+        percentile(latencies_us, 99.0) / 1000.0,
+        percentile(latencies_us, 99.9) / 1000.0,
+        (latencies_us.empty() ? 0 : latencies_us.back()) / 1000.0);
+    std::printf("Max send lag: %.3f ms%s\n",
+        std::chrono::duration<double, std::milli>(max_send_lag).count(),
+        max_send_lag > std::chrono::milliseconds(10) ? " (the client could not keep up, consider more threads)" : "");
+
+    return error_count == 0 ? 0 : 2;
+}